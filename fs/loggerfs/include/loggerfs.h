@@ -3,29 +3,311 @@
 
 #include <linux/fs.h>
 #include <linux/types.h>
+#include <linux/llist.h>
+#include <linux/workqueue.h>
+#include <linux/refcount.h>
+#include <linux/rcupdate.h>
+#include <linux/rwsem.h>
+#include <linux/path.h>
+#include <linux/cred.h>
+#include <linux/shrinker.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/errseq.h>
+#include <linux/xarray.h>
+#include <linux/ktime.h>
+#include "loggerfs_ioctl.h"
 
 /* LoggerFS 魔数和常量 */
 #define LOGGERFS_MAGIC 0x858458f6
-#define MAX_LOG_SIZE 4096
-#define MAX_LOG_ENTRIES 50
 
-/* ioctl 命令定义 */
-#define READLOG_CMD 0x1000
-#define REVERT_CMD 0x2000
+/* 日志容量（可通过挂载选项logsize=、logentries=和每文件的ioctl修改） */
+#define LOGGERFS_LOG_SEG_SIZE 4096              // 日志内存分段大小
+#define LOGGERFS_DEFAULT_LOG_SIZE 4096          // 默认日志容量：一个磁盘块（题目要求）
+#define LOGGERFS_MIN_LOG_SIZE LOGGERFS_LOG_SEG_SIZE
+#define LOGGERFS_MAX_LOG_SIZE (16 << 20)
+#define LOGGERFS_DEFAULT_LOG_ENTRIES 0          // 记录数上限，0为不限制
 
-/* 日志边界标记 */
+/* 读日志策略的默认采样间隔（ioctl接口和策略取值见loggerfs_ioctl.h） */
+#define LOGGERFS_DEFAULT_READ_SAMPLE 16
+
+/*
+ * 定长二进制日志记录（v4），所有字段小端存储。
+ * 命令路径不存放在记录中，而是记录命令表中的槽位，文本只在READLOG时生成
+ */
+struct loggerfs_log_record {
+	__le64 seq;             // 记录序号（每个文件单调递增）
+	__le64 time;            // 访问时间（纳秒）
+	__le64 offset;          // 起始位置
+	__le32 length;          // 数据长度
+	__le16 op;              // LOGGERFS_OP_*
+	__u8 cmd;               // 命令表槽位，LOGGERFS_CMD_NONE表示未知
+	__u8 flags;             // LOGGERFS_REC_*
+} __packed;
+
+#define LOGGERFS_REC_SIZE sizeof(struct loggerfs_log_record)
+
+/* 去重的命令路径表：固定槽位，每槽存放以NUL结尾的路径（超长路径截断） */
+#define LOGGERFS_CMD_SLOTS 16
+#define LOGGERFS_CMD_SLOT_SIZE 256
+#define LOGGERFS_CMD_TABLE_SIZE (LOGGERFS_CMD_SLOTS * LOGGERFS_CMD_SLOT_SIZE)
+#define LOGGERFS_CMD_NONE 0xff
+/* loggerfs_log_cmd_slot的dirty_slots中表示旧记录的命令被清除、需要重写记录区域的位 */
+#define LOGGERFS_CMD_DIRTY_RECORDS LOGGERFS_CMD_SLOTS
+
+/* 日志边界标记（v1格式，仅用于兼容读取旧文件） */
 #define LOG_START_MARKER "<<<LOGGERFS_LOG_START>>>\n"
 #define LOG_END_MARKER "<<<LOGGERFS_LOG_END>>>\n"
 #define LOG_MARKER_LEN 26
 
-/* 原始数据备份结构 */
-struct backup_data {
-	loff_t offset;          // 备份数据的偏移位置
-	size_t length;          // 备份数据的长度
-	char *original_data;    // 原始数据内容
-	bool is_valid;          // 备份是否有效
+/*
+ * 磁盘格式版本
+ * v1: 日志用文本标记包围，需要扫描文件才能定位
+ * v2: 文件物理末尾为定长二进制尾部，记录日志位置，从尾部读一个块即可定位
+ * v3: 日志区域是固定容量的环形缓冲区，尾部另外记录最旧记录的位置
+ *     (log_head)和有效字节数(log_used)；日志满时只淘汰最旧的整条记录
+ * v4: 环形缓冲区中是定长二进制记录（struct loggerfs_log_record），
+ *     日志区域前是命令表；v1～v3的文本日志在首次加载时转换为v4
+ * v5: 命令表从数据末尾向上对齐到页边界开始，数据最后一页的其余部分是填充，
+ *     mmap映射的页面中不会有日志。填充长度由物理大小推算，v4文件首次加载时重写为v5
+ *
+ * v5物理布局：
+ * [数据 data_size][填充][命令表 LOGGERFS_CMD_TABLE_SIZE][记录区域 log_size][struct loggerfs_trailer]
+ * 环形回绕之前记录区域就是[0, log_used)，回绕之后记录区域长度固定为日志容量，
+ * 有效记录从log_head开始，跨过区域末尾时接到区域开头
+ */
+#define LOGGERFS_FORMAT_V1 1
+#define LOGGERFS_FORMAT_V2 2
+#define LOGGERFS_FORMAT_V3 3
+#define LOGGERFS_FORMAT_V4 4
+#define LOGGERFS_FORMAT_V5 5
+#define LOGGERFS_FORMAT_VERSION LOGGERFS_FORMAT_V5
+#define LOGGERFS_LOG_ALIGN PAGE_SIZE    // 写入时命令表的对齐
+#define LOGGERFS_MAX_LOG_PAD 65536      // 读取时接受的最大填充（支持最大64K的页）
+#define LOGGERFS_TRAILER_MAGIC 0x4c47544cU /* "LTGL" */
+
+/*
+ * 定长日志尾部，所有字段小端存储。
+ * v2的log_len是__le64、其后为保留的0；v3把它拆成log_len/log_head，
+ * 保留字段改为log_used，旧尾部按v3读出时log_head和log_used都为0
+ */
+struct loggerfs_trailer {
+	__le32 magic;           // LOGGERFS_TRAILER_MAGIC
+	__le16 version;         // 磁盘格式版本
+	__le16 size;            // 尾部结构大小
+	__le64 log_start;       // 数据大小（v5之前也是命令表的位置）
+	__le32 log_len;         // 日志（v4为记录）区域长度，不含命令表和尾部
+	__le32 log_head;        // 最旧记录在日志区域中的位置（v3）
+	__le32 log_used;        // 有效日志字节数（v3）
+	__le32 crc;             // 以上字段的crc32
+} __packed;
+
+#define LOGGERFS_TRAILER_SIZE sizeof(struct loggerfs_trailer)
+
+/*
+ * 堆叠模式的意图日志（见loggerfs_journal.c）：下层目录中的LOGGERFS_JOURNAL_NAME文件，
+ * 由若干事务首尾相接组成，每个事务是一个头部加若干块，所有字段小端存储。
+ * 块记录一个文件在该事务中追加的日志记录和此时的数据大小：
+ * [struct loggerfs_journal_block][路径 path_len][记录 + __u8命令路径长度 + 命令路径]...
+ */
+#define LOGGERFS_JOURNAL_NAME ".loggerfs_journal"
+#define LOGGERFS_JOURNAL_MAGIC 0x4e4a474cU /* "LGJN" */
+
+struct loggerfs_journal_header {
+	__le32 magic;           // LOGGERFS_JOURNAL_MAGIC
+	__le32 len;             // 头部之后各块的总长度
+	__le64 tid;             // 事务号（每个挂载单调递增）
+	__le32 crc;             // 以上字段和各块的crc32，不完整的事务在恢复时被忽略
+} __packed;
+
+struct loggerfs_journal_block {
+	__le64 ino;             // 下层inode号
+	__le64 data_size;       // 这批记录写入后的数据大小
+	__le32 generation;      // 下层inode generation
+	__le32 nr_records;      // 其后的记录数
+	__le16 path_len;        // 相对lowerdir的路径长度（不含结尾的NUL）
+	__le16 reserved;
+} __packed;
+
+/*
+ * 整个挂载的汇总日志（见loggerfs_audit.c）：挂载根目录下的LOGGERFS_AUDIT_DIR/LOGGERFS_AUDIT_NAME，
+ * 按时间合并所有文件的日志记录。每个CPU的环保留最近LOGGERFS_AUDIT_RECORDS条
+ */
+#define LOGGERFS_AUDIT_DIR ".loggerfs"
+#define LOGGERFS_AUDIT_NAME "journal"
+#define LOGGERFS_AUDIT_RECORDS 1024
+
+/* 撤销历史的一层：一次修改之前被覆盖区域的页面快照（见loggerfs_undo.c） */
+struct loggerfs_undo {
+	struct list_head list;  // 挂在file_info->undo_stack上，最新的一层在头部，去掉后为空
+	refcount_t ref;         // 栈本身一个引用，写入过程中写入者一个引用
+	loff_t offset;          // 被覆盖区域的起始位置
+	size_t length;          // 被覆盖区域的长度（不超过修改前的数据末尾）
+	loff_t old_size;        // 修改前的数据大小
+	unsigned long bytes;    // 快照页面占用的内存
+	u64 seq;                // 记录这次修改的日志记录序号，记录写入日志之前或被丢弃时为U64_MAX
+	struct loggerfs_undo *rec_next; // 合并进同一条记录的前一层（持有引用，见log_try_coalesce）
+	unsigned int nr_pages;
+	struct page *pages[];   // 被覆盖区域各页的快照，NULL为空洞
 };
 
+/* 写入锁定的字节范围（见loggerfs_range.c） */
+struct loggerfs_range {
+	struct list_head list;  // 挂在file_info->ranges上
+	loff_t start;
+	loff_t end;             // 不含
+};
+
+/* loggerfs_undo_account的事件 */
+enum {
+	LOGGERFS_UNDO_PUSH,     // 压入新的一层
+	LOGGERFS_UNDO_POP,      // REVERT恢复或写入失败撤回
+	LOGGERFS_UNDO_DISCARD,  // 因层数或内存上限丢弃
+};
+
+/* 日志批量写入的默认参数（可通过挂载选项flush_ms=、flush_records=修改） */
+#define LOGGERFS_DEFAULT_FLUSH_MS 100
+#define LOGGERFS_DEFAULT_FLUSH_RECORDS 64
+
+/* 撤销快照总量的默认上限（挂载选项backup_max=，0为不限制） */
+#define LOGGERFS_DEFAULT_BACKUP_MAX (64UL << 20)
+/* 每个文件撤销历史的默认层数（挂载选项undo_depth=，0为关闭撤销） */
+#define LOGGERFS_DEFAULT_UNDO_DEPTH 16
+#define LOGGERFS_MAX_UNDO_DEPTH 4096
+
+/* 按挂载统计次数、字节数和耗时的操作（见loggerfs_stats.c） */
+enum loggerfs_stat_op {
+	LOGGERFS_STAT_READ,             // loggerfs_read_iter
+	LOGGERFS_STAT_WRITE,            // loggerfs_write_iter
+	LOGGERFS_STAT_LOG_ENTRY,        // add_log_entry
+	LOGGERFS_STAT_BACKUP,           // loggerfs_undo_push（撤销快照）
+	LOGGERFS_STAT_FIND_LOG,         // find_log_start（首次加载布局）
+	LOGGERFS_STAT_REVERT,           // remove_last_write_log
+	LOGGERFS_STAT_NR,
+};
+/* 耗时直方图的桶数：第i个桶是[2^i, 2^(i+1))纳秒，最后一个桶包含更长的 */
+#define LOGGERFS_STAT_BUCKETS 32
+
+struct loggerfs_stats;
+struct loggerfs_audit_cpu;
+struct loggerfs_audit_path;
+
+/* 超级块私有数据 */
+struct loggerfs_sb_info {
+	unsigned int flush_ms;          // 日志记录最多延迟多少毫秒写入文件
+	unsigned int flush_records;     // 积累多少条记录后立即写入
+	struct llist_head flush_list;   // 有待写日志记录的inode
+	atomic_t pending_records;       // 尚未写入的记录数
+	atomic_long_t log_dropped;      // 槽位环满时丢弃的记录数
+	struct delayed_work flush_work; // 批量写日志的工作项
+	unsigned int log_size;          // 新文件的日志容量
+	unsigned int log_entries;       // 新文件的日志记录数上限
+	unsigned int read_policy;       // 新文件的读日志策略
+	unsigned int read_sample;       // 新文件的读采样间隔
+	struct path lower_root;         // 堆叠模式下的下层目录（lowerdir=），为空时是内存文件系统
+	char *lowerdir;                 // lowerdir=选项原文，用于显示挂载选项
+	const struct cred *lower_cred;  // 访问下层文件系统使用的挂载者凭据
+
+	// 内存统计与回收（见loggerfs_mem.c）
+	unsigned int undo_depth;        // 每个文件撤销历史的层数上限
+	unsigned long backup_max;       // 撤销快照总量上限，0为不限制
+	spinlock_t backup_lock;         // 保护以下撤销统计和LRU
+	struct list_head backup_lru;    // 有撤销历史的inode，最冷的在头部
+	unsigned long backup_bytes;     // 撤销快照总字节数
+	unsigned int backup_files;      // 有撤销历史的inode数
+	unsigned long backup_dropped;   // 因层数、内存上限或内存压力丢弃的层数
+	atomic_long_t log_bytes;        // 日志缓冲区（段和命令表）占用的字节数
+	struct shrinker backup_shrinker;
+	struct dentry *debugfs_dir;     // debugfs中本挂载的统计目录
+	struct loggerfs_stats __percpu *stats; // 各操作的计数和耗时直方图（每CPU一份）
+
+	// 堆叠模式的意图日志（见loggerfs_journal.c）
+	bool journal;                   // 挂载选项journal=，只对堆叠模式有效
+	struct file *journal_file;      // 下层目录中的意图日志文件，为空时不记录
+	size_t journal_root_len;        // lowerdir在下层文件系统中的路径长度
+	struct mutex journal_lock;      // 保护正在积累的事务和journal_inodes
+	char *journal_buf;              // 正在积累的事务中的块
+	size_t journal_len;
+	size_t journal_cap;
+	u64 journal_tid;                // 正在积累的事务号
+	struct list_head journal_inodes; // 上次检查点之后出现在意图日志中的inode（持有引用）
+	struct mutex journal_commit_lock; // 串行化提交和检查点
+	u64 journal_committed;          // 最后一个已提交的事务号
+	loff_t journal_size;            // 意图日志文件的大小
+	errseq_t journal_err;           // 提交失败的错误，fsync据此返回错误
+	unsigned long journal_commits;  // 提交的事务数
+	unsigned long journal_files;    // 各次提交写回的文件数之和
+	unsigned long journal_fsyncs;   // 经由意图日志的fsync次数（多于提交数的部分被合并了）
+	unsigned long journal_checkpoints; // 检查点次数
+
+	// 新记录通知（见loggerfs_watch.c）
+	spinlock_t watch_lock;          // 保护watches和各inode的watches
+	struct list_head watches;       // 整个挂载的通知
+
+	// 汇总日志（见loggerfs_audit.c）
+	struct loggerfs_audit_cpu __percpu *audit; // 每CPU的记录环
+	bool audit_on;                  // 环已分配（第一次打开汇总日志之后），刷新路径开始记录
+	struct mutex audit_lock;        // 串行化环的分配
+	wait_queue_head_t audit_wait;   // 等待新记录的读者
+	struct dentry *audit_dir;       // 根目录下的LOGGERFS_AUDIT_DIR
+	struct dentry *audit_file;      // 其中的LOGGERFS_AUDIT_NAME
+};
+
+static inline struct loggerfs_sb_info *LOGGERFS_SB(struct super_block *sb)
+{
+	return sb->s_fs_info;
+}
+
+// 是否堆叠在下层目录上（否则页缓存就是唯一的存储）
+static inline bool loggerfs_stacked(struct super_block *sb)
+{
+	return LOGGERFS_SB(sb)->lower_root.dentry != NULL;
+}
+
+// 统计的起点，与loggerfs_stat_end配对
+static inline u64 loggerfs_stat_start(void)
+{
+	return ktime_get_ns();
+}
+
+/* 缓存的命令路径，以可执行文件inode为键，按程序共享（见loggerfs_cmd.c） */
+struct loggerfs_cmd {
+	refcount_t ref;
+	struct rcu_head rcu;
+	dev_t dev;              // 可执行文件所在设备
+	unsigned long ino;      // 可执行文件inode号
+	u32 generation;         // 可执行文件inode generation
+	unsigned int len;       // 路径长度
+	char path[];            // 命令全路径
+};
+
+/* 待写入的日志记录：读写路径只保存原始字段，格式化推迟到日志线程 */
+struct loggerfs_log_rec {
+	struct timespec64 ts;   // 访问时间
+	u16 op;                 // 访问类型，LOGGERFS_OP_*
+	loff_t offset;          // 起始位置
+	size_t length;          // 数据长度
+	struct loggerfs_cmd *cmd; // 执行访问的命令（持有引用，可为NULL）
+	pid_t tgid;             // 执行访问的进程，合并顺序访问时使用
+	struct loggerfs_undo *undo; // 这次修改的撤销层（持有引用，可为NULL），写入日志时得到记录序号
+};
+
+/*
+ * 待写入记录的槽位环（见loggerfs_core.c）：记录者用cmpxchg取得票号，
+ * 票号对环大小取模就是槽位，填好记录后发布commit。
+ * 环的大小是flush_records向上取到2的幂，至少LOGGERFS_LOG_SLOTS个
+ */
+#define LOGGERFS_LOG_SLOTS 32
+#define LOGGERFS_MAX_FLUSH_RECORDS 4096
+struct loggerfs_log_slot {
+	unsigned long ticket;   // 占用这个槽位的票号
+	unsigned long commit;   // 记录发布后为票号+1
+	struct loggerfs_log_rec rec;
+};
+
+/* loggerfs_file_info.log_state 标志位 */
+#define LOGGERFS_LOG_QUEUED 0   // 已挂在超级块的flush_list上
+
 /* 文件私有数据结构 - 物理日志方案 */
 struct loggerfs_file_info {
 	struct inode vfs_inode; // VFS inode必须是第一个成员
@@ -33,27 +315,202 @@ struct loggerfs_file_info {
 	// 文件数据和日志的物理布局信息
 	loff_t data_size;       // 数据部分大小（stat显示的大小）
 	loff_t log_start;       // 日志开始位置（数据末尾）
-	size_t log_size;        // 日志部分大小
-	loff_t total_size;      // 文件总大小（数据+日志）
+	size_t log_size;        // 记录区域大小（不含命令表和尾部）
+	size_t log_head;        // 环形日志中最旧记录的位置
+	size_t log_used;        // 环形日志中的有效字节数（记录大小的整数倍）
+	loff_t total_size;      // 文件总大小（数据+命令表+记录+尾部）
+	size_t log_base;        // 记录区域在文件中相对内存副本的轮转量，非零时log_size等于容量（见loggerfs_attach_log）
+	loff_t log_cleared;     // loggerfs_log_make_room为扩展写清零到的位置，下一次接回日志时使用
+	bool layout_loaded;     // 布局是否已从磁盘解析（之后由读写路径增量维护）
 	
-	struct backup_data backup; // 最后一次写操作的原始数据备份
-	spinlock_t log_lock;    // 日志操作锁
+	struct list_head undo_stack; // 撤销历史，最新的一层在头部
+	unsigned int undo_depth;     // 撤销历史的层数
+	unsigned long undo_bytes;    // 撤销快照占用的内存
+	struct list_head backup_lru; // 挂在超级块backup_lru上（有撤销历史时）
+	struct xarray mmap_dirty;    // 通过mmap写过、尚未收进撤销历史的页：页号->写入前的副本
+	struct rw_semaphore layout_rwsem; // 保护数据/日志布局、日志缓冲区和备份（可睡眠）
+	struct mutex undo_lock;      // 持布局读锁的覆盖写修改撤销栈时持有
+	spinlock_t range_lock;       // 保护ranges
+	struct list_head ranges;     // 持布局读锁的覆盖写锁定的页面范围
+	wait_queue_head_t range_wait; // 等待重叠的范围解锁
+	struct list_head watches;    // 只通知这个文件的通知fd（见loggerfs_watch.c）
+
+	// 日志区域的内存副本：分段环形缓冲区（见loggerfs_log.c）
+	char **log_segs;        // 段表，每段LOGGERFS_LOG_SEG_SIZE
+	char *log_seg0;         // 只有一段时段表就是这里，省去一次分配
+	size_t log_cap;         // 日志容量（记录大小的整数倍）
+	unsigned int log_nr_alloc;    // 已分配的段数
+	unsigned int log_max_entries; // 记录数上限，0为不限制
+	char *log_cmd_table;    // 命令表的内存副本（LOGGERFS_CMD_TABLE_SIZE）
+	u64 log_cmd_seq[LOGGERFS_CMD_SLOTS]; // 各槽位最后一次被引用的记录序号
+	u64 log_next_seq;       // 下一条记录的序号
+
+	struct loggerfs_log_slot *log_slots; // 待写入记录的槽位环
+	unsigned int log_nr_slots;      // 槽位数（2的幂）
+	atomic_long_t log_tail;         // 下一个票号
+	unsigned long log_slot_head;    // 下一条要写入的票号，只由持写锁的刷新推进
+	unsigned int read_policy;       // 读日志策略，LOGGERFS_READS_*
+	unsigned int read_sample;       // 读采样间隔
+	atomic_t read_count;            // 采样计数
+	spinlock_t log_open_lock;       // 保护log_open_rec及其入队顺序
+	struct loggerfs_log_rec *log_open_rec; // 合并模式下仍可扩展的最新记录，所在槽位尚未发布
+
+	// 堆叠模式下对应的下层文件（见loggerfs_lower.c），内存模式下都为空
+	struct path lower_path;         // 下层dentry
+	struct inode *lower_inode;      // 下层inode，查找时作为键
+	struct file *lower_file;        // 页面读写使用的下层文件，首次使用时打开
+	struct llist_node flush_node;   // 挂在超级块flush_list上的节点
+	unsigned long log_state;        // LOGGERFS_LOG_* 标志位
+
+	// 意图日志（堆叠模式），由超级块的journal_lock保护
+	struct list_head journal_node;  // 挂在超级块journal_inodes上
+	struct list_head journal_commit; // 提交时挂在本次事务的inode列表上（提交锁保护）
+	u64 journal_tid;                // 最近一次加入的事务号
+	loff_t journal_size;            // 最近一次加入事务时的数据大小，提交前要写回的范围
+};
+
+/* 把一批日志记录写入正在积累的事务（loggerfs_journal_begin/record/end） */
+struct loggerfs_journal_handle {
+	struct loggerfs_file_info *file_info;
+	size_t block;           // 块在事务缓冲区中的位置
+	unsigned int nr;        // 已写入的记录数
+	bool failed;            // 缓冲区扩展失败，这批记录不进入意图日志
+};
+
+/* 把一批日志记录放进汇总日志（loggerfs_audit_begin/record/end） */
+struct loggerfs_audit_handle {
+	struct loggerfs_sb_info *sbi;
+	struct loggerfs_audit_path *path; // 这批记录共享的文件路径（持有引用，可为NULL）
+	u64 ino;
+	unsigned int nr;        // 已放入的记录数
 };
 
 /* 函数声明 */
-void get_current_command(char *buffer, size_t size);
-int add_log_entry(struct loggerfs_file_info *file_info, const char *operation,
-		   loff_t offset, size_t length);
+int add_log_entry(struct loggerfs_file_info *file_info, u16 op,
+		  loff_t offset, size_t length, struct loggerfs_undo *undo);
+struct loggerfs_cmd *loggerfs_cmd_get_current(void);
+void loggerfs_cmd_put(struct loggerfs_cmd *cmd);
+void loggerfs_cmd_cache_destroy(void);
+int loggerfs_log_slots_init(struct loggerfs_file_info *file_info);
+void loggerfs_log_slots_destroy(struct loggerfs_file_info *file_info);
+void loggerfs_schedule_log_flush(struct loggerfs_file_info *file_info);
+void loggerfs_flush_log(struct loggerfs_file_info *file_info);
+void loggerfs_flush_all_logs(struct loggerfs_sb_info *sbi);
+void loggerfs_log_flush_work(struct work_struct *work);
 int remove_last_write_log(struct loggerfs_file_info *file_info);
-int backup_original_data(struct loggerfs_file_info *file_info, loff_t offset, size_t length);
-int restore_original_data(struct loggerfs_file_info *file_info);
-void cleanup_backup_data(struct loggerfs_file_info *file_info);
-loff_t find_log_start(struct inode *inode);
-int parse_log_size(struct inode *inode, loff_t log_start);
+int loggerfs_undo_push(struct loggerfs_file_info *file_info, loff_t start,
+		       loff_t end, bool shared, struct loggerfs_undo **held);
+int loggerfs_undo_pop(struct loggerfs_file_info *file_info, loff_t *offset,
+		      u64 *seq);
+void loggerfs_undo_unwind(struct loggerfs_file_info *file_info,
+			  struct loggerfs_undo *undo, loff_t from);
+void loggerfs_undo_push_page(struct loggerfs_file_info *file_info,
+			     pgoff_t index, struct page *copy);
+void loggerfs_undo_put(struct loggerfs_undo *undo);
+void loggerfs_undo_clear(struct loggerfs_file_info *file_info);
+void loggerfs_undo_account(struct loggerfs_file_info *file_info, long bytes,
+			   int how);
+unsigned long loggerfs_undo_shrink(struct loggerfs_sb_info *sbi,
+				   unsigned long goal);
+int loggerfs_range_lock(struct loggerfs_file_info *file_info,
+			struct loggerfs_range *range, loff_t start, loff_t end,
+			bool wait);
+void loggerfs_range_unlock(struct loggerfs_file_info *file_info,
+			   struct loggerfs_range *range);
+int loggerfs_file_mmap(struct file *file, struct vm_area_struct *vma);
+void loggerfs_mmap_collect(struct loggerfs_file_info *file_info);
+void loggerfs_mmap_release(struct loggerfs_file_info *file_info);
+bool loggerfs_journal_begin(struct loggerfs_file_info *file_info,
+			   struct loggerfs_journal_handle *handle);
+void loggerfs_journal_record(struct loggerfs_journal_handle *handle,
+			     const struct loggerfs_log_record *rec,
+			     const char *cmd);
+void loggerfs_journal_end(struct loggerfs_journal_handle *handle);
+int loggerfs_journal_commit(struct loggerfs_sb_info *sbi);
+int loggerfs_journal_sync(struct loggerfs_sb_info *sbi);
+int loggerfs_journal_fsync(struct loggerfs_file_info *file_info);
+int loggerfs_journal_init(struct super_block *sb);
+void loggerfs_journal_exit(struct super_block *sb);
+bool loggerfs_journal_hidden(struct dentry *dentry);
+void loggerfs_replay_layout(struct loggerfs_file_info *file_info, loff_t size);
+int loggerfs_mem_init(struct super_block *sb);
+void loggerfs_mem_exit(struct super_block *sb);
+int loggerfs_watch_create(struct file *file, struct loggerfs_watch_args __user *uargs);
+void loggerfs_watch_notify(struct loggerfs_file_info *file_info,
+			   const struct loggerfs_log_record *rec);
+bool loggerfs_audit_begin(struct loggerfs_file_info *file_info,
+			  struct loggerfs_audit_handle *handle);
+void loggerfs_audit_record(struct loggerfs_audit_handle *handle,
+			   const struct loggerfs_log_record *entry,
+			   struct loggerfs_cmd *cmd);
+void loggerfs_audit_end(struct loggerfs_audit_handle *handle);
+int loggerfs_audit_init(struct super_block *sb);
+void loggerfs_audit_exit(struct super_block *sb);
+int loggerfs_stats_init(struct super_block *sb);
+void loggerfs_stats_exit(struct super_block *sb);
+void loggerfs_stat_end(struct loggerfs_sb_info *sbi, enum loggerfs_stat_op op,
+		       u64 start, u64 bytes);
+loff_t find_log_start(struct inode *inode, size_t *log_len, size_t *log_head,
+		      size_t *log_used, int *format);
+int loggerfs_log_resize(struct loggerfs_file_info *file_info, size_t cap,
+			unsigned int max_entries);
+int loggerfs_log_reserve(struct loggerfs_file_info *file_info, size_t len,
+			 gfp_t gfp);
+void loggerfs_log_destroy(struct loggerfs_file_info *file_info);
+void loggerfs_log_reload(struct loggerfs_file_info *file_info);
+u8 loggerfs_log_cmd_slot(struct loggerfs_file_info *file_info,
+			 const char *path, unsigned long *dirty_slots);
+size_t loggerfs_log_append(struct loggerfs_file_info *file_info,
+			   const struct loggerfs_log_record *rec);
+int loggerfs_log_revert(struct loggerfs_file_info *file_info, u64 seq,
+			loff_t offset, size_t *rec_off, u32 *length);
+struct loggerfs_log_record *loggerfs_log_rec_at(struct loggerfs_file_info *file_info,
+						unsigned int idx);
+char *loggerfs_log_seg(struct loggerfs_file_info *file_info, size_t off,
+		       size_t max, size_t *len);
+const char *loggerfs_log_op_name(unsigned int op);
+int loggerfs_log_op_code(const char *name);
+int loggerfs_log_render(struct loggerfs_file_info *file_info,
+			const struct loggerfs_log_record *rec, char *buf,
+			size_t size);
+long loggerfs_log_render_to_user(struct loggerfs_file_info *file_info,
+				 char __user *buf, size_t size);
+long loggerfs_log_read_user(struct loggerfs_file_info *file_info,
+			    struct loggerfs_readlog *arg);
 int read_from_file(struct inode *inode, loff_t pos, char *buffer, size_t len);
+void loggerfs_load_layout(struct loggerfs_file_info *file_info);
+void loggerfs_detach_log(struct loggerfs_file_info *file_info);
+void loggerfs_log_make_room(struct loggerfs_file_info *file_info, loff_t end);
+int loggerfs_attach_log(struct loggerfs_file_info *file_info);
+void loggerfs_resize_data(struct loggerfs_file_info *file_info, loff_t size);
+int loggerfs_init_file_inode(struct inode *inode);
+struct page *loggerfs_get_page(struct inode *inode, pgoff_t index);
+struct page *loggerfs_grab_page(struct inode *inode, pgoff_t index,
+				bool partial);
+struct inode *loggerfs_lower_iget(struct super_block *sb,
+				  struct dentry *lower_dentry);
+int loggerfs_lower_setattr(struct loggerfs_file_info *file_info,
+			   struct iattr *attr);
+void loggerfs_lower_sync_size(struct loggerfs_file_info *file_info);
+void loggerfs_lower_release(struct loggerfs_file_info *file_info);
+int loggerfs_lower_fsync(struct loggerfs_file_info *file_info, loff_t end,
+			 int datasync);
+int loggerfs_lower_fallocate(struct loggerfs_file_info *file_info, int mode,
+			     loff_t offset, loff_t len);
+loff_t loggerfs_lower_seek_data(struct loggerfs_file_info *file_info,
+				loff_t offset, int whence);
+
+extern struct kmem_cache *loggerfs_log_buf_cachep;
+extern struct workqueue_struct *loggerfs_log_wq;
+extern struct dentry *loggerfs_debugfs_root;
 
 /* 文件操作函数声明 */
 extern const struct file_operations loggerfs_file_operations;
+extern const struct address_space_operations loggerfs_aops;
+extern const struct address_space_operations loggerfs_lower_aops;
+extern const struct inode_operations loggerfs_lower_dir_inode_operations;
+extern const struct file_operations loggerfs_lower_dir_operations;
+extern const struct dentry_operations loggerfs_lower_dentry_operations;
 extern const struct inode_operations loggerfs_file_inode_operations;
 extern const struct inode_operations loggerfs_dir_inode_operations;
 extern const struct super_operations loggerfs_ops;
@@ -0,0 +1,131 @@
+#ifndef LOGGERFS_IOCTL_H
+#define LOGGERFS_IOCTL_H
+
+/*
+ * loggerfs的ioctl接口，内核模块和用户态工具（logctl）共用。
+ * 只依赖<linux/types.h>和<linux/ioctl.h>，用户态程序可以直接包含
+ */
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* ioctl 命令定义（旧命令号，保持兼容） */
+#define READLOG_CMD 0x1000      // 读取文本格式的日志（最多LOGGERFS_READLOG_MAX字节，保留最新的记录）
+#define REVERT_CMD 0x2000
+#define GETLOGCONF_CMD 0x3000   // 读取文件的日志配置，参数为struct loggerfs_log_config
+#define SETLOGCONF_CMD 0x3001   // 修改文件的日志容量和记录数上限
+#define GETLOGPOLICY_CMD 0x3002 // 读取文件的读日志策略，参数为struct loggerfs_log_policy
+#define SETLOGPOLICY_CMD 0x3003 // 修改文件的读日志策略
+
+/* READLOG_CMD没有缓冲区大小参数，调用者的缓冲区至少要有这么大 */
+#define LOGGERFS_READLOG_MAX 4096
+
+/* GETLOGCONF/SETLOGCONF的参数（SETLOGCONF只使用前两个字段） */
+struct loggerfs_log_config {
+	__u32 log_size;         // 日志容量（字节）
+	__u32 log_entries;      // 记录数上限，0为不限制
+	__u32 log_used;         // 当前记录占用的字节数
+	__u32 nr_entries;       // 当前记录数
+};
+
+/* 读操作的日志策略（挂载选项readlog=和每文件的SETLOGPOLICY） */
+#define LOGGERFS_READS_OFF 0            // 不记录读操作
+#define LOGGERFS_READS_ON 1             // 每次读都记录（默认）
+#define LOGGERFS_READS_SAMPLE 2         // 每read_sample次读记录一次
+#define LOGGERFS_READS_COALESCE 3       // 同一进程相邻的顺序读（以及顺序写）合并为一条记录
+
+/* GETLOGPOLICY/SETLOGPOLICY的参数 */
+struct loggerfs_log_policy {
+	__u32 read_policy;      // LOGGERFS_READS_*
+	__u32 read_sample;      // 采样间隔，至少为1
+};
+
+/* 日志记录的操作类型 */
+#define LOGGERFS_OP_READ 1
+#define LOGGERFS_OP_WRITE 2
+#define LOGGERFS_OP_TRUNCATE 3
+#define LOGGERFS_OP_REVERT 4    // REVERT撤销了一次修改，偏移和长度取自被撤销的记录
+#define LOGGERFS_OP_ALLOCATE 5  // fallocate预分配（可能扩展数据区）
+#define LOGGERFS_OP_PUNCH 6     // fallocate打洞（FALLOC_FL_PUNCH_HOLE）
+#define LOGGERFS_OP_ZERO 7      // fallocate清零（FALLOC_FL_ZERO_RANGE）
+
+/* 记录的标志 */
+#define LOGGERFS_REC_REVERTED 0x01      // 这次修改已被REVERT撤销，文本日志中不再显示
+
+/*
+ * 流式读取日志（LOGGERFS_IOC_READLOG）：
+ * 从序号不小于start_seq的最旧记录开始，按从旧到新的顺序填入buf，放不下下一条记录时停止。
+ * 返回写入buf的字节数，并回填next_seq（下一次调用的start_seq）、first_seq和nr_records。
+ * 收集程序每次传入上次的next_seq即可增量地跟踪日志；first_seq大于start_seq说明
+ * 中间的记录已被环形日志淘汰。一条记录都放不下时返回-EMSGSIZE
+ */
+#define LOGGERFS_READLOG_V1 1
+
+/* struct loggerfs_readlog.flags */
+#define LOGGERFS_READLOG_BINARY 0x01    // 输出struct loggerfs_readlog_entry，否则输出文本行
+#define LOGGERFS_READLOG_ALL 0x02       // 文本模式也输出已被撤销的记录
+
+struct loggerfs_readlog {
+	__u32 version;          // LOGGERFS_READLOG_V1，结构变化时增加，内核拒绝不认识的版本
+	__u32 flags;            // LOGGERFS_READLOG_*
+	__u64 buf;              // 用户缓冲区地址
+	__u32 len;              // 缓冲区大小
+	__u32 nr_records;       // 返回：写入的记录数
+	__u64 start_seq;        // 从这个序号开始，0为最旧的记录
+	__u64 next_seq;         // 返回：下一条记录的序号
+	__u64 first_seq;        // 返回：日志中最旧记录的序号（日志为空时等于next_seq）
+};
+
+/*
+ * 二进制模式的一条记录（主机字节序），后接path_len字节的命令路径（不含NUL），
+ * 整条记录按8字节对齐，下一条记录从sizeof(entry) + path_len向上对齐到8的位置开始
+ */
+struct loggerfs_readlog_entry {
+	__u64 seq;              // 记录序号
+	__u64 time;             // 访问时间（纳秒，CLOCK_REALTIME）
+	__s64 offset;           // 起始位置
+	__u32 length;           // 数据长度
+	__u16 op;               // LOGGERFS_OP_*
+	__u16 flags;            // LOGGERFS_REC_*
+	__u16 path_len;         // 命令路径长度，路径未知时为0
+	__u16 reserved[3];
+};
+
+#define LOGGERFS_READLOG_ENTRY_SIZE(path_len) \
+	((sizeof(struct loggerfs_readlog_entry) + (path_len) + 7) & ~7UL)
+
+/*
+ * 新记录通知（LOGGERFS_IOC_WATCH）：返回一个匿名inode的fd，日志中每追加一条记录
+ * 就向其队列放入一个struct loggerfs_watch_event。fd支持read、poll和epoll；
+ * read返回尽可能多的整条事件，队列为空时阻塞（非阻塞fd返回-EAGAIN）。
+ * 队列满时丢弃新记录，丢弃的条数记在下一个放入的事件的dropped中，
+ * 读者据此用LOGGERFS_IOC_READLOG按序号补齐。fd持有创建它的文件的引用
+ */
+struct loggerfs_watch_args {
+	__u32 flags;            // LOGGERFS_WATCH_*
+	__u32 queue_len;        // 队列容量（事件数），0为LOGGERFS_WATCH_QUEUE_DEFAULT
+};
+
+/* struct loggerfs_watch_args.flags */
+#define LOGGERFS_WATCH_MOUNT 0x01       // 通知整个挂载的所有文件（需要CAP_SYS_ADMIN），否则只通知这个文件
+#define LOGGERFS_WATCH_NONBLOCK 0x02    // 返回的fd带O_NONBLOCK
+
+#define LOGGERFS_WATCH_QUEUE_DEFAULT 1024
+#define LOGGERFS_WATCH_QUEUE_MAX 65536
+
+struct loggerfs_watch_event {
+	__u64 ino;              // 文件的inode号
+	__u64 seq;              // 记录序号（每个文件单调递增）
+	__u64 time;             // 访问时间（纳秒，CLOCK_REALTIME）
+	__s64 offset;           // 起始位置
+	__u32 length;           // 数据长度
+	__u16 op;               // LOGGERFS_OP_*
+	__u16 flags;            // LOGGERFS_REC_*
+	__u32 dropped;          // 这个事件之前因队列满丢弃的记录数
+	__u32 reserved;
+};
+
+#define LOGGERFS_IOC_MAGIC 'L'
+#define LOGGERFS_IOC_READLOG _IOWR(LOGGERFS_IOC_MAGIC, 1, struct loggerfs_readlog)
+#define LOGGERFS_IOC_WATCH _IOW(LOGGERFS_IOC_MAGIC, 2, struct loggerfs_watch_args)
+
+#endif /* LOGGERFS_IOCTL_H */
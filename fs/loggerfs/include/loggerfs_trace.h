@@ -0,0 +1,132 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM loggerfs
+
+#if !defined(_LOGGERFS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LOGGERFS_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/ktime.h>
+#include "loggerfs.h"
+
+/*
+ * loggerfs的跟踪点（/sys/kernel/tracing/events/loggerfs/，也可用perf trace -e 'loggerfs:*'）。
+ * 每个事件带文件的设备号和inode号、偏移、长度、当时的日志大小（log_used）和耗时（纳秒）。
+ * 耗时在TP_fast_assign中计算，跟踪点关闭时调用处只有一个静态分支，不读时钟
+ */
+
+/* 一次操作：start是loggerfs_stat_start()取得的起点 */
+DECLARE_EVENT_CLASS(loggerfs_op_class,
+	TP_PROTO(struct loggerfs_file_info *file_info, loff_t offset, u64 length,
+		 u64 start),
+
+	TP_ARGS(file_info, offset, length, start),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(ino_t, ino)
+		__field(loff_t, offset)
+		__field(u64, length)
+		__field(size_t, log_used)
+		__field(loff_t, data_size)
+		__field(u64, ns)
+	),
+
+	TP_fast_assign(
+		__entry->dev = file_info->vfs_inode.i_sb->s_dev;
+		__entry->ino = file_info->vfs_inode.i_ino;
+		__entry->offset = offset;
+		__entry->length = length;
+		__entry->log_used = READ_ONCE(file_info->log_used);
+		__entry->data_size = READ_ONCE(file_info->data_size);
+		__entry->ns = ktime_get_ns() - start;
+	),
+
+	TP_printk("dev %d:%d ino %lu offset %lld length %llu log_used %zu data_size %lld ns %llu",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  (unsigned long)__entry->ino, __entry->offset, __entry->length,
+		  __entry->log_used, __entry->data_size, __entry->ns)
+);
+
+#define DEFINE_LOGGERFS_OP_EVENT(name)					\
+DEFINE_EVENT(loggerfs_op_class, name,					\
+	TP_PROTO(struct loggerfs_file_info *file_info, loff_t offset,	\
+		 u64 length, u64 start),				\
+	TP_ARGS(file_info, offset, length, start))
+
+/* 读写：长度是实际读写的字节数（出错为0） */
+DEFINE_LOGGERFS_OP_EVENT(loggerfs_read);
+DEFINE_LOGGERFS_OP_EVENT(loggerfs_write);
+/* 为修改压入撤销层：长度是快照覆盖的数据 */
+DEFINE_LOGGERFS_OP_EVENT(loggerfs_backup);
+/* 恢复撤销历史的栈顶一层 */
+DEFINE_LOGGERFS_OP_EVENT(loggerfs_restore);
+/* REVERT：长度是被撤销的记录长度，没有历史时为0 */
+DEFINE_LOGGERFS_OP_EVENT(loggerfs_revert);
+/* 首次使用时扫描文件找日志区域：偏移是日志起点（没有日志时为负），长度是日志区域大小 */
+DEFINE_LOGGERFS_OP_EVENT(loggerfs_layout_rescan);
+
+/* 用户态工具（perf、trace-cmd）也能解析的操作类型名 */
+#define show_loggerfs_op(op)						\
+	__print_symbolic(op,						\
+		{ LOGGERFS_OP_READ,	"read" },			\
+		{ LOGGERFS_OP_WRITE,	"write" },			\
+		{ LOGGERFS_OP_TRUNCATE,	"truncate" },			\
+		{ LOGGERFS_OP_REVERT,	"revert" },			\
+		{ LOGGERFS_OP_ALLOCATE,	"allocate" },			\
+		{ LOGGERFS_OP_PUNCH,	"punch" },			\
+		{ LOGGERFS_OP_ZERO,	"zero" })
+
+/* 日志记录：从入队（记录中的时间）到追加进日志或被淘汰经过的时间 */
+DECLARE_EVENT_CLASS(loggerfs_log_class,
+	TP_PROTO(struct loggerfs_file_info *file_info,
+		 const struct loggerfs_log_record *rec),
+
+	TP_ARGS(file_info, rec),
+
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(ino_t, ino)
+		__field(u16, op)
+		__field(loff_t, offset)
+		__field(u32, length)
+		__field(size_t, log_used)
+		__field(u64, ns)
+	),
+
+	TP_fast_assign(
+		__entry->dev = file_info->vfs_inode.i_sb->s_dev;
+		__entry->ino = file_info->vfs_inode.i_ino;
+		__entry->op = le16_to_cpu(rec->op);
+		__entry->offset = le64_to_cpu(rec->offset);
+		__entry->length = le32_to_cpu(rec->length);
+		__entry->log_used = file_info->log_used;
+		__entry->ns = ktime_get_real_ns() - le64_to_cpu(rec->time);
+	),
+
+	TP_printk("dev %d:%d ino %lu op %s offset %lld length %u log_used %zu ns %llu",
+		  MAJOR(__entry->dev), MINOR(__entry->dev),
+		  (unsigned long)__entry->ino, show_loggerfs_op(__entry->op),
+		  __entry->offset, __entry->length, __entry->log_used,
+		  __entry->ns)
+);
+
+/* 一条记录追加进日志（日志线程或fsync刷新时），耗时是它在槽位环中等待的时间 */
+DEFINE_EVENT(loggerfs_log_class, loggerfs_log_append,
+	TP_PROTO(struct loggerfs_file_info *file_info,
+		 const struct loggerfs_log_record *rec),
+	TP_ARGS(file_info, rec));
+
+/* 环形日志淘汰最旧的一条记录，耗时是这条记录在日志中的存活时间 */
+DEFINE_EVENT(loggerfs_log_class, loggerfs_log_evict,
+	TP_PROTO(struct loggerfs_file_info *file_info,
+		 const struct loggerfs_log_record *rec),
+	TP_ARGS(file_info, rec));
+
+#endif /* _LOGGERFS_TRACE_H */
+
+/* 模块外构建：头文件目录已在ccflags的-I中 */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE loggerfs_trace
+#include <trace/define_trace.h>
@@ -5,22 +5,45 @@
 #include <sys/ioctl.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <poll.h>
 
-#define READLOG_CMD 0x1000
-#define REVERT_CMD 0x2000
-#define MAX_LOG_SIZE 4096
+#include "../include/loggerfs_ioctl.h"
+
+// 与内核中的LOGGERFS_READS_*顺序一致
+static const char *read_policy_names[] = { "off", "on", "sample", "coalesce" };
+#define NR_READ_POLICIES (sizeof(read_policy_names) / sizeof(read_policy_names[0]))
+
+static const char *op_name(unsigned int op) {
+    static const char *names[] = { NULL, "read", "write", "truncate", "revert",
+                                    "allocate", "punch", "zero" };
+
+    if (op < sizeof(names) / sizeof(names[0]) && names[op])
+        return names[op];
+    return "unknown";
+}
 
 void print_usage(char *prog_name) {
-    printf("用法: %s <file_path> <command>\n", prog_name);
+    printf("用法: %s <file_path> <command> [args]\n", prog_name);
     printf("命令:\n");
-    printf("  readlog  - 读取文件的日志\n");
+    printf("  readlog [seq] - 读取文件的日志，给出序号时只读取从该序号开始的记录\n");
     printf("  revert   - 撤销最后一次写操作\n");
+    printf("  logconf  - 显示文件的日志容量和记录数上限\n");
+    printf("  setlog <size> [entries] - 修改文件的日志容量（字节）和记录数上限（0为不限制）\n");
+    printf("  readpolicy - 显示文件的读日志策略\n");
+    printf("  setread <off|on|sample|coalesce> [N] - 修改读日志策略，sample为每N次读记录一次\n");
+    printf("  watch [mount] - 持续输出新追加的日志记录，mount为整个挂载的所有文件\n");
 }
 
-int read_log(const char *file_path) {
+// 用LOGGERFS_IOC_READLOG的二进制模式分批读取序号不小于start_seq的记录，在用户态格式化，
+// 不受日志大小和内核文本输出上限的限制
+int read_log(const char *file_path, unsigned long long start_seq) {
     int fd;
-    char log_buffer[MAX_LOG_SIZE];
-    int log_size;
+    struct loggerfs_readlog rl;
+    char *log_buffer;
+    size_t buf_size = 64 * 1024;
+    unsigned long long total = 0;
+    int ret;
     
     fd = open(file_path, O_RDONLY);
     if (fd < 0) {
@@ -28,36 +51,248 @@ int read_log(const char *file_path) {
         return -1;
     }
     
-    log_size = ioctl(fd, READLOG_CMD, log_buffer);
-    if (log_size < 0) {
-        perror("读取日志失败");
+    log_buffer = malloc(buf_size);
+    if (!log_buffer) {
+        perror("分配缓冲区失败");
         close(fd);
         return -1;
     }
     
+    memset(&rl, 0, sizeof(rl));
+    rl.version = LOGGERFS_READLOG_V1;
+    rl.flags = LOGGERFS_READLOG_BINARY;
+    rl.buf = (uintptr_t)log_buffer;
+    rl.len = buf_size;
+    rl.start_seq = start_seq;
+    
     printf("=== 文件日志内容 ===\n");
-    if (log_size == 0) {
-        printf("(无日志记录)\n");
-    } else {
-        printf("日志大小: %d 字节\n", log_size);
-        printf("日志内容:\n");
-        printf("时间戳       命令路径                 操作类型  偏移     长度\n");
-        printf("--------------------------------------------------------\n");
+    for (;;) {
+        size_t off = 0;
         
-        // 确保字符串以null结尾
-        if (log_size < MAX_LOG_SIZE) {
-            log_buffer[log_size] = '\0';
-        } else {
-            log_buffer[MAX_LOG_SIZE - 1] = '\0';
+        ret = ioctl(fd, LOGGERFS_IOC_READLOG, &rl);
+        if (ret < 0) {
+            perror("读取日志失败");
+            free(log_buffer);
+            close(fd);
+            return -1;
+        }
+        if (total == 0 && rl.nr_records) {
+            printf("日志内容:\n");
+            printf("时间戳       命令路径                 操作类型  偏移     长度\n");
+            printf("--------------------------------------------------------\n");
+        }
+        
+        while (off < (size_t)ret) {
+            const struct loggerfs_readlog_entry *entry =
+                (const struct loggerfs_readlog_entry *)(log_buffer + off);
+            
+            off += LOGGERFS_READLOG_ENTRY_SIZE(entry->path_len);
+            total++;
+            // 被撤销的修改只保留在二进制日志中
+            if (entry->flags & LOGGERFS_REC_REVERTED)
+                continue;
+            printf("%llu %.*s %s %lld %u\n",
+                   (unsigned long long)(entry->time / 1000000000ULL),
+                   entry->path_len ? entry->path_len : 9,
+                   entry->path_len ? (const char *)(entry + 1) : "[unknown]",
+                   op_name(entry->op), (long long)entry->offset, entry->length);
         }
         
-        printf("%s", log_buffer);
+        // 读到了当前日志的末尾
+        if (rl.nr_records == 0 || rl.next_seq == rl.start_seq)
+            break;
+        rl.start_seq = rl.next_seq;
+    }
+    
+    if (total == 0)
+        printf("(无日志记录)\n");
+    // 续读的起点写到标准错误，不混入日志内容
+    if (start_seq && rl.first_seq > start_seq)
+        fprintf(stderr, "序号%llu到%llu的记录已被淘汰\n", start_seq,
+                (unsigned long long)rl.first_seq - 1);
+    fprintf(stderr, "下一个序号: %llu\n", (unsigned long long)rl.next_seq);
+    
+    free(log_buffer);
+    close(fd);
+    return 0;
+}
+
+int show_log_config(const char *file_path) {
+    int fd;
+    struct loggerfs_log_config conf;
+    
+    fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        perror("打开文件失败");
+        return -1;
+    }
+    
+    if (ioctl(fd, GETLOGCONF_CMD, &conf) < 0) {
+        perror("读取日志配置失败");
+        close(fd);
+        return -1;
+    }
+    
+    printf("日志容量: %u 字节\n", conf.log_size);
+    if (conf.log_entries)
+        printf("记录数上限: %u\n", conf.log_entries);
+    else
+        printf("记录数上限: 不限制\n");
+    printf("当前日志: %u 字节, %u 条记录\n", conf.log_used, conf.nr_entries);
+    
+    close(fd);
+    return 0;
+}
+
+int set_log_config(const char *file_path, const char *size, const char *entries) {
+    int fd;
+    struct loggerfs_log_config conf;
+    
+    memset(&conf, 0, sizeof(conf));
+    conf.log_size = strtoul(size, NULL, 0);
+    conf.log_entries = entries ? strtoul(entries, NULL, 0) : 0;
+    
+    fd = open(file_path, O_WRONLY);
+    if (fd < 0) {
+        perror("打开文件失败");
+        return -1;
+    }
+    
+    if (ioctl(fd, SETLOGCONF_CMD, &conf) < 0) {
+        perror("修改日志配置失败");
+        close(fd);
+        return -1;
+    }
+    
+    printf("日志配置已修改\n");
+    close(fd);
+    return 0;
+}
+
+int show_read_policy(const char *file_path) {
+    int fd;
+    struct loggerfs_log_policy policy;
+    
+    fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        perror("打开文件失败");
+        return -1;
+    }
+    
+    if (ioctl(fd, GETLOGPOLICY_CMD, &policy) < 0) {
+        perror("读取读日志策略失败");
+        close(fd);
+        return -1;
     }
     
+    printf("读日志策略: %s\n", policy.read_policy < NR_READ_POLICIES ?
+           read_policy_names[policy.read_policy] : "未知");
+    printf("采样间隔: %u\n", policy.read_sample);
+    
     close(fd);
     return 0;
 }
 
+int set_read_policy(const char *file_path, const char *name, const char *sample) {
+    int fd;
+    unsigned int i;
+    struct loggerfs_log_policy policy;
+    
+    for (i = 0; i < NR_READ_POLICIES; i++)
+        if (strcmp(name, read_policy_names[i]) == 0)
+            break;
+    if (i == NR_READ_POLICIES) {
+        printf("未知的读日志策略: %s\n", name);
+        return -1;
+    }
+    
+    fd = open(file_path, O_RDWR);
+    if (fd < 0) {
+        perror("打开文件失败");
+        return -1;
+    }
+    
+    // 未指定采样间隔时保留文件当前的设置
+    if (ioctl(fd, GETLOGPOLICY_CMD, &policy) < 0) {
+        perror("读取读日志策略失败");
+        close(fd);
+        return -1;
+    }
+    policy.read_policy = i;
+    if (sample)
+        policy.read_sample = strtoul(sample, NULL, 0);
+    
+    if (ioctl(fd, SETLOGPOLICY_CMD, &policy) < 0) {
+        perror("修改读日志策略失败");
+        close(fd);
+        return -1;
+    }
+    
+    printf("读日志策略已修改\n");
+    close(fd);
+    return 0;
+}
+
+// 用LOGGERFS_IOC_WATCH取得通知fd，poll等待并逐批输出事件，直到被中断
+int watch_log(const char *file_path, int mount) {
+    struct loggerfs_watch_event events[64];
+    struct loggerfs_watch_args args;
+    struct pollfd pfd;
+    int fd, wfd;
+    ssize_t n;
+    size_t i;
+    
+    fd = open(file_path, O_RDONLY);
+    if (fd < 0) {
+        perror("打开文件失败");
+        return -1;
+    }
+    
+    memset(&args, 0, sizeof(args));
+    args.flags = LOGGERFS_WATCH_NONBLOCK | (mount ? LOGGERFS_WATCH_MOUNT : 0);
+    wfd = ioctl(fd, LOGGERFS_IOC_WATCH, &args);
+    close(fd);
+    if (wfd < 0) {
+        perror("创建通知失败");
+        return -1;
+    }
+    
+    printf("%-10s %-10s %-10s %-12s %-10s\n", "inode", "序号", "操作", "位置", "长度");
+    fflush(stdout);
+    
+    pfd.fd = wfd;
+    pfd.events = POLLIN;
+    for (;;) {
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll失败");
+            break;
+        }
+        
+        n = read(wfd, events, sizeof(events));
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            perror("读取通知失败");
+            break;
+        }
+        
+        for (i = 0; i < n / sizeof(events[0]); i++) {
+            if (events[i].dropped)
+                printf("（队列已满，丢弃了%u条记录）\n", events[i].dropped);
+            printf("%-10llu %-10llu %-10s %-12lld %-10u\n",
+                   (unsigned long long)events[i].ino,
+                   (unsigned long long)events[i].seq, op_name(events[i].op),
+                   (long long)events[i].offset, events[i].length);
+        }
+        fflush(stdout);
+    }
+    
+    close(wfd);
+    return -1;
+}
+
 int revert_last_write(const char *file_path) {
     int fd;
     int result;
@@ -91,7 +326,7 @@ int revert_last_write(const char *file_path) {
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
+    if (argc < 3) {
         print_usage(argv[0]);
         return 1;
     }
@@ -99,10 +334,22 @@ int main(int argc, char *argv[]) {
     char *file_path = argv[1];
     char *command = argv[2];
     
-    if (strcmp(command, "readlog") == 0) {
-        return read_log(file_path);
+    if (strcmp(command, "readlog") == 0 && (argc == 3 || argc == 4)) {
+        return read_log(file_path, argc == 4 ? strtoull(argv[3], NULL, 0) : 0);
     } else if (strcmp(command, "revert") == 0) {
         return revert_last_write(file_path);
+    } else if (strcmp(command, "logconf") == 0) {
+        return show_log_config(file_path);
+    } else if (strcmp(command, "setlog") == 0 && (argc == 4 || argc == 5)) {
+        return set_log_config(file_path, argv[3], argc == 5 ? argv[4] : NULL);
+    } else if (strcmp(command, "readpolicy") == 0) {
+        return show_read_policy(file_path);
+    } else if (strcmp(command, "setread") == 0 && (argc == 4 || argc == 5)) {
+        return set_read_policy(file_path, argv[3], argc == 5 ? argv[4] : NULL);
+    } else if (strcmp(command, "watch") == 0 && argc == 3) {
+        return watch_log(file_path, 0);
+    } else if (strcmp(command, "watch") == 0 && argc == 4 && strcmp(argv[3], "mount") == 0) {
+        return watch_log(file_path, 1);
     } else {
         printf("未知命令: %s\n", command);
         print_usage(argv[0]);
@@ -0,0 +1,497 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/poll.h>
+#include <linux/sort.h>
+#include <linux/dcache.h>
+#include <linux/uaccess.h>
+#include "../include/loggerfs.h"
+
+// 整个挂载的汇总日志（挂载根目录下的/.loggerfs/journal）：
+// 1. 日志刷新把记录追加进各文件的日志时，同时把记录连同inode号和文件路径放进本CPU的环中，
+//    不同CPU上的刷新不争用同一个锁和缓存行。路径每批记录解析一次，由这批记录共享
+// 2. 环在第一次打开这个文件时才分配，之前刷新路径只检查一个标志。
+//    每个CPU保留最近LOGGERFS_AUDIT_RECORDS条，环满时覆盖最旧的记录
+// 3. 每个打开的文件有自己的读位置，从打开时环中最旧的记录开始。读取时从各CPU取一批记录，
+//    按时间排序后输出文本行，没有新记录时阻塞。读得太慢被覆盖的记录输出为一行"# lost N records"
+// 记录的时间是访问时间，日志线程最多延迟flush_ms才追加，排序只在一批之内保证
+
+struct loggerfs_audit_path {
+	refcount_t ref;
+	char path[];            // 相对挂载根目录的路径
+};
+
+/* 环中的一条记录 */
+struct loggerfs_audit_rec {
+	u64 time;               // 访问时间（纳秒）
+	u64 ino;
+	u64 seq;                // 文件日志中的记录序号
+	s64 offset;
+	u32 length;
+	u16 op;                 // LOGGERFS_OP_*
+	struct loggerfs_audit_path *path; // 持有引用，可为NULL
+	struct loggerfs_cmd *cmd;         // 持有引用，可为NULL
+};
+
+/* 每CPU的记录环 */
+struct loggerfs_audit_cpu {
+	spinlock_t lock;        // 保护以下字段和环中的记录
+	u64 head;               // 写入过的记录总数，下一条放在head % LOGGERFS_AUDIT_RECORDS
+	struct loggerfs_audit_rec *recs; // LOGGERFS_AUDIT_RECORDS条，第一次打开时分配
+};
+
+/* 一次读取最多从各CPU取出的记录数 */
+#define AUDIT_BATCH 256
+/* 一行文本：时间、inode号、序号、命令路径、操作、偏移、长度和文件路径 */
+#define AUDIT_LINE_SIZE (PATH_MAX + LOGGERFS_CMD_SLOT_SIZE + 128)
+
+/* 每个打开的文件的读取状态 */
+struct audit_reader {
+	struct mutex lock;
+	u64 *pos;               // 各CPU下一条要读的记录
+	u64 lost;               // 尚未报告的被覆盖记录数
+	unsigned int nr;        // batch中的记录数
+	unsigned int next;      // batch中下一条要输出的记录
+	size_t line_len;        // line中的文本长度
+	size_t line_off;        // line中已复制给用户的长度
+	struct loggerfs_audit_rec batch[AUDIT_BATCH]; // 已排序、持有引用的记录
+	char line[AUDIT_LINE_SIZE];
+};
+
+static void audit_path_put(struct loggerfs_audit_path *path)
+{
+	if (path && refcount_dec_and_test(&path->ref))
+		kfree(path);
+}
+
+static void audit_rec_put(struct loggerfs_audit_rec *rec)
+{
+	audit_path_put(rec->path);
+	loggerfs_cmd_put(rec->cmd);
+}
+
+static void audit_rec_get(struct loggerfs_audit_rec *rec)
+{
+	if (rec->path)
+		refcount_inc(&rec->path->ref);
+	if (rec->cmd)
+		refcount_inc(&rec->cmd->ref);
+}
+
+// 解析文件当前的路径，失败时返回NULL（输出为[unknown]）
+static struct loggerfs_audit_path *audit_path_get(struct inode *inode)
+{
+	struct loggerfs_audit_path *ap = NULL;
+	struct dentry *alias;
+	char *buf, *path;
+	size_t len;
+
+	alias = d_find_alias(inode);
+	if (!alias)
+		return NULL;
+
+	buf = kmalloc(PATH_MAX, GFP_NOFS);
+	if (buf) {
+		path = dentry_path_raw(alias, buf, PATH_MAX);
+		if (!IS_ERR(path)) {
+			len = strlen(path);
+			ap = kmalloc(sizeof(*ap) + len + 1, GFP_NOFS);
+			if (ap) {
+				refcount_set(&ap->ref, 1);
+				memcpy(ap->path, path, len + 1);
+			}
+		}
+		kfree(buf);
+	}
+	dput(alias);
+	return ap;
+}
+
+// 开始把file_info的一批记录放进汇总日志。没有打开过汇总日志时返回false。
+// 调用者持有layout_rwsem写锁
+bool loggerfs_audit_begin(struct loggerfs_file_info *file_info,
+			  struct loggerfs_audit_handle *handle)
+{
+	struct inode *inode = &file_info->vfs_inode;
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+
+	if (!smp_load_acquire(&sbi->audit_on))
+		return false;
+
+	handle->sbi = sbi;
+	handle->ino = inode->i_ino;
+	handle->path = audit_path_get(inode);
+	handle->nr = 0;
+	return true;
+}
+
+void loggerfs_audit_record(struct loggerfs_audit_handle *handle,
+			   const struct loggerfs_log_record *entry,
+			   struct loggerfs_cmd *cmd)
+{
+	struct loggerfs_audit_cpu *ac;
+	struct loggerfs_audit_rec *rec, old;
+
+	// 取当时所在CPU的环；之后被迁移到别的CPU也只是多一次跨CPU的加锁
+	ac = raw_cpu_ptr(handle->sbi->audit);
+
+	spin_lock(&ac->lock);
+	rec = &ac->recs[ac->head % LOGGERFS_AUDIT_RECORDS];
+	old = *rec;
+	rec->time = le64_to_cpu(entry->time);
+	rec->ino = handle->ino;
+	rec->seq = le64_to_cpu(entry->seq);
+	rec->offset = le64_to_cpu(entry->offset);
+	rec->length = le32_to_cpu(entry->length);
+	rec->op = le16_to_cpu(entry->op);
+	rec->path = handle->path;
+	rec->cmd = cmd;
+	audit_rec_get(rec);
+	ac->head++;
+	spin_unlock(&ac->lock);
+
+	// 被覆盖的记录在锁外释放，环还没写满时是全零的空位
+	audit_rec_put(&old);
+	handle->nr++;
+}
+
+void loggerfs_audit_end(struct loggerfs_audit_handle *handle)
+{
+	struct loggerfs_sb_info *sbi = handle->sbi;
+
+	audit_path_put(handle->path);
+	if (handle->nr && wq_has_sleeper(&sbi->audit_wait))
+		wake_up_interruptible_poll(&sbi->audit_wait, EPOLLIN | EPOLLRDNORM);
+}
+
+// 第一次打开时分配各CPU的环
+static int audit_enable(struct loggerfs_sb_info *sbi)
+{
+	struct loggerfs_audit_cpu *ac;
+	int cpu, ret = 0;
+
+	mutex_lock(&sbi->audit_lock);
+	if (sbi->audit_on)
+		goto out;
+
+	for_each_possible_cpu(cpu) {
+		ac = per_cpu_ptr(sbi->audit, cpu);
+		ac->recs = kvcalloc(LOGGERFS_AUDIT_RECORDS, sizeof(*ac->recs),
+				    GFP_KERNEL);
+		if (!ac->recs) {
+			ret = -ENOMEM;
+			break;
+		}
+	}
+
+	if (ret) {
+		for_each_possible_cpu(cpu) {
+			ac = per_cpu_ptr(sbi->audit, cpu);
+			kvfree(ac->recs);
+			ac->recs = NULL;
+		}
+		goto out;
+	}
+	smp_store_release(&sbi->audit_on, true);
+out:
+	mutex_unlock(&sbi->audit_lock);
+	return ret;
+}
+
+static int audit_rec_cmp(const void *a, const void *b)
+{
+	const struct loggerfs_audit_rec *x = a, *y = b;
+
+	if (x->time != y->time)
+		return x->time < y->time ? -1 : 1;
+	if (x->ino != y->ino)
+		return x->ino < y->ino ? -1 : 1;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// 从各CPU取出一批新记录并按时间排序。每个CPU最多取一份，忙的CPU不会挤掉其他CPU的记录
+static void audit_collect(struct loggerfs_sb_info *sbi,
+			  struct audit_reader *reader)
+{
+	unsigned int share = max_t(unsigned int, AUDIT_BATCH / num_online_cpus(), 8);
+	struct loggerfs_audit_cpu *ac;
+	u64 pos, n;
+	int cpu;
+
+	reader->nr = reader->next = 0;
+	for_each_possible_cpu(cpu) {
+		ac = per_cpu_ptr(sbi->audit, cpu);
+		pos = reader->pos[cpu];
+		if (READ_ONCE(ac->head) == pos || reader->nr == AUDIT_BATCH)
+			continue;
+
+		spin_lock(&ac->lock);
+		if (ac->head - pos > LOGGERFS_AUDIT_RECORDS) {
+			reader->lost += ac->head - LOGGERFS_AUDIT_RECORDS - pos;
+			pos = ac->head - LOGGERFS_AUDIT_RECORDS;
+		}
+		n = min_t(u64, ac->head - pos, share);
+		n = min_t(u64, n, AUDIT_BATCH - reader->nr);
+		for (; n; n--, pos++) {
+			reader->batch[reader->nr] =
+				ac->recs[pos % LOGGERFS_AUDIT_RECORDS];
+			audit_rec_get(&reader->batch[reader->nr++]);
+		}
+		spin_unlock(&ac->lock);
+		reader->pos[cpu] = pos;
+	}
+
+	sort(reader->batch, reader->nr, sizeof(reader->batch[0]),
+	     audit_rec_cmp, NULL);
+}
+
+static bool audit_pending(struct loggerfs_sb_info *sbi,
+			  struct audit_reader *reader)
+{
+	int cpu;
+
+	if (reader->line_off < reader->line_len || reader->lost ||
+	    reader->next < reader->nr)
+		return true;
+	for_each_possible_cpu(cpu)
+		if (READ_ONCE(per_cpu_ptr(sbi->audit, cpu)->head) !=
+		    READ_ONCE(reader->pos[cpu]))
+			return true;
+	return false;
+}
+
+// 准备下一行文本，没有可输出的内容时返回false
+static bool audit_next_line(struct loggerfs_sb_info *sbi,
+			    struct audit_reader *reader)
+{
+	struct loggerfs_audit_rec *rec;
+	u32 rem;
+	u64 sec;
+
+	if (reader->next == reader->nr && !reader->lost)
+		audit_collect(sbi, reader);
+
+	reader->line_off = 0;
+	if (reader->lost) {
+		reader->line_len = scnprintf(reader->line, AUDIT_LINE_SIZE,
+					     "# lost %llu records\n",
+					     reader->lost);
+		reader->lost = 0;
+		return true;
+	}
+	if (reader->next == reader->nr) {
+		reader->line_len = 0;
+		return false;
+	}
+
+	// 时间 inode号 序号 命令 操作 偏移 长度 路径（路径可能含空格，放在最后）
+	rec = &reader->batch[reader->next++];
+	sec = div_u64_rem(rec->time, NSEC_PER_SEC, &rem);
+	reader->line_len = scnprintf(reader->line, AUDIT_LINE_SIZE,
+				     "%llu.%09u %llu %llu %s %s %lld %u %s\n",
+				     sec, rem, rec->ino, rec->seq,
+				     rec->cmd ? rec->cmd->path : "[unknown]",
+				     loggerfs_log_op_name(rec->op),
+				     rec->offset, rec->length,
+				     rec->path ? rec->path->path : "[unknown]");
+	audit_rec_put(rec);
+	return true;
+}
+
+static ssize_t loggerfs_audit_read(struct file *file, char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_inode(file)->i_sb);
+	struct audit_reader *reader = file->private_data;
+	size_t done = 0, n;
+	ssize_t ret;
+
+	if (mutex_lock_interruptible(&reader->lock))
+		return -ERESTARTSYS;
+
+	while (done < count) {
+		if (reader->line_off == reader->line_len &&
+		    !audit_next_line(sbi, reader)) {
+			if (done)
+				break;
+			if (file->f_flags & O_NONBLOCK) {
+				ret = -EAGAIN;
+				goto out;
+			}
+			// 持锁等待：同一个打开的文件上的其他读者排在后面
+			ret = wait_event_interruptible(sbi->audit_wait,
+						       audit_pending(sbi, reader));
+			if (ret)
+				goto out;
+			continue;
+		}
+
+		n = min(count - done, reader->line_len - reader->line_off);
+		if (copy_to_user(buf + done, reader->line + reader->line_off, n)) {
+			ret = done ? done : -EFAULT;
+			goto out;
+		}
+		reader->line_off += n;
+		done += n;
+	}
+	ret = done;
+out:
+	mutex_unlock(&reader->lock);
+	return ret;
+}
+
+static __poll_t loggerfs_audit_poll(struct file *file, poll_table *wait)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_inode(file)->i_sb);
+	struct audit_reader *reader = file->private_data;
+
+	poll_wait(file, &sbi->audit_wait, wait);
+	return audit_pending(sbi, reader) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static int loggerfs_audit_open(struct inode *inode, struct file *file)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+	struct loggerfs_audit_cpu *ac;
+	struct audit_reader *reader;
+	int cpu, ret;
+
+	ret = audit_enable(sbi);
+	if (ret)
+		return ret;
+
+	reader = kvzalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+	reader->pos = kcalloc(nr_cpu_ids, sizeof(*reader->pos), GFP_KERNEL);
+	if (!reader->pos) {
+		kvfree(reader);
+		return -ENOMEM;
+	}
+	mutex_init(&reader->lock);
+
+	// 从环中还保留的最旧记录开始
+	for_each_possible_cpu(cpu) {
+		ac = per_cpu_ptr(sbi->audit, cpu);
+		spin_lock(&ac->lock);
+		reader->pos[cpu] = ac->head > LOGGERFS_AUDIT_RECORDS ?
+				   ac->head - LOGGERFS_AUDIT_RECORDS : 0;
+		spin_unlock(&ac->lock);
+	}
+
+	file->private_data = reader;
+	return stream_open(inode, file);
+}
+
+static int loggerfs_audit_release(struct inode *inode, struct file *file)
+{
+	struct audit_reader *reader = file->private_data;
+
+	while (reader->next < reader->nr)
+		audit_rec_put(&reader->batch[reader->next++]);
+	kfree(reader->pos);
+	kvfree(reader);
+	return 0;
+}
+
+static const struct file_operations loggerfs_audit_fops = {
+	.open = loggerfs_audit_open,
+	.read = loggerfs_audit_read,
+	.poll = loggerfs_audit_poll,
+	.release = loggerfs_audit_release,
+};
+
+// 在parent下创建一个钉在dcache中的只读项。内存模式由kill_litter_super释放，
+// 堆叠模式由loggerfs_audit_exit释放
+static struct dentry *audit_create(struct dentry *parent, const char *name,
+				   umode_t mode)
+{
+	struct super_block *sb = parent->d_sb;
+	struct dentry *dentry;
+	struct inode *inode;
+
+	dentry = d_alloc_name(parent, name);
+	if (!dentry)
+		return NULL;
+
+	inode = new_inode(sb);
+	if (!inode) {
+		dput(dentry);
+		return NULL;
+	}
+
+	inode->i_ino = get_next_ino();
+	inode->i_mode = mode;
+	inode->i_uid = d_inode(sb->s_root)->i_uid;
+	inode->i_gid = d_inode(sb->s_root)->i_gid;
+	inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode);
+	// 不能删除、改名或链接
+	inode->i_flags |= S_IMMUTABLE | S_NOATIME;
+	if (S_ISDIR(mode)) {
+		inode->i_op = &simple_dir_inode_operations;
+		inode->i_fop = &simple_dir_operations;
+		set_nlink(inode, 2);
+	} else {
+		inode->i_fop = &loggerfs_audit_fops;
+	}
+
+	d_add(dentry, inode);
+	return dentry;
+}
+
+// 创建/.loggerfs/journal，根目录已建立。堆叠模式下它遮住下层目录中的同名项，
+// 也不出现在根目录的列表中，但可以直接打开
+int loggerfs_audit_init(struct super_block *sb)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(sb);
+	int cpu;
+
+	sbi->audit = alloc_percpu(struct loggerfs_audit_cpu);
+	if (!sbi->audit)
+		return -ENOMEM;
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(sbi->audit, cpu)->lock);
+
+	sbi->audit_dir = audit_create(sb->s_root, LOGGERFS_AUDIT_DIR,
+				      S_IFDIR | 0555);
+	if (!sbi->audit_dir)
+		return -ENOMEM;
+	if (!loggerfs_stacked(sb))
+		inc_nlink(d_inode(sb->s_root));
+
+	sbi->audit_file = audit_create(sbi->audit_dir, LOGGERFS_AUDIT_NAME,
+				       S_IFREG | 0400);
+	if (!sbi->audit_file)
+		return -ENOMEM;
+	return 0;
+}
+
+// 卸载时调用，之前已写完所有日志，也没有打开的汇总日志
+void loggerfs_audit_exit(struct super_block *sb)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(sb);
+	struct loggerfs_audit_cpu *ac;
+	u64 i;
+	int cpu;
+
+	if (loggerfs_stacked(sb)) {
+		dput(sbi->audit_file);
+		dput(sbi->audit_dir);
+	}
+	sbi->audit_file = sbi->audit_dir = NULL;
+
+	if (!sbi->audit)
+		return;
+	for_each_possible_cpu(cpu) {
+		ac = per_cpu_ptr(sbi->audit, cpu);
+		if (!ac->recs)
+			continue;
+		for (i = 0; i < min_t(u64, ac->head, LOGGERFS_AUDIT_RECORDS); i++)
+			audit_rec_put(&ac->recs[i]);
+		kvfree(ac->recs);
+	}
+	free_percpu(sbi->audit);
+	sbi->audit = NULL;
+	sbi->audit_on = false;
+}
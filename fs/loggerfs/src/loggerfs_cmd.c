@@ -0,0 +1,149 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/sched/mm.h>
+#include <linux/mm.h>
+#include <linux/hash.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
+#include "../include/loggerfs.h"
+
+// 命令路径缓存：
+// 1. 以可执行文件inode的身份（设备号、inode号、generation）为键，同一程序的所有进程共享一项
+// 2. exec后mm->exe_file变化，自然查到新的键，旧项无需显式失效
+// 3. 缓存项不持有文件引用，不会阻止可执行文件所在文件系统卸载
+// 4. 直接映射的小表，冲突时新项替换旧项，查找只需一次RCU读
+#define CMD_CACHE_BITS 8
+#define CMD_CACHE_SIZE (1 << CMD_CACHE_BITS)
+
+static struct loggerfs_cmd __rcu *cmd_cache[CMD_CACHE_SIZE];
+static DEFINE_SPINLOCK(cmd_cache_lock);
+
+static inline u64 cmd_key_hash(dev_t dev, unsigned long ino, u32 generation)
+{
+	return ((u64)dev << 32) ^ ino ^ ((u64)generation << 16);
+}
+
+static inline bool cmd_match(const struct loggerfs_cmd *cmd,
+			     const struct inode *inode)
+{
+	return cmd->ino == inode->i_ino && cmd->dev == inode->i_sb->s_dev &&
+	       cmd->generation == inode->i_generation;
+}
+
+void loggerfs_cmd_put(struct loggerfs_cmd *cmd)
+{
+	if (cmd && refcount_dec_and_test(&cmd->ref))
+		kfree_rcu(cmd, rcu);
+}
+
+// 慢路径：解析可执行文件全路径，建立缓存项（每个程序只走一次）
+static struct loggerfs_cmd *cmd_cache_fill(struct mm_struct *mm)
+{
+	struct loggerfs_cmd *cmd, *old;
+	struct file *exe_file;
+	struct inode *inode;
+	char *path_buf, *pathname;
+	size_t len;
+	unsigned int slot;
+
+	exe_file = get_mm_exe_file(mm);
+	if (!exe_file)
+		return NULL;
+
+	path_buf = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!path_buf) {
+		fput(exe_file);
+		return NULL;
+	}
+
+	pathname = d_path(&exe_file->f_path, path_buf, PATH_MAX);
+	if (IS_ERR(pathname)) {
+		kfree(path_buf);
+		fput(exe_file);
+		return NULL;
+	}
+
+	len = strlen(pathname);
+	cmd = kmalloc(struct_size(cmd, path, len + 1), GFP_KERNEL);
+	if (!cmd) {
+		kfree(path_buf);
+		fput(exe_file);
+		return NULL;
+	}
+
+	inode = file_inode(exe_file);
+	cmd->dev = inode->i_sb->s_dev;
+	cmd->ino = inode->i_ino;
+	cmd->generation = inode->i_generation;
+	cmd->len = len;
+	memcpy(cmd->path, pathname, len + 1);
+	refcount_set(&cmd->ref, 2); // 缓存一份，调用者一份
+
+	kfree(path_buf);
+	fput(exe_file);
+
+	slot = hash_64(cmd_key_hash(cmd->dev, cmd->ino, cmd->generation),
+		       CMD_CACHE_BITS);
+
+	spin_lock(&cmd_cache_lock);
+	old = rcu_dereference_protected(cmd_cache[slot],
+					lockdep_is_held(&cmd_cache_lock));
+	rcu_assign_pointer(cmd_cache[slot], cmd);
+	spin_unlock(&cmd_cache_lock);
+
+	loggerfs_cmd_put(old);
+
+	pr_debug("Cached command path %s\n", cmd->path);
+	return cmd;
+}
+
+// 获取当前进程的命令路径（带引用），热路径只有一次哈希查找
+struct loggerfs_cmd *loggerfs_cmd_get_current(void)
+{
+	struct mm_struct *mm = current->mm;
+	struct loggerfs_cmd *cmd;
+	struct file *exe_file;
+	struct inode *inode;
+
+	if (!mm || (current->flags & PF_KTHREAD))
+		return NULL;
+
+	rcu_read_lock();
+	exe_file = rcu_dereference(mm->exe_file);
+	if (exe_file) {
+		inode = file_inode(exe_file);
+		cmd = rcu_dereference(
+			cmd_cache[hash_64(cmd_key_hash(inode->i_sb->s_dev,
+						       inode->i_ino,
+						       inode->i_generation),
+					  CMD_CACHE_BITS)]);
+		if (cmd && cmd_match(cmd, inode) &&
+		    refcount_inc_not_zero(&cmd->ref)) {
+			rcu_read_unlock();
+			return cmd;
+		}
+	}
+	rcu_read_unlock();
+
+	return cmd_cache_fill(mm);
+}
+
+// 模块卸载时清空缓存
+void loggerfs_cmd_cache_destroy(void)
+{
+	struct loggerfs_cmd *cmd;
+	int i;
+
+	spin_lock(&cmd_cache_lock);
+	for (i = 0; i < CMD_CACHE_SIZE; i++) {
+		cmd = rcu_dereference_protected(cmd_cache[i],
+						lockdep_is_held(&cmd_cache_lock));
+		RCU_INIT_POINTER(cmd_cache[i], NULL);
+		loggerfs_cmd_put(cmd);
+	}
+	spin_unlock(&cmd_cache_lock);
+
+	rcu_barrier();
+}
@@ -22,167 +22,532 @@
 #include <linux/seq_file.h>
 #include <linux/sched/mm.h>
 #include <linux/version.h>
+#include <linux/crc32.h>
+#include <linux/log2.h>
+#include <linux/llist.h>
+#include <linux/workqueue.h>
+#include <linux/rwsem.h>
 #include "../include/loggerfs.h"
+#include "../include/loggerfs_trace.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("KernelSnippets");
 MODULE_DESCRIPTION("A filesystem with automatic logging functionality");
 
-// 获取当前进程的命令路径
-void get_current_command(char *buffer, size_t size)
+struct kmem_cache *loggerfs_log_buf_cachep;
+struct workqueue_struct *loggerfs_log_wq;
+
+static int write_log_to_file(struct inode *inode, loff_t pos, const char *data, size_t len);
+int read_from_file(struct inode *inode, loff_t pos, char *buffer, size_t len);
+
+// 命令表在文件中的位置：数据末尾对齐到页边界
+static inline loff_t log_table_pos(struct loggerfs_file_info *file_info)
+{
+	return round_up(file_info->log_start, LOGGERFS_LOG_ALIGN);
+}
+
+// 记录区域在文件中的开始位置（命令表之后）
+static inline loff_t log_recs_pos(struct loggerfs_file_info *file_info)
 {
-	struct mm_struct *mm;
-	char *path_buf, *pathname;
+	return log_table_pos(file_info) + LOGGERFS_CMD_TABLE_SIZE;
+}
 
-	mm = get_task_mm(current);
-	if (!mm) {
-		strncpy(buffer, "[unknown]", size);
-		return;
+// 内存副本中区域偏移off在文件记录区域中的位置（见loggerfs_attach_log）
+static inline size_t log_phys(struct loggerfs_file_info *file_info, size_t off)
+{
+	if (!file_info->log_base)
+		return off;
+	return (off + file_info->log_base) % file_info->log_cap;
+}
+
+// 写入日志尾部，crc覆盖crc字段之前的所有字段
+static int write_log_trailer(struct loggerfs_file_info *file_info)
+{
+	struct loggerfs_trailer trailer;
+
+	memset(&trailer, 0, sizeof(trailer));
+	trailer.magic = cpu_to_le32(LOGGERFS_TRAILER_MAGIC);
+	trailer.version = cpu_to_le16(LOGGERFS_FORMAT_VERSION);
+	trailer.size = cpu_to_le16(LOGGERFS_TRAILER_SIZE);
+	trailer.log_start = cpu_to_le64(file_info->log_start);
+	trailer.log_len = cpu_to_le32(file_info->log_size);
+	trailer.log_head = cpu_to_le32(log_phys(file_info, file_info->log_head));
+	trailer.log_used = cpu_to_le32(file_info->log_used);
+	trailer.crc = cpu_to_le32(crc32_le(~0, (const u8 *)&trailer,
+					   offsetof(struct loggerfs_trailer, crc)));
+
+	return write_log_to_file(&file_info->vfs_inode,
+				 log_recs_pos(file_info) + file_info->log_size,
+				 (const char *)&trailer, sizeof(trailer));
+}
+
+// 把记录区域[from, from+len)从内存副本写入文件，逐段写出。
+// 区域轮转过时文件中的位置在容量处回绕；尚未分配的段里没有记录，跳过
+static int write_log_segs(struct loggerfs_file_info *file_info, size_t from,
+			  size_t len)
+{
+	size_t done, n, phys;
+	char *p;
+	int ret;
+
+	for (done = 0; done < len; done += n) {
+		if ((from + done) / LOGGERFS_LOG_SEG_SIZE >= file_info->log_nr_alloc)
+			break;
+		p = loggerfs_log_seg(file_info, from + done, len - done, &n);
+		phys = log_phys(file_info, from + done);
+		n = min_t(size_t, n, file_info->log_cap - phys);
+		ret = write_log_to_file(&file_info->vfs_inode,
+					log_recs_pos(file_info) + phys, p, n);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+// 写入区域偏移[from, from+len)，在容量处回绕
+static int write_log_ring(struct loggerfs_file_info *file_info, size_t from,
+			  size_t len)
+{
+	size_t first = min_t(size_t, len, file_info->log_cap - from);
+	int ret;
+
+	ret = write_log_segs(file_info, from, first);
+	if (ret == 0 && len > first)
+		ret = write_log_segs(file_info, 0, len - first);
+	return ret;
+}
+
+// 写入命令表中的一个槽位
+static int write_log_cmd_slot(struct loggerfs_file_info *file_info,
+			      unsigned int slot)
+{
+	return write_log_to_file(&file_info->vfs_inode,
+				 log_table_pos(file_info) + slot * LOGGERFS_CMD_SLOT_SIZE,
+				 file_info->log_cmd_table + slot * LOGGERFS_CMD_SLOT_SIZE,
+				 LOGGERFS_CMD_SLOT_SIZE);
+}
+
+// 在数据末尾之后的页边界写入命令表和全部有效记录，并在其后写入尾部。
+// 记录按内存副本中的位置写出（取消轮转），区域中其余的字节没有意义，不需要写
+static int write_log_region(struct loggerfs_file_info *file_info)
+{
+	int ret;
+
+	file_info->log_base = 0;
+	file_info->log_size = min(file_info->log_size, file_info->log_cap);
+
+	ret = write_log_to_file(&file_info->vfs_inode, log_table_pos(file_info),
+				file_info->log_cmd_table, LOGGERFS_CMD_TABLE_SIZE);
+	if (ret == 0)
+		ret = write_log_ring(file_info, file_info->log_head,
+				     file_info->log_used);
+	if (ret == 0)
+		ret = write_log_trailer(file_info);
+	return ret;
+}
+
+// 有日志时文件的物理大小
+static inline loff_t log_total_size(struct loggerfs_file_info *file_info)
+{
+	if (!file_info->log_size)
+		return file_info->log_start;
+	return log_recs_pos(file_info) + file_info->log_size +
+	       LOGGERFS_TRAILER_SIZE;
+}
+
+// 待写入记录的槽位环：
+// 1. 记录者用cmpxchg取得票号，票号对log_nr_slots取模就是槽位，
+//    在不持锁的情况下填写记录，再以release语义写入commit发布
+// 2. 日志线程在layout_rwsem写锁下从log_slot_head开始按票号顺序取走已发布的槽位，
+//    遇到还在填写的槽位就停下，之后的记录留到下一批，READLOG看不到未发布的记录
+// 3. 环满（所有槽位都还没被取走）时不取票号，丢弃这条记录并计入log_dropped，再催日志线程。
+//    记录者从不等待日志线程：持有layout_rwsem读锁的拷贝可能在同一文件的映射上缺页，
+//    日志线程却要拿这个inode的写锁，等待会死锁
+// 环至少能放下flush_records条，日志线程正常工作时不会丢弃。
+// 记录路径上只有一次cmpxchg，没有锁和内存分配；合并模式的打开记录见log_open_lock
+
+static inline struct loggerfs_log_slot *log_slot(struct loggerfs_file_info *file_info,
+						 unsigned long ticket)
+{
+	return &file_info->log_slots[ticket & (file_info->log_nr_slots - 1)];
+}
+
+static inline bool log_slot_committed(struct loggerfs_file_info *file_info,
+				      unsigned long ticket)
+{
+	return smp_load_acquire(&log_slot(file_info, ticket)->commit) == ticket + 1;
+}
+
+// 发布槽位中的记录，日志线程此后才会读取它
+static inline void log_slot_commit(struct loggerfs_log_rec *rec)
+{
+	struct loggerfs_log_slot *slot =
+		container_of(rec, struct loggerfs_log_slot, rec);
+
+	smp_store_release(&slot->commit, slot->ticket + 1);
+}
+
+// 每个inode只挂一次，持有引用直到日志线程处理完
+static void log_queue_inode(struct loggerfs_file_info *file_info)
+{
+	struct inode *inode = &file_info->vfs_inode;
+
+	if (!test_and_set_bit(LOGGERFS_LOG_QUEUED, &file_info->log_state)) {
+		ihold(inode);
+		llist_add(&file_info->flush_node,
+			  &LOGGERFS_SB(inode->i_sb)->flush_list);
+	}
+}
+
+// 取得一个槽位。环满时返回NULL并立即运行日志线程，不等待
+static struct loggerfs_log_slot *log_slot_reserve(struct loggerfs_file_info *file_info)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_info->vfs_inode.i_sb);
+	long ticket = atomic_long_read(&file_info->log_tail);
+	struct loggerfs_log_slot *slot;
+
+	do {
+		if (unlikely((unsigned long)ticket -
+			     smp_load_acquire(&file_info->log_slot_head) >=
+			     file_info->log_nr_slots)) {
+			atomic_long_inc(&sbi->log_dropped);
+			log_queue_inode(file_info);
+			mod_delayed_work(loggerfs_log_wq, &sbi->flush_work, 0);
+			return NULL;
+		}
+	} while (!atomic_long_try_cmpxchg(&file_info->log_tail, &ticket,
+					  ticket + 1));
+
+	slot = log_slot(file_info, ticket);
+	slot->ticket = ticket;
+	return slot;
+}
+
+// 把记录的序号交给它的撤销层（包括合并进来的各层）并放开引用，REVERT按序号找回这条记录
+static void log_rec_set_seq(struct loggerfs_log_rec *rec, u64 seq)
+{
+	struct loggerfs_undo *undo, *next;
+
+	for (undo = rec->undo; undo; undo = next) {
+		next = undo->rec_next;
+		undo->rec_next = NULL;
+		undo->seq = seq;
+		loggerfs_undo_put(undo);
 	}
+	rec->undo = NULL;
+}
+
+// 普通文件创建时分配槽位环，大小取挂载选项flush_records
+int loggerfs_log_slots_init(struct loggerfs_file_info *file_info)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_info->vfs_inode.i_sb);
+	unsigned int nr;
+
+	nr = roundup_pow_of_two(max_t(unsigned int, sbi->flush_records,
+				      LOGGERFS_LOG_SLOTS));
+	file_info->log_slots = kvcalloc(nr, sizeof(struct loggerfs_log_slot),
+					GFP_KERNEL);
+	if (!file_info->log_slots)
+		return -ENOMEM;
+	file_info->log_nr_slots = nr;
+	atomic_long_add(nr * sizeof(struct loggerfs_log_slot), &sbi->log_bytes);
+	return 0;
+}
+
+// inode销毁时释放槽位环（日志线程已取走所有发布的记录，这里只是防御）
+void loggerfs_log_slots_destroy(struct loggerfs_file_info *file_info)
+{
+	unsigned long ticket = file_info->log_slot_head;
 
-	path_buf = kmalloc(PATH_MAX, GFP_KERNEL);
-	if (!path_buf) {
-		mmput(mm);
-		strncpy(buffer, "[nomem]", size);
+	if (!file_info->log_slots)
 		return;
+
+	while (log_slot_committed(file_info, ticket)) {
+		log_rec_set_seq(&log_slot(file_info, ticket)->rec, U64_MAX);
+		loggerfs_cmd_put(log_slot(file_info, ticket++)->rec.cmd);
+	}
+	if (file_info->log_open_rec) {
+		log_rec_set_seq(file_info->log_open_rec, U64_MAX);
+		loggerfs_cmd_put(file_info->log_open_rec->cmd);
 	}
 
-	// 为不同内核版本提供兼容性
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
-	down_read(&mm->mmap_lock);
-#else
-	down_read(&mm->mmap_sem);
-#endif
-	if (mm->exe_file) {
-		pathname = d_path(&mm->exe_file->f_path, path_buf, PATH_MAX);
-		if (!IS_ERR(pathname)) {
-			strncpy(buffer, pathname, size - 1);
-			buffer[size - 1] = '\0';
-		} else {
-			strncpy(buffer, "[error]", size);
+	kvfree(file_info->log_slots);
+	atomic_long_sub(file_info->log_nr_slots * sizeof(struct loggerfs_log_slot),
+			&LOGGERFS_SB(file_info->vfs_inode.i_sb)->log_bytes);
+	file_info->log_slots = NULL;
+}
+
+// 发布打开的合并记录，之后的访问开始新的记录。调用者持有log_open_lock
+static void log_close_open_rec(struct loggerfs_file_info *file_info)
+{
+	if (file_info->log_open_rec) {
+		log_slot_commit(file_info->log_open_rec);
+		file_info->log_open_rec = NULL;
+	}
+}
+
+// 合并模式：同一进程紧接着打开记录的顺序访问直接扩展该记录，不再分配和入队
+static bool log_try_coalesce(struct loggerfs_file_info *file_info, u16 op,
+			     loff_t offset, size_t length,
+			     struct loggerfs_undo *undo)
+{
+	struct loggerfs_log_rec *rec;
+	bool merged = false;
+
+	spin_lock(&file_info->log_open_lock);
+	rec = file_info->log_open_rec;
+	if (rec && rec->op == op && rec->tgid == current->tgid &&
+	    rec->offset + rec->length == offset &&
+	    rec->length + length <= U32_MAX) {
+		rec->length += length;
+		// 合并的写入共用这条记录的序号
+		if (undo) {
+			refcount_inc(&undo->ref);
+			undo->rec_next = rec->undo;
+			rec->undo = undo;
 		}
-	} else {
-		strncpy(buffer, "[noexe]", size);
+		merged = true;
 	}
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0)
-	up_read(&mm->mmap_lock);
-#else
-	up_read(&mm->mmap_sem);
-#endif
+	spin_unlock(&file_info->log_open_lock);
 
-	kfree(path_buf);
-	mmput(mm);
+	return merged;
 }
-static int write_log_to_file(struct inode *inode, loff_t pos, const char *data, size_t len);
-int read_from_file(struct inode *inode, loff_t pos, char *buffer, size_t len);
 
-// 添加日志条目 - 物理存储在文件末尾，使用标记分隔
-int add_log_entry(struct loggerfs_file_info *file_info, const char *operation,
-		   loff_t offset, size_t length)
+static void log_fill_rec(struct loggerfs_log_rec *rec, u16 op, loff_t offset,
+			 size_t length, struct loggerfs_undo *undo)
 {
-	struct timespec64 ts;
-	char command[256];
-	char log_line[512];
-	char *log_content;
-	int log_line_len;
-	loff_t write_pos;
-	struct inode *inode = &file_info->vfs_inode;
-	int ret = 0;
+	ktime_get_real_ts64(&rec->ts);
+	rec->op = op;
+	rec->offset = offset;
+	rec->length = length;
+	rec->cmd = loggerfs_cmd_get_current();
+	rec->tgid = current->tgid;
+	rec->undo = undo;
+	if (undo)
+		refcount_inc(&undo->ref);
+}
+
+// 添加日志条目 - 读写路径只把原始字段填进槽位并发布，编码和写入由日志线程批量完成。
+// 不等待日志线程，环满时丢弃记录（见log_slot_reserve）。解析命令路径可能睡眠，调用者不能持有页锁。
+// undo是这次修改压入的撤销层（可为NULL），记录写入日志时把序号存进去
+int add_log_entry(struct loggerfs_file_info *file_info, u16 op,
+		  loff_t offset, size_t length, struct loggerfs_undo *undo)
+{
+	struct loggerfs_log_slot *slot;
+	struct loggerfs_sb_info *sbi;
+	bool coalesce;
+	u64 start;
 
-	if (!file_info || !operation) {
+	if (!file_info) {
 		pr_err("Invalid parameters in add_log_entry\n");
 		return -EINVAL;
 	}
+	sbi = LOGGERFS_SB(file_info->vfs_inode.i_sb);
+	start = loggerfs_stat_start();
+
+	// 只有读写参与合并，截断会先关闭打开的记录以保持日志顺序
+	coalesce = READ_ONCE(file_info->read_policy) == LOGGERFS_READS_COALESCE &&
+		   (op == LOGGERFS_OP_READ || op == LOGGERFS_OP_WRITE);
+	if (coalesce && log_try_coalesce(file_info, op, offset, length, undo))
+		goto out;
+
+	// 槽位发布之前日志线程不会读取，填写不需要锁
+	slot = log_slot_reserve(file_info);
+	if (!slot)
+		goto out;
+	log_fill_rec(&slot->rec, op, offset, length, undo);
+
+	// 打开的记录和新记录在同一把锁下发布；合并模式下新记录保持打开，暂不发布
+	if (coalesce || READ_ONCE(file_info->log_open_rec)) {
+		spin_lock(&file_info->log_open_lock);
+		log_close_open_rec(file_info);
+		if (coalesce)
+			file_info->log_open_rec = &slot->rec;
+		else
+			log_slot_commit(&slot->rec);
+		spin_unlock(&file_info->log_open_lock);
+	} else {
+		log_slot_commit(&slot->rec);
+	}
+
+	loggerfs_schedule_log_flush(file_info);
+out:
+	loggerfs_stat_end(sbi, LOGGERFS_STAT_LOG_ENTRY, start, 0);
+	return 0;
+}
 
-	// 获取当前时间和命令
-	ktime_get_real_ts64(&ts);
-	get_current_command(command, sizeof(command));
+// 把inode挂到超级块的待刷新列表并按挂载选项安排日志线程
+void loggerfs_schedule_log_flush(struct loggerfs_file_info *file_info)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_info->vfs_inode.i_sb);
 
-	// 格式化日志行：时间 命令全路径 访问类型 起始位置 数据长度
-	log_line_len = snprintf(log_line, sizeof(log_line),
-				"%lld %s %s %lld %zu\n",
-				(long long)ts.tv_sec, command, operation,
-				(long long)offset, length);
+	log_queue_inode(file_info);
 
-	if (log_line_len <= 0 || log_line_len >= sizeof(log_line)) {
-		pr_warn("Log line formatting failed or too long\n");
-		return -EINVAL;
+	// 只有达到上限的那一条记录提前日志线程，之后的记录不再争用工作队列的锁
+	if (atomic_inc_return(&sbi->pending_records) == sbi->flush_records)
+		mod_delayed_work(loggerfs_log_wq, &sbi->flush_work, 0);
+	else
+		queue_delayed_work(loggerfs_log_wq, &sbi->flush_work,
+				   msecs_to_jiffies(sbi->flush_ms));
+}
+
+// 打开的合并记录随下一批写入，此后的顺序访问开始新的记录
+static void log_close_open_rec_locked(struct loggerfs_file_info *file_info)
+{
+	if (READ_ONCE(file_info->log_open_rec)) {
+		spin_lock(&file_info->log_open_lock);
+		log_close_open_rec(file_info);
+		spin_unlock(&file_info->log_open_lock);
 	}
+}
+
+// 把槽位环中已发布的记录（以及extra，不为NULL时排在最后）编码为定长二进制记录
+// 追加到日志缓冲区，再一次性写入文件，整批只重写一次尾部。调用者持有layout_rwsem写锁
+static void log_flush_locked(struct loggerfs_file_info *file_info,
+			     struct loggerfs_log_rec *extra)
+{
+	struct inode *inode = &file_info->vfs_inode;
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+	struct loggerfs_log_rec *rec;
+	struct loggerfs_log_record entry;
+	struct loggerfs_journal_handle handle;
+	struct loggerfs_audit_handle audit_handle;
+	unsigned long head, end, nr, i;
+	unsigned long dirty_slots = 0;
+	size_t dirty_from = 0, dirty_len = 0;
+	size_t cap, off;
+	bool new_region, journal, audit;
+	unsigned int slot;
+	int count = 0;
+	int ret = 0;
+
+	// mmap写过的页面在这里收进撤销历史并重新写保护，之后的写入再次记录
+	loggerfs_mmap_collect(file_info);
 
-	spin_lock(&file_info->log_lock);
+	// 取走从head开始连续发布的槽位，还在填写的槽位及其后的记录留到下一批
+	head = file_info->log_slot_head;
+	for (end = head; end - head < file_info->log_nr_slots; end++)
+		if (!log_slot_committed(file_info, end))
+			break;
+	if (end == head && !extra)
+		return;
 
-	// 如果这是第一个日志条目，需要写入开始标记
-	if (file_info->log_size == 0) {
-		// 计算日志起始位置（数据末尾）
+	new_region = file_info->log_size == 0;
+	if (new_region)
 		file_info->log_start = file_info->data_size;
-		
-		// 分配空间存储开始标记 + 日志行 + 结束标记
-		size_t total_len = strlen(LOG_START_MARKER) + log_line_len + strlen(LOG_END_MARKER);
-		log_content = kmalloc(total_len, GFP_ATOMIC);
-		if (!log_content) {
-			spin_unlock(&file_info->log_lock);
-			return -ENOMEM;
-		}
+	cap = file_info->log_cap;
+
+	// 堆叠模式下这批记录同时进入意图日志，由日志线程成组提交
+	journal = loggerfs_journal_begin(file_info, &handle);
+	// 打开过汇总日志时，这批记录也放进本CPU的汇总环
+	audit = loggerfs_audit_begin(file_info, &audit_handle);
+
+	nr = end - head + (extra ? 1 : 0);
+	for (i = 0; i < nr; i++) {
+		rec = head + i != end ? &log_slot(file_info, head + i)->rec : extra;
+
+		// 命令路径只在命令表中存一份，记录中保存槽位
+		entry.cmd = rec->cmd ?
+			loggerfs_log_cmd_slot(file_info, rec->cmd->path,
+					      &dirty_slots) :
+			LOGGERFS_CMD_NONE;
+		log_rec_set_seq(rec, file_info->log_next_seq);
+		entry.seq = cpu_to_le64(file_info->log_next_seq++);
+		entry.time = cpu_to_le64(timespec64_to_ns(&rec->ts));
+		entry.offset = cpu_to_le64(rec->offset);
+		entry.length = cpu_to_le32(min_t(size_t, rec->length, U32_MAX));
+		entry.op = cpu_to_le16(rec->op);
+		entry.flags = 0;
+
+		off = loggerfs_log_append(file_info, &entry);
+		trace_loggerfs_log_append(file_info, &entry);
+		loggerfs_watch_notify(file_info, &entry);
+		if (journal)
+			loggerfs_journal_record(&handle, &entry,
+						rec->cmd ? rec->cmd->path : NULL);
+		if (audit)
+			loggerfs_audit_record(&audit_handle, &entry, rec->cmd);
+		if (!dirty_len)
+			dirty_from = off;
+		dirty_len += LOGGERFS_REC_SIZE;
+		count++;
+	}
+
+	if (journal)
+		loggerfs_journal_end(&handle);
+	if (audit)
+		loggerfs_audit_end(&audit_handle);
 
-		// 组装：开始标记 + 日志行 + 结束标记
-		strcpy(log_content, LOG_START_MARKER);
-		strcat(log_content, log_line);
-		strcat(log_content, LOG_END_MARKER);
-		
-		write_pos = file_info->log_start;
-		file_info->log_size = total_len;
+	// 只写回本批追加的记录（回绕时分两段）和新占用的命令表槽位，淘汰旧记录不需要写文件。
+	// 新建日志区域、整批超过容量、容量因内存不足被压缩或重用命令槽位改动了旧记录时，重写整个区域
+	if (new_region || dirty_len >= cap || file_info->log_cap != cap ||
+	    test_bit(LOGGERFS_CMD_DIRTY_RECORDS, &dirty_slots)) {
+		ret = write_log_region(file_info);
 	} else {
-		// 检查日志大小限制（题目要求：最大一个磁盘块）
-		size_t new_entry_size = log_line_len;
-		if (file_info->log_size + new_entry_size > MAX_LOG_SIZE) {
-			// 清空旧日志，重新开始
-			file_info->log_start = file_info->data_size;
-			file_info->log_size = 0;
-			
-			size_t total_len = strlen(LOG_START_MARKER) + log_line_len + strlen(LOG_END_MARKER);
-			log_content = kmalloc(total_len, GFP_ATOMIC);
-			if (!log_content) {
-				spin_unlock(&file_info->log_lock);
-				return -ENOMEM;
-			}
-			strcpy(log_content, LOG_START_MARKER);
-			strcat(log_content, log_line);
-			strcat(log_content, LOG_END_MARKER);
-			
-			write_pos = file_info->log_start;
-			file_info->log_size = total_len;
-		} else {
-			// 在现有日志中插入新条目（在结束标记之前）
-			size_t total_content_len = log_line_len + strlen(LOG_END_MARKER);
-			log_content = kmalloc(total_content_len, GFP_ATOMIC);
-			if (!log_content) {
-				spin_unlock(&file_info->log_lock);
-				return -ENOMEM;
-			}
-			strcpy(log_content, log_line);
-			strcat(log_content, LOG_END_MARKER);
-			
-			// 写入位置：当前日志结束标记之前
-			write_pos = file_info->log_start + file_info->log_size - strlen(LOG_END_MARKER);
-			file_info->log_size += log_line_len;
+		for_each_set_bit(slot, &dirty_slots, LOGGERFS_CMD_SLOTS) {
+			ret = write_log_cmd_slot(file_info, slot);
+			if (ret)
+				break;
 		}
+
+		if (ret == 0)
+			ret = write_log_ring(file_info, dirty_from, dirty_len);
+		if (ret == 0)
+			ret = write_log_trailer(file_info);
 	}
+	file_info->total_size = log_total_size(file_info);
+	if (ret)
+		pr_err("Failed to write log records to file: %d\n", ret);
+
+	pr_debug("Flushed %d log records, log_used=%zu\n", count,
+		 file_info->log_used);
+
+	// 释放取走的槽位
+	for (i = head; i != end; i++)
+		loggerfs_cmd_put(log_slot(file_info, i)->rec.cmd);
+	smp_store_release(&file_info->log_slot_head, end);
+	atomic_sub(end - head, &sbi->pending_records);
+}
 
-	// 写入日志到文件末尾
-	ret = write_log_to_file(inode, write_pos, log_content, strlen(log_content));
-	if (ret == 0) {
-		// 更新文件总大小
-		file_info->total_size = file_info->data_size + file_info->log_size;
-		
-		pr_debug("Added log entry: %s at offset %lld, length %zu\n",
-			 operation, (long long)offset, length);
-	} else {
-		pr_err("Failed to write log entry to file: %d\n", ret);
+void loggerfs_flush_log(struct loggerfs_file_info *file_info)
+{
+	log_close_open_rec_locked(file_info);
+
+	if (!log_slot_committed(file_info, READ_ONCE(file_info->log_slot_head)))
+		return;
+
+	down_write(&file_info->layout_rwsem);
+	log_flush_locked(file_info, NULL);
+	up_write(&file_info->layout_rwsem);
+}
+
+// 刷新超级块上所有待写日志的inode
+void loggerfs_flush_all_logs(struct loggerfs_sb_info *sbi)
+{
+	struct loggerfs_file_info *file_info, *tmp;
+	struct llist_node *nodes;
+
+	nodes = llist_del_all(&sbi->flush_list);
+	llist_for_each_entry_safe(file_info, tmp, nodes, flush_node) {
+		// 先清标记，之后新入队的记录会让inode重新挂到列表上
+		clear_bit(LOGGERFS_LOG_QUEUED, &file_info->log_state);
+		smp_mb__after_atomic();
+		loggerfs_flush_log(file_info);
+		iput(&file_info->vfs_inode);
 	}
 
-	kfree(log_content);
-	spin_unlock(&file_info->log_lock);
-	return ret;
+	// 这一轮各inode的记录作为一个事务提交，只需一次意图日志的刷盘
+	loggerfs_journal_commit(sbi);
+}
+
+// 日志线程：延迟时间到或积累的记录数达到上限时运行
+void loggerfs_log_flush_work(struct work_struct *work)
+{
+	struct loggerfs_sb_info *sbi =
+		container_of(to_delayed_work(work), struct loggerfs_sb_info,
+			     flush_work);
+
+	loggerfs_flush_all_logs(sbi);
 }
 
 // 写入日志内容到文件的指定位置
@@ -197,18 +562,12 @@ static int write_log_to_file(struct inode *inode, loff_t pos, const char *data,
 		struct page *page;
 		void *page_addr;
 
-		// 获取或创建页面
-		page = grab_cache_page(inode->i_mapping, page_idx);
-		if (!page) {
+		// 获取或创建页面，不是完整页写入时先读入原有内容（内存模式下清零）
+		page = loggerfs_grab_page(inode, page_idx,
+					  page_offset || copy_size < PAGE_SIZE);
+		if (IS_ERR(page)) {
 			pr_err("Failed to grab cache page %lu for log write\n", page_idx);
-			return -ENOMEM;
-		}
-
-		// 如果页面不是最新的且不是完整页写入，先清零
-		if (!PageUptodate(page) && (page_offset || copy_size < PAGE_SIZE)) {
-			page_addr = kmap_atomic(page);
-			memset(page_addr, 0, PAGE_SIZE);
-			kunmap_atomic(page_addr);
+			return PTR_ERR(page);
 		}
 
 		page_addr = kmap_atomic(page);
@@ -226,521 +585,598 @@ static int write_log_to_file(struct inode *inode, loff_t pos, const char *data,
 	return 0;
 }
 
-// 查找日志开始位置
-loff_t find_log_start(struct inode *inode)
+// 从文件物理末尾读取并校验尾部，O(1)定位日志
+static loff_t find_log_trailer(struct inode *inode, loff_t physical_size,
+			       size_t *log_len, size_t *log_head,
+			       size_t *log_used, int *format)
 {
-	loff_t file_size = i_size_read(inode);
-	loff_t search_pos = 0;
-	char buffer[512]; // 增大搜索缓冲区
-	
-	// 从文件开始向后搜索日志开始标记
-	while (search_pos < file_size) {
-		size_t read_len = min_t(size_t, sizeof(buffer) - 1, file_size - search_pos);
-		if (read_from_file(inode, search_pos, buffer, read_len) != 0)
-			break;
-			
-		buffer[read_len] = '\0';
-		char *marker_pos = strstr(buffer, LOG_START_MARKER);
-		if (marker_pos) {
-			return search_pos + (marker_pos - buffer);
-		}
-		
-		// 向前移动，但要保留一些重叠以防标记跨页
-		search_pos += read_len - strlen(LOG_START_MARKER);
-		if (search_pos >= file_size)
-			break;
+	struct loggerfs_trailer trailer;
+	loff_t log_start, table, pad;
+	u32 len, head, used;
+	u16 version;
+
+	if (physical_size < (loff_t)LOGGERFS_TRAILER_SIZE)
+		return -1;
+
+	if (read_from_file(inode, physical_size - LOGGERFS_TRAILER_SIZE,
+			   (char *)&trailer, sizeof(trailer)) != 0)
+		return -1;
+
+	if (le32_to_cpu(trailer.magic) != LOGGERFS_TRAILER_MAGIC ||
+	    le16_to_cpu(trailer.size) != LOGGERFS_TRAILER_SIZE)
+		return -1;
+
+	if (le32_to_cpu(trailer.crc) !=
+	    crc32_le(~0, (const u8 *)&trailer,
+		     offsetof(struct loggerfs_trailer, crc))) {
+		pr_warn("Log trailer checksum mismatch, ignoring trailer\n");
+		return -1;
 	}
-	
-	return -1; // 未找到日志开始标记
-}
 
-// 从文件读取数据的辅助函数
-int read_from_file(struct inode *inode, loff_t pos, char *buffer, size_t len)
-{
-	size_t read_size = 0;
-	
-	while (read_size < len) {
-		pgoff_t page_idx = (pos + read_size) >> PAGE_SHIFT;
-		size_t page_offset = (pos + read_size) & (PAGE_SIZE - 1);
-		size_t copy_size = min_t(size_t, len - read_size, PAGE_SIZE - page_offset);
-		struct page *page;
-		void *page_addr;
+	version = le16_to_cpu(trailer.version);
+	if (version < LOGGERFS_FORMAT_V2 || version > LOGGERFS_FORMAT_V5) {
+		pr_warn("Unsupported log format version %u\n", version);
+		return -1;
+	}
 
-		page = find_get_page(inode->i_mapping, page_idx);
-		if (!page) {
-			// 页面不存在，填零
-			memset(buffer + read_size, 0, copy_size);
-		} else {
-			page_addr = kmap_atomic(page);
-			memcpy(buffer + read_size, (char *)page_addr + page_offset, copy_size);
-			kunmap_atomic(page_addr);
-			put_page(page);
+	// v4起在记录区域前有命令表，v5在数据和命令表之间有填充
+	table = version >= LOGGERFS_FORMAT_V4 ? LOGGERFS_CMD_TABLE_SIZE : 0;
+	log_start = le64_to_cpu(trailer.log_start);
+	len = le32_to_cpu(trailer.log_len);
+	pad = physical_size - log_start - table - len - LOGGERFS_TRAILER_SIZE;
+	if (log_start < 0 || len > LOGGERFS_MAX_LOG_SIZE || pad < 0 ||
+	    pad >= (version == LOGGERFS_FORMAT_V5 ? LOGGERFS_MAX_LOG_PAD : 1)) {
+		pr_warn("Log trailer points outside the file, ignoring trailer\n");
+		return -1;
+	}
+
+	// v2日志不回绕，整个区域都是有效记录
+	if (version == LOGGERFS_FORMAT_V2) {
+		head = 0;
+		used = len;
+	} else {
+		head = le32_to_cpu(trailer.log_head);
+		used = le32_to_cpu(trailer.log_used);
+		if (used > len || (len && head >= len) ||
+		    (version >= LOGGERFS_FORMAT_V4 &&
+		     (len % LOGGERFS_REC_SIZE || head % LOGGERFS_REC_SIZE ||
+		      used % LOGGERFS_REC_SIZE))) {
+			pr_warn("Log trailer has an invalid ring position, ignoring trailer\n");
+			return -1;
 		}
-		read_size += copy_size;
 	}
-	
-	return 0;
-}
 
-// 解析日志大小
-int parse_log_size(struct inode *inode, loff_t log_start)
-{
-	if (log_start < 0)
-		return 0;
-		
-	loff_t file_size = i_size_read(inode);
-	if (log_start >= file_size)
-		return 0;
-		
-	return file_size - log_start;
+	*log_len = len;
+	*log_head = head;
+	*log_used = used;
+	*format = version;
+	return log_start;
 }
 
-// 解析日志行，提取操作信息
-static int parse_log_line(const char *line, size_t line_len, char *operation,
-			  loff_t *offset, size_t *length)
-{
-	char temp_line[512];
-	char timestamp_str[32], command[256];
-	int parsed;
+// v1格式兼容：旧文件的日志以文本标记包围且总在文件末尾，
+// 大小不超过一个块加上标记和一行日志，只需在尾部窗口内查找
+#define LEGACY_LOG_WINDOW (LOGGERFS_DEFAULT_LOG_SIZE + 1024)
 
-	if (line_len >= sizeof(temp_line))
-		return -EINVAL;
+static loff_t find_legacy_log_start(struct inode *inode, loff_t physical_size,
+				    size_t *log_len)
+{
+	size_t start_len = strlen(LOG_START_MARKER);
+	size_t end_len = strlen(LOG_END_MARKER);
+	size_t window = min_t(loff_t, physical_size, LEGACY_LOG_WINDOW);
+	loff_t base = physical_size - window;
+	loff_t log_start = -1;
+	char *buffer, *p;
+
+	if (window < start_len + end_len)
+		return -1;
+
+	buffer = kmalloc(window, GFP_KERNEL);
+	if (!buffer)
+		return -1;
+
+	if (read_from_file(inode, base, buffer, window) != 0)
+		goto out;
+
+	// 旧格式的日志总以结束标记收尾
+	if (memcmp(buffer + window - end_len, LOG_END_MARKER, end_len) != 0)
+		goto out;
+
+	// 取窗口内最后一个开始标记，避免数据中恰好含有标记文本时误判
+	for (p = buffer + window - end_len - start_len; p >= buffer; p--) {
+		if (memcmp(p, LOG_START_MARKER, start_len) == 0) {
+			log_start = base + (p - buffer);
+			*log_len = physical_size - log_start;
+			break;
+		}
+	}
 
-	strncpy(temp_line, line, line_len);
-	temp_line[line_len] = '\0';
+out:
+	kfree(buffer);
+	return log_start;
+}
 
-	// 解析格式：时间 命令全路径 访问类型 起始位置 数据长度
-	parsed = sscanf(temp_line, "%31s %255s %31s %lld %zu",
-			timestamp_str, command, operation,
-			(long long *)offset, length);
+// 查找日志开始位置：优先读取二进制尾部，找不到时兼容查找v1文本标记
+loff_t find_log_start(struct inode *inode, size_t *log_len, size_t *log_head,
+		      size_t *log_used, int *format)
+{
+	loff_t physical_size = i_size_read(inode);
+	loff_t log_start;
+
+	log_start = find_log_trailer(inode, physical_size, log_len, log_head,
+				     log_used, format);
+	if (log_start >= 0)
+		return log_start;
+
+	log_start = find_legacy_log_start(inode, physical_size, log_len);
+	if (log_start >= 0) {
+		*log_head = 0;
+		*log_used = 0;
+		*format = LOGGERFS_FORMAT_V1;
+		return log_start;
+	}
 
-	return (parsed == 5) ? 0 : -EINVAL;
+	return -1; // 未找到日志
 }
 
-// 重建日志，排除最后一个写操作
-static int rebuild_log_without_last_write(struct loggerfs_file_info *file_info,
-					  const char *old_log)
+// 把一行文本日志（时间 命令全路径 访问类型 起始位置 数据长度）转换为二进制记录追加到日志
+static void import_text_log_line(struct loggerfs_file_info *file_info,
+				 const char *line, unsigned long *dirty_slots)
 {
-	// 简化实现：清空日志区域，这里可以实现更精细的日志重建
-	struct inode *inode = &file_info->vfs_inode;
-	
-	spin_lock(&file_info->log_lock);
-	
-	// 截断文件到数据部分结束
-	truncate_inode_pages(inode->i_mapping, file_info->data_size);
-	i_size_write(inode, file_info->data_size);
-	
-	// 重置日志信息
-	file_info->log_start = file_info->data_size;
-	file_info->log_size = 0;
-	file_info->total_size = file_info->data_size;
-	
-	spin_unlock(&file_info->log_lock);
-	
-	pr_debug("Cleared log area after revert operation\n");
-	return 0;
+	struct loggerfs_log_record rec;
+	char command[LOGGERFS_CMD_SLOT_SIZE], operation[32];
+	long long time, offset;
+	size_t length;
+	int op;
+
+	if (sscanf(line, "%lld %255s %31s %lld %zu", &time, command,
+		   operation, &offset, &length) != 5)
+		return;
+	op = loggerfs_log_op_code(operation);
+	if (op < 0)
+		return;
+
+	rec.cmd = strcmp(command, "[unknown]") ?
+		loggerfs_log_cmd_slot(file_info, command, dirty_slots) :
+		LOGGERFS_CMD_NONE;
+	rec.seq = cpu_to_le64(file_info->log_next_seq++);
+	rec.time = cpu_to_le64((u64)time * NSEC_PER_SEC);
+	rec.offset = cpu_to_le64(offset);
+	rec.length = cpu_to_le32(min_t(size_t, length, U32_MAX));
+	rec.op = cpu_to_le16(op);
+	rec.flags = 0;
+	loggerfs_log_append(file_info, &rec);
 }
 
-// 移除最后一次写操作的日志条目 - 物理日志处理
-int remove_last_write_log(struct loggerfs_file_info *file_info)
+// 把v1/v2/v3格式的文本日志转换为当前的二进制格式并就地重写日志区域。
+// 返回0表示成功，失败时调用者丢弃日志
+static int upgrade_text_log(struct loggerfs_file_info *file_info,
+			    loff_t log_start, size_t len, size_t head,
+			    size_t used, int format)
 {
 	struct inode *inode = &file_info->vfs_inode;
-	char *log_buffer = NULL;
-	char *line_start, *line_end;
-	char operation[32];
-	loff_t last_write_offset = -1;
-	size_t last_write_length = 0;
-	bool found_write = false;
-	int ret = 0;
-
-	if (!file_info) {
-		return -EINVAL;
+	size_t start_len = strlen(LOG_START_MARKER);
+	unsigned long dirty_slots = 0;
+	char *region, *text, *line, *next;
+	int ret;
+
+	region = kvmalloc(len + 1, GFP_KERNEL);
+	text = kvmalloc(len + 1, GFP_KERNEL);
+	if (!region || !text) {
+		ret = -ENOMEM;
+		goto out;
 	}
 
-	spin_lock(&file_info->log_lock);
-
-	if (file_info->log_size == 0) {
-		pr_info("No log data available for revert\n");
-		spin_unlock(&file_info->log_lock);
-		return -ENODATA;
-	}
+	read_from_file(inode, log_start, region, len);
 
-	// 分配缓冲区读取日志内容
-	log_buffer = kmalloc(file_info->log_size + 1, GFP_ATOMIC);
-	if (!log_buffer) {
-		spin_unlock(&file_info->log_lock);
-		return -ENOMEM;
-	}
+	// 把文本线性化为从旧到新的顺序：v1去掉标记，v3按环形位置拼接
+	if (format == LOGGERFS_FORMAT_V1) {
+		used = len - start_len - strlen(LOG_END_MARKER);
+		memcpy(text, region + start_len, used);
+	} else {
+		size_t first = min(used, len - head);
 
-	// 从文件读取日志内容
-	ret = read_from_file(inode, file_info->log_start, log_buffer, file_info->log_size);
-	if (ret != 0) {
-		pr_err("Failed to read log data from file\n");
-		kfree(log_buffer);
-		spin_unlock(&file_info->log_lock);
-		return ret;
-	}
-	
-	log_buffer[file_info->log_size] = '\0';
-
-	// 跳过开始标记，从后往前解析日志找到最后一次写操作
-	char *log_content = strstr(log_buffer, LOG_START_MARKER);
-	if (!log_content) {
-		pr_warn("Log start marker not found\n");
-		kfree(log_buffer);
-		spin_unlock(&file_info->log_lock);
-		return -ENODATA;
-	}
-	log_content += strlen(LOG_START_MARKER);
-
-	// 找到结束标记
-	char *log_end = strstr(log_content, LOG_END_MARKER);
-	if (log_end) {
-		*log_end = '\0'; // 截断到结束标记
-	}
-
-	// 从后往前解析日志行
-	line_end = log_content + strlen(log_content);
-	while (line_end > log_content) {
-		// 向前查找行开始
-		line_start = line_end - 1;
-		while (line_start > log_content && *(line_start - 1) != '\n') {
-			line_start--;
-		}
-		
-		// 解析这一行
-		if (parse_log_line(line_start, line_end - line_start, operation, 
-				   &last_write_offset, &last_write_length) == 0) {
-			if (strcmp(operation, "write") == 0) {
-				found_write = true;
-				break;
-			}
-		}
-		
-		line_end = line_start - 1; // 跳过换行符
-		if (line_end <= log_content)
-			break;
+		memcpy(text, region + head, first);
+		memcpy(text + first, region, used - first);
 	}
+	text[used] = '\0';
 
-	spin_unlock(&file_info->log_lock);
+	truncate_inode_pages(inode->i_mapping, log_start);
+	file_info->log_start = log_start;
 
-	if (!found_write) {
-		pr_info("No write operation found in log for revert\n");
-		kfree(log_buffer);
-		return -ENOENT;
+	for (line = text; line && *line; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		import_text_log_line(file_info, line, &dirty_slots);
 	}
 
-	// 执行文件内容回退
-	ret = restore_original_data(file_info);
-	if (ret == 0) {
-		// 成功回退后，从日志中移除该写操作条目
-		// 这里简化实现：重新构建日志，排除最后一个写操作
-		ret = rebuild_log_without_last_write(file_info, log_buffer);
-		
-		pr_info("Successfully reverted write operation at offset %lld, length %zu\n",
-			(long long)last_write_offset, last_write_length);
+	ret = file_info->log_size ? write_log_region(file_info) : 0;
+	if (ret) {
+		pr_err("Failed to upgrade text log: %d\n", ret);
+		truncate_inode_pages(inode->i_mapping, log_start);
+	} else {
+		pr_info("Upgraded format v%d log to %zu binary records\n",
+			format, file_info->log_used / LOGGERFS_REC_SIZE);
 	}
 
-	kfree(log_buffer);
+out:
+	kvfree(region);
+	kvfree(text);
 	return ret;
 }
 
-// 清理备份数据
-void cleanup_backup_data(struct loggerfs_file_info *file_info)
+// 把文件中table处的命令表和其后的记录区域读入内存
+static int load_log_region(struct loggerfs_file_info *file_info,
+			   loff_t log_start, loff_t table, size_t len,
+			   size_t head, size_t used)
 {
-	if (!file_info)
-		return;
+	struct inode *inode = &file_info->vfs_inode;
+	size_t cap, need, done, n;
+	char *p;
+	int ret = 0;
 
-	if (file_info->backup.original_data) {
-		kfree(file_info->backup.original_data);
-		file_info->backup.original_data = NULL;
+	// 已回绕的日志容量就是区域长度，否则沿用当前容量（至少放得下整个区域）
+	cap = head + used > len ? len : max_t(size_t, len, file_info->log_cap);
+	if (cap != file_info->log_cap)
+		ret = loggerfs_log_resize(file_info, cap,
+					  file_info->log_max_entries);
+	// 没有回绕时只读入最后一条记录之前的部分（轮转过的区域长度总是整个容量）
+	need = head + used > len ? len : head + used;
+	if (ret == 0)
+		ret = loggerfs_log_reserve(file_info, need, GFP_KERNEL);
+	if (ret)
+		return ret;
+
+	read_from_file(inode, table, file_info->log_cmd_table,
+		       LOGGERFS_CMD_TABLE_SIZE);
+	for (done = 0; done < need; done += n) {
+		p = loggerfs_log_seg(file_info, done, need - done, &n);
+		read_from_file(inode, table + LOGGERFS_CMD_TABLE_SIZE + done,
+			       p, n);
 	}
 
-	file_info->backup.offset = 0;
-	file_info->backup.length = 0;
-	file_info->backup.is_valid = false;
+	file_info->log_start = log_start;
+	file_info->log_size = len;
+	file_info->log_head = head;
+	file_info->log_used = used;
+	file_info->log_base = 0;
+	loggerfs_log_reload(file_info);
+	return 0;
 }
 
-// 实际回退文件内容
-static int revert_file_content(struct loggerfs_file_info *file_info,
-			       loff_t write_offset, size_t write_length)
+// 丢弃内存中的日志（文件中的日志区域由调用者处理）
+static void reset_log(struct loggerfs_file_info *file_info)
 {
-	struct inode *inode;
-	loff_t current_data_size;
-	
-	if (!file_info)
-		return -EINVAL;
-
-	inode = &file_info->vfs_inode;
-	current_data_size = file_info->data_size;
+	file_info->log_size = 0;
+	file_info->log_head = 0;
+	file_info->log_used = 0;
+	file_info->log_base = 0;
+	file_info->log_cleared = 0;
+	if (file_info->log_cmd_table)
+		memset(file_info->log_cmd_table, 0, LOGGERFS_CMD_TABLE_SIZE);
+	memset(file_info->log_cmd_seq, 0, sizeof(file_info->log_cmd_seq));
+}
 
-	pr_info("Reverting write operation - offset:%lld, length:%zu, current_size:%lld\n",
-		(long long)write_offset, write_length, (long long)current_data_size);
+// 加载文件布局：只在inode首次使用时从磁盘解析一次。此后file_info中的布局
+// 就是权威数据，由读写、截断和日志路径增量维护，读写不再重复扫描文件
+void loggerfs_load_layout(struct loggerfs_file_info *file_info)
+{
+	struct inode *inode = &file_info->vfs_inode;
+	loff_t physical_size;
+	loff_t log_start, table = -1;
+	size_t log_len = 0, log_head = 0, log_used = 0;
+	int format = 0;
+	u64 start;
+	int ret;
+
+	if (likely(smp_load_acquire(&file_info->layout_loaded)))
+		return;
 
-	// 情况1：有完全匹配的备份数据
-	if (file_info->backup.is_valid &&
-	    file_info->backup.offset == write_offset &&
-	    file_info->backup.length == write_length) {
-		
-		pr_info("Using exact backup data for revert\n");
-		int restore_result = restore_original_data(file_info);
-		cleanup_backup_data(file_info);
+	// 首次加载可能需要转换旧格式，持写锁串行化
+	down_write(&file_info->layout_rwsem);
+	if (file_info->layout_loaded) {
+		up_write(&file_info->layout_rwsem);
+		return;
+	}
 
-		if (restore_result == 0 || restore_result == -EIO) {
-			pr_info("Successfully reverted using backup data\n");
-			return 0;
+	physical_size = i_size_read(inode);
+	start = loggerfs_stat_start();
+	log_start = find_log_start(inode, &log_len, &log_head, &log_used, &format);
+	loggerfs_stat_end(LOGGERFS_SB(inode->i_sb), LOGGERFS_STAT_FIND_LOG, start,
+			  physical_size);
+	if (log_start >= 0) {
+		// 命令表的位置由物理大小推算，v4没有填充
+		if (format >= LOGGERFS_FORMAT_V4) {
+			table = physical_size - LOGGERFS_TRAILER_SIZE - log_len -
+				LOGGERFS_CMD_TABLE_SIZE;
+			ret = load_log_region(file_info, log_start, table,
+					      log_len, log_head, log_used);
 		} else {
-			pr_err("Failed to restore from backup - error: %d\n", restore_result);
-			return restore_result;
+			ret = upgrade_text_log(file_info, log_start, log_len,
+					       log_head, log_used, format);
 		}
-	}
-	// 情况2：有部分覆盖的备份数据
-	else if (file_info->backup.is_valid &&
-		 file_info->backup.offset <= write_offset &&
-		 file_info->backup.offset + file_info->backup.length > write_offset) {
-		
-		pr_info("Using partial backup data for revert\n");
-		// 先恢复备份数据覆盖的部分
-		int restore_result = restore_original_data(file_info);
-		
-		// 然后处理超出备份范围的部分（如果写操作扩展了文件）
-		loff_t backup_end = file_info->backup.offset + file_info->backup.length;
-		if (write_offset + write_length > backup_end) {
-			// 截断到备份数据的结束位置
-			if (backup_end < current_data_size) {
-				file_info->data_size = backup_end;
-				i_size_write(inode, backup_end);
-				pr_info("File truncated to backup end: %lld\n", (long long)backup_end);
-			}
+		if (ret) {
+			// 没有内存放下日志时丢弃日志，数据部分不受影响
+			pr_warn("Failed to load %zu bytes of log, dropping it\n",
+				log_len);
+			truncate_inode_pages(inode->i_mapping, log_start);
+			reset_log(file_info);
 		}
-		
-		cleanup_backup_data(file_info);
-		inode->i_mtime = inode->i_ctime = current_time(inode);
-		
-		if (restore_result == 0 || restore_result == -EIO) {
-			pr_info("Successfully reverted using partial backup\n");
-			return 0;
-		} else {
-			pr_warn("Partial revert with errors: %d\n", restore_result);
-			return 0; // 仍然算成功，因为已经尽力了
+
+		file_info->data_size = log_start;
+		file_info->log_start = log_start;
+		file_info->total_size = log_total_size(file_info);
+
+		// 更新inode的逻辑大小（仅数据部分）
+		i_size_write(inode, file_info->data_size);
+
+		// v4文件（或不同页大小下写入的文件）的命令表不在当前的对齐位置，重写日志区域
+		if (ret == 0 && table >= 0 && table != log_table_pos(file_info)) {
+			loggerfs_detach_log(file_info);
+			loggerfs_attach_log(file_info);
 		}
+	} else {
+		// 没有日志，全部都是数据
+		file_info->data_size = physical_size;
+		file_info->log_start = physical_size;
+		file_info->total_size = physical_size;
+		reset_log(file_info);
 	}
-	// 情况3：写操作是在文件末尾的追加，没有备份但可以截断
-	else if (write_offset + write_length >= current_data_size) {
-		loff_t new_size = write_offset;
-		
-		if (new_size < 0)
-			new_size = 0;
 
-		file_info->data_size = new_size;
-		i_size_write(inode, new_size);
-		inode->i_mtime = inode->i_ctime = current_time(inode);
+	trace_loggerfs_layout_rescan(file_info, log_start, log_len, start);
+	smp_store_release(&file_info->layout_loaded, true);
+	up_write(&file_info->layout_rwsem);
 
-		pr_info("File truncated from %lld to %lld (append revert)\n",
-			(long long)current_data_size, (long long)new_size);
-		return 0;
-	}
-	// 情况4：无法回退的中间写操作
-	else {
-		pr_warn("Cannot revert middle write operation without backup - offset:%lld, length:%zu\n",
-			(long long)write_offset, write_length);
-		pr_warn("Current file size: %lld, backup: %s\n",
-			(long long)current_data_size,
-			file_info->backup.is_valid ? "exists but doesn't cover write area" : "none");
-		return -ENODATA;
-	}
+	pr_debug("File layout loaded: data=%lld, log_start=%lld, log_size=%zu, head=%zu, used=%zu, total=%lld\n",
+		 file_info->data_size, file_info->log_start,
+		 file_info->log_size, file_info->log_head,
+		 file_info->log_used, file_info->total_size);
 }
 
-// 备份写操作前的原始数据
-int backup_original_data(struct loggerfs_file_info *file_info, loff_t offset,
-			 size_t length)
+// 数据区将要越过日志起始位置（扩展写、截断）时清除旧日志区域，
+// 日志内容仍保留在日志缓冲区中。调用者持有layout_rwsem写锁
+void loggerfs_detach_log(struct loggerfs_file_info *file_info)
+{
+	struct inode *inode = &file_info->vfs_inode;
+
+	file_info->log_cleared = 0;
+	if (file_info->total_size <= file_info->data_size)
+		return;
+
+	// 截断数据末尾之后的页面，部分页中属于日志的字节会被清零
+	truncate_inode_pages(inode->i_mapping, file_info->data_size);
+	file_info->log_start = file_info->data_size;
+	file_info->total_size = file_info->data_size;
+}
+
+// 把页缓存中整页对齐的[start, end)写零
+static int zero_log_pages(struct inode *inode, loff_t start, loff_t end)
 {
 	struct page *page;
-	void *page_addr;
-	loff_t page_offset;
-	size_t copy_size;
-	size_t copied = 0;
-	pgoff_t page_idx;
-	int error_count = 0;
-
-	if (!file_info)
-		return -EINVAL;
 
-	if (length == 0) {
-		pr_debug("Backup length is 0, nothing to backup\n");
-		return 0;
-	}
+	for (; start < end; start += PAGE_SIZE) {
+		page = loggerfs_grab_page(inode, start >> PAGE_SHIFT, false);
+		if (IS_ERR(page))
+			return PTR_ERR(page);
 
-	// 检查是否需要保留现有的备份数据
-	// 如果当前操作的起始位置比现有备份更早，则保留现有备份
-	// 否则为当前操作创建新的备份
-	if (file_info->backup.is_valid && file_info->backup.offset < offset) {
-		pr_debug("Keeping earlier backup (offset %lld), not backing up current write (offset %lld)\n",
-			 (long long)file_info->backup.offset, (long long)offset);
-		return 0;
+		zero_user(page, 0, PAGE_SIZE);
+		SetPageUptodate(page);
+		set_page_dirty(page);
+		unlock_page(page);
+		put_page(page);
 	}
+	return 0;
+}
 
-	// 为当前操作创建备份（如果没有备份，或者当前操作更早）
-	cleanup_backup_data(file_info);
+// 扩展写之前为写到end的数据让出位置。end对齐后仍在命令表之前时日志原地不动，
+// 数据只占用填充。命令表需要后移且移动量小于有效记录时，只把命令表和记录区域开头
+// 将被数据占用的页面清零，接回时整个区域轮转（见loggerfs_attach_log）；
+// 否则像原来一样清除整个日志区域。调用者持有layout_rwsem写锁
+void loggerfs_log_make_room(struct loggerfs_file_info *file_info, loff_t end)
+{
+	loff_t table = log_table_pos(file_info);
+	loff_t new_table = round_up(end, LOGGERFS_LOG_ALIGN);
 
-	// 分配备份缓冲区
-	file_info->backup.original_data = kzalloc(length, GFP_KERNEL);
-	if (!file_info->backup.original_data) {
-		pr_err("Failed to allocate backup buffer\n");
-		return -ENOMEM;
+	if (file_info->total_size <= file_info->log_start) {
+		loggerfs_detach_log(file_info);
+		return;
 	}
+	if (new_table <= table)
+		return;
 
-	file_info->backup.offset = offset;
-	file_info->backup.length = length;
-	file_info->backup.is_valid = false;
+	if (new_table - table < file_info->log_used &&
+	    new_table - table < file_info->log_cap &&
+	    zero_log_pages(&file_info->vfs_inode, table, new_table) == 0) {
+		file_info->log_cleared = max(file_info->log_cleared, new_table);
+		return;
+	}
+	loggerfs_detach_log(file_info);
+}
 
-	// 逐页读取原始数据
-	while (copied < length) {
-		page_idx = (offset + copied) >> PAGE_SHIFT;
-		page_offset = (offset + copied) & (PAGE_SIZE - 1);
-		copy_size =
-			min_t(size_t, length - copied, PAGE_SIZE - page_offset);
+// 将日志缓冲区的内容写到当前数据末尾。调用者持有layout_rwsem写锁。
+//
+// 日志区域还在文件中时不重写全部记录：命令表位置不变只更新尾部；命令表后移了s字节时，
+// 记录区域也后移s字节，留在原处的字节在新区域中的位置正好少了s，于是把记录区域
+// 相对内存副本的轮转量log_base减去s（模容量），只需写入新的命令表、原区域开头被清零的
+// 字节（在新区域中回绕到末尾）和尾部。轮转后区域长度固定为整个容量，
+// 没有记录的部分不写入；尾部中的log_head是文件中的位置，加载时按未轮转的区域读入
+int loggerfs_attach_log(struct loggerfs_file_info *file_info)
+{
+	loff_t log_start = file_info->data_size;
+	loff_t table = log_table_pos(file_info);
+	loff_t recs = log_recs_pos(file_info);
+	loff_t new_table = round_up(log_start, LOGGERFS_LOG_ALIGN);
+	size_t cap = file_info->log_cap;
+	size_t shift, len;
+	int ret;
+
+	if (file_info->log_size == 0)
+		return 0;
 
-		// 获取页面
-		page = find_get_page(file_info->vfs_inode.i_mapping,
-				     page_idx);
-		if (!page) {
-			// 页面不存在，说明这部分是空洞，用零填充
-			memset(file_info->backup.original_data + copied, 0,
-			       copy_size);
-			pr_debug("Backup hole data - page %lu\n", page_idx);
-		} else {
-			// 映射页面并复制数据
-			page_addr = kmap(page);
-			if (page_addr) {
-				memcpy(file_info->backup.original_data + copied,
-				       (char *)page_addr + page_offset,
-				       copy_size);
-				kunmap(page);
-				pr_debug(
-					"Backup page data - page %lu, offset %lld, size %zu\n",
-					page_idx, page_offset, copy_size);
-			} else {
-				pr_err("Failed to map page %lu during backup\n",
-				       page_idx);
-				// 映射失败时用零填充，但继续备份其他页面
-				memset(file_info->backup.original_data + copied,
-				       0, copy_size);
-				error_count++;
-			}
-			put_page(page);
-		}
+	if (file_info->total_size > file_info->log_start && new_table >= table &&
+	    new_table - table < cap) {
+		if (log_start == file_info->log_start && !file_info->log_cleared)
+			return 0;
 
-		copied += copy_size;
+		shift = new_table - table;
+		len = file_info->log_cleared > recs ?
+		      file_info->log_cleared - recs : 0;
+		len = max(len, shift);
+
+		if (shift && file_info->log_size < cap)
+			file_info->log_size = cap;
+		file_info->log_base = (file_info->log_base + cap - shift) % cap;
+		file_info->log_start = log_start;
+
+		ret = 0;
+		if (file_info->log_cleared > table || shift)
+			ret = write_log_to_file(&file_info->vfs_inode, new_table,
+						file_info->log_cmd_table,
+						LOGGERFS_CMD_TABLE_SIZE);
+		// 原区域开头（文件偏移0）在内存副本中的位置
+		if (ret == 0 && len)
+			ret = write_log_ring(file_info,
+					     (cap - (file_info->log_base + shift) % cap) % cap,
+					     len);
+		if (ret == 0)
+			ret = write_log_trailer(file_info);
+	} else {
+		file_info->log_start = log_start;
+		ret = write_log_region(file_info);
 	}
+	file_info->log_cleared = 0;
 
-	file_info->backup.is_valid = true;
-
-	if (error_count > 0) {
-		pr_warn("Backup completed with %d mapping errors, some data may be zero-filled\n",
-			error_count);
-	} else {
-		pr_info("Successfully backed up original data - offset:%lld, length:%zu\n",
-			(long long)offset, length);
+	if (ret) {
+		pr_err("Failed to relocate log to %lld: %d\n", (long long)log_start, ret);
+		reset_log(file_info);
 	}
+	file_info->total_size = log_total_size(file_info);
 
-	return 0;
+	return ret;
 }
 
-// 恢复原始数据
-int restore_original_data(struct loggerfs_file_info *file_info)
+// 把数据区改为size字节：日志先移开，截掉多出的页面（扩大时新区域读出为零），
+// 再把日志接到新的数据末尾。调用者持有layout_rwsem写锁
+void loggerfs_resize_data(struct loggerfs_file_info *file_info, loff_t size)
 {
-	struct page *page;
-	void *page_addr;
-	loff_t page_offset;
-	size_t copy_size;
-	size_t copied = 0;
-	pgoff_t page_idx;
-	int error_count = 0;
-	int ret = 0;
+	struct inode *inode = &file_info->vfs_inode;
 
-	if (!file_info || !file_info->backup.is_valid) {
-		pr_warn("No valid backup data to restore\n");
-		return -ENODATA;
-	}
+	loggerfs_detach_log(file_info);
+	truncate_inode_pages(inode->i_mapping, size);
 
-	if (!file_info->backup.original_data) {
-		pr_err("Backup data buffer is NULL\n");
-		return -EINVAL;
-	}
+	file_info->data_size = size;
+	file_info->log_start = size;
+	file_info->total_size = size;
+	i_size_write(inode, size);
 
-	pr_info("Start restoring original data - offset:%lld, length:%zu\n",
-		(long long)file_info->backup.offset, file_info->backup.length);
+	loggerfs_attach_log(file_info);
+}
 
-	// 逐页恢复原始数据
-	while (copied < file_info->backup.length) {
-		page_idx = (file_info->backup.offset + copied) >> PAGE_SHIFT;
-		page_offset =
-			(file_info->backup.offset + copied) & (PAGE_SIZE - 1);
-		copy_size = min_t(size_t, file_info->backup.length - copied,
-				  PAGE_SIZE - page_offset);
+// 意图日志恢复：把从磁盘加载的布局改为已提交的数据大小size。
+// 日志区域位于size之后时仍然有效，随数据末尾移动；否则日志区域已被数据覆盖或没有尾部，
+// 丢弃日志，由调用者追加意图日志中的记录。调用者持有layout_rwsem写锁
+void loggerfs_replay_layout(struct loggerfs_file_info *file_info, loff_t size)
+{
+	struct inode *inode = &file_info->vfs_inode;
 
-		// 获取或创建页面
-		page = find_or_create_page(file_info->vfs_inode.i_mapping,
-					   page_idx, GFP_KERNEL);
-		if (!page) {
-			pr_err("Failed to get page %lu for restore\n",
-			       page_idx);
-			error_count++;
-			copied += copy_size;
-			continue;
-		}
+	if (file_info->log_size && file_info->log_start >= size) {
+		if (file_info->data_size != size)
+			loggerfs_resize_data(file_info, size);
+		return;
+	}
 
-		// 映射页面并恢复数据
-		page_addr = kmap(page);
-		if (page_addr) {
-			memcpy((char *)page_addr + page_offset,
-			       file_info->backup.original_data + copied,
-			       copy_size);
-			kunmap(page);
+	// size之前的页面是已写回的数据，不能像loggerfs_resize_data那样先截到旧的日志位置
+	reset_log(file_info);
+	file_info->log_next_seq = 0;
+	truncate_inode_pages(inode->i_mapping, size);
+	file_info->data_size = size;
+	file_info->log_start = size;
+	file_info->total_size = size;
+	i_size_write(inode, size);
+}
 
-			SetPageUptodate(page);
-			set_page_dirty(page);
+// 从文件读取数据的辅助函数
+int read_from_file(struct inode *inode, loff_t pos, char *buffer, size_t len)
+{
+	size_t read_size = 0;
+	
+	while (read_size < len) {
+		pgoff_t page_idx = (pos + read_size) >> PAGE_SHIFT;
+		size_t page_offset = (pos + read_size) & (PAGE_SIZE - 1);
+		size_t copy_size = min_t(size_t, len - read_size, PAGE_SIZE - page_offset);
+		struct page *page;
+		void *page_addr;
 
-			pr_debug(
-				"Restored page data - page %lu, offset %lld, size %zu\n",
-				page_idx, page_offset, copy_size);
+		page = loggerfs_get_page(inode, page_idx);
+		if (IS_ERR(page))
+			return PTR_ERR(page);
+		if (!page) {
+			// 页面不存在，填零
+			memset(buffer + read_size, 0, copy_size);
 		} else {
-			pr_err("Failed to map page %lu for restore\n",
-			       page_idx);
-			error_count++;
-		}
-
-		unlock_page(page);
-		put_page(page);
-		copied += copy_size;
-	}
-
-	// 更新文件大小（如果需要）
-	if (file_info->backup.offset + file_info->backup.length >=
-	    file_info->data_size) {
-		// 如果原始写操作扩展了文件，恢复到写操作前的大小
-		loff_t original_size = file_info->backup.offset;
-		if (original_size < file_info->data_size) {
-			file_info->data_size = original_size;
-			i_size_write(&file_info->vfs_inode, original_size);
-			pr_info("Restore file size to %lld\n",
-				(long long)original_size);
+			page_addr = kmap_atomic(page);
+			memcpy(buffer + read_size, (char *)page_addr + page_offset, copy_size);
+			kunmap_atomic(page_addr);
+			put_page(page);
 		}
+		read_size += copy_size;
 	}
+	
+	return 0;
+}
 
-	// 更新时间戳
-	file_info->vfs_inode.i_mtime = file_info->vfs_inode.i_ctime =
-		current_time(&file_info->vfs_inode);
+// 撤销最后一次修改：恢复撤销历史的栈顶一层，在日志中原地标记被撤销的记录并追加一条
+// revert记录，其余日志保持不变。数据大小不变时只需重写两条记录
+int remove_last_write_log(struct loggerfs_file_info *file_info)
+{
+	struct loggerfs_log_rec rec;
+	size_t rec_off;
+	loff_t offset = 0;
+	u32 length = 0;
+	u64 start, seq;
+	int ret;
 
-	// 检查是否有错误发生
-	if (error_count > 0) {
-		pr_warn("Restore completed with %d errors\n", error_count);
-		ret = -EIO; // 部分恢复失败
-	} else {
-		pr_info("Successfully restored original data\n");
-		ret = 0; // 完全成功
+	if (!file_info) {
+		return -EINVAL;
+	}
+	start = loggerfs_stat_start();
+	// revert记录不经过槽位环（持写锁时不能等待环上的空位），在持锁之前取得命令
+	rec.cmd = loggerfs_cmd_get_current();
+	rec.tgid = current->tgid;
+	rec.undo = NULL;
+
+	down_write(&file_info->layout_rwsem);
+
+	// 先把排队的记录写入日志，被撤销的记录才能在日志中找到
+	log_close_open_rec_locked(file_info);
+	log_flush_locked(file_info, NULL);
+
+	ret = loggerfs_undo_pop(file_info, &offset, &seq);
+	if (ret) {
+		if (ret == -ENODATA)
+			pr_info("No undo history available for revert\n");
+		goto out;
 	}
 
+	// 被撤销的记录可能已经被环形日志淘汰或因槽位环满被丢弃，此时只追加revert记录
+	if (loggerfs_log_revert(file_info, seq, offset, &rec_off, &length) == 0 &&
+	    write_log_segs(file_info, rec_off, LOGGERFS_REC_SIZE))
+		pr_err("Failed to rewrite reverted log record\n");
+
+	ktime_get_real_ts64(&rec.ts);
+	rec.op = LOGGERFS_OP_REVERT;
+	rec.offset = offset;
+	rec.length = length;
+	log_flush_locked(file_info, &rec);
+
+	pr_info("Reverted write at offset %lld, length %u, %u more undo levels\n",
+		(long long)offset, length, file_info->undo_depth);
+
+out:
+	up_write(&file_info->layout_rwsem);
+	loggerfs_cmd_put(rec.cmd);
+	loggerfs_stat_end(LOGGERFS_SB(file_info->vfs_inode.i_sb),
+			  LOGGERFS_STAT_REVERT, start, length);
+	trace_loggerfs_revert(file_info, offset, length, start);
 	return ret;
 }
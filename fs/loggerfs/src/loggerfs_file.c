@@ -4,223 +4,210 @@
 #include <linux/highmem.h>
 #include <linux/uaccess.h>
 #include <linux/fcntl.h>
+#include <linux/falloc.h>
 #include <linux/slab.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
 #include "../include/loggerfs.h"
+#include "../include/loggerfs_trace.h"
 
 // 物理日志方案：
 // 1. 文件内容和日志都存储在同一个文件中，日志紧跟在数据后面
 // 2. 使用标记来分隔数据和日志区域
 // 3. 读取时自动过滤掉日志部分
 // 4. stat显示的文件大小仅包含数据部分
+// 5. 布局只在inode首次使用时解析（loggerfs_load_layout），之后增量维护
 
-// 初始化文件信息（从已有文件中解析数据和日志布局）
-static void init_file_info_from_disk(struct loggerfs_file_info *file_info)
+// 按读日志策略决定是否记录本次读：关闭或采样跳过的读不分配记录、不查命令路径
+static inline bool log_this_read(struct loggerfs_file_info *file_info)
 {
-	struct inode *inode = &file_info->vfs_inode;
-	loff_t physical_size = i_size_read(inode);
-	loff_t log_start;
-
-	// 查找日志开始位置
-	log_start = find_log_start(inode);
-	if (log_start >= 0) {
-		// 找到了日志
-		file_info->data_size = log_start;
-		file_info->log_start = log_start;
-		file_info->log_size = parse_log_size(inode, log_start);
-		file_info->total_size = physical_size;
-		
-		// 更新inode的逻辑大小（仅数据部分）
-		if (i_size_read(inode) != file_info->data_size) {
-			i_size_write(inode, file_info->data_size);
-		}
-		
-		pr_debug("File layout: data=%lld, log_start=%lld, log_size=%zu, total=%lld\n",
-			 file_info->data_size, file_info->log_start, 
-			 file_info->log_size, file_info->total_size);
-	} else {
-		// 没有日志，全部都是数据
-		file_info->data_size = physical_size;
-		file_info->log_start = physical_size;
-		file_info->log_size = 0;
-		file_info->total_size = physical_size;
-		
-		pr_debug("No log found, pure data file: size=%lld\n", file_info->data_size);
+	switch (READ_ONCE(file_info->read_policy)) {
+	case LOGGERFS_READS_OFF:
+		return false;
+	case LOGGERFS_READS_SAMPLE:
+		return atomic_inc_return(&file_info->read_count) %
+		       READ_ONCE(file_info->read_sample) == 0;
+	default:
+		return true;
 	}
 }
 
-// 文件读操作 - 只读取数据部分，过滤掉日志
-static ssize_t loggerfs_read(struct file *file, char __user *buf, size_t count,
-			     loff_t *ppos)
+// 文件读操作 - 走通用页缓存读路径（含预读、向量和异步I/O）。i_size就是data_size，
+// 通用路径自然只读到数据末尾，日志部分不可见
+static ssize_t loggerfs_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
-	struct inode *inode = file_inode(file);
+	struct inode *inode = file_inode(iocb->ki_filp);
 	struct loggerfs_file_info *file_info =
 		container_of(inode, struct loggerfs_file_info, vfs_inode);
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+	u64 start = loggerfs_stat_start();
+	loff_t pos = iocb->ki_pos;
 	ssize_t ret;
-	loff_t pos = *ppos;
-	size_t copied = 0;
 
-	// 确保文件信息是最新的
-	init_file_info_from_disk(file_info);
+	loggerfs_load_layout(file_info);
 
-	pr_debug("Read operation: pos=%lld, count=%zu, data_size=%lld\n", 
-		 pos, count, file_info->data_size);
+	// 读锁：防止读取过程中数据区被并发截断
+	if (iocb->ki_flags & IOCB_NOWAIT) {
+		if (!down_read_trylock(&file_info->layout_rwsem))
+			return -EAGAIN;
+	} else {
+		down_read(&file_info->layout_rwsem);
+	}
 
-	// 检查读取范围（只能读取数据部分）
-	if (pos >= file_info->data_size)
-		return 0;
+	ret = generic_file_read_iter(iocb, to);
 
-	if (pos + count > file_info->data_size)
-		count = file_info->data_size - pos;
+	up_read(&file_info->layout_rwsem);
 
-	if (count == 0)
-		return 0;
+	// 记录读操作日志（受读日志策略控制）
+	if (ret > 0 && log_this_read(file_info))
+		add_log_entry(file_info, LOGGERFS_OP_READ, pos, ret, NULL);
 
-	// 逐页读取文件内容（仅数据部分）
-	while (copied < count) {
-		pgoff_t page_idx = (pos + copied) >> PAGE_SHIFT;
-		size_t page_offset = (pos + copied) & (PAGE_SIZE - 1);
-		size_t copy_size = min_t(size_t, count - copied, PAGE_SIZE - page_offset);
-		struct page *page;
-		void *page_addr;
-
-		page = find_get_page(inode->i_mapping, page_idx);
-		if (!page) {
-			// 页面不存在，填零（稀疏文件处理）
-			if (clear_user(buf + copied, copy_size)) {
-				if (copied)
-					break;
-				return -EFAULT;
-			}
-		} else {
-			page_addr = kmap_atomic(page);
-			if (copy_to_user(buf + copied, (char *)page_addr + page_offset, copy_size)) {
-				kunmap_atomic(page_addr);
-				put_page(page);
-				if (copied)
-					break;
-				return -EFAULT;
-			}
-			kunmap_atomic(page_addr);
-			put_page(page);
+	loggerfs_stat_end(sbi, LOGGERFS_STAT_READ, start, max_t(ssize_t, ret, 0));
+	trace_loggerfs_read(file_info, pos, max_t(ssize_t, ret, 0), start);
+	return ret;
+}
+
+// 写入不越过数据末尾、不需要清除特权位时不改变布局，可以与其他这样的写入并行
+static bool write_can_share(struct kiocb *iocb, struct iov_iter *from,
+			    struct loggerfs_file_info *file_info)
+{
+	return !(iocb->ki_flags & IOCB_APPEND) &&
+	       IS_NOSEC(&file_info->vfs_inode) &&
+	       iocb->ki_pos + iov_iter_count(from) <= READ_ONCE(file_info->data_size);
+}
+
+// 共享时持inode共享锁和布局读锁，否则持两者的独占锁（布局锁在inode锁之内）
+static int write_lock(struct kiocb *iocb, struct loggerfs_file_info *file_info,
+		      bool shared)
+{
+	struct inode *inode = &file_info->vfs_inode;
+
+	if (iocb->ki_flags & IOCB_NOWAIT) {
+		if (shared ? !inode_trylock_shared(inode) : !inode_trylock(inode))
+			return -EAGAIN;
+		if (shared ? !down_read_trylock(&file_info->layout_rwsem) :
+			     !down_write_trylock(&file_info->layout_rwsem)) {
+			if (shared)
+				inode_unlock_shared(inode);
+			else
+				inode_unlock(inode);
+			return -EAGAIN;
 		}
-		copied += copy_size;
+		return 0;
 	}
 
-	ret = copied;
-	*ppos = pos + copied;
-
-	// 记录读操作日志
-	if (ret > 0) {
-		add_log_entry(file_info, "read", pos, ret);
+	if (shared) {
+		inode_lock_shared(inode);
+		down_read(&file_info->layout_rwsem);
+	} else {
+		inode_lock(inode);
+		down_write(&file_info->layout_rwsem);
 	}
+	return 0;
+}
 
-	pr_debug("Read completed: pos=%lld->%lld, read=%zd\n", pos, *ppos, ret);
-	return ret;
+static void write_unlock(struct loggerfs_file_info *file_info, bool shared)
+{
+	struct inode *inode = &file_info->vfs_inode;
+
+	if (shared) {
+		up_read(&file_info->layout_rwsem);
+		inode_unlock_shared(inode);
+	} else {
+		up_write(&file_info->layout_rwsem);
+		inode_unlock(inode);
+	}
 }
 
-// 文件写操作 - 写入数据部分，日志自动追加到文件末尾
-static ssize_t loggerfs_write(struct file *file, const char __user *buf,
-			      size_t count, loff_t *ppos)
+// 文件写操作 - 写入数据部分，日志自动追加到文件末尾。
+// 数据区内的覆盖写持读锁并锁住涉及的页面范围，同一文件上不重叠的覆盖写并行执行；
+// 扩展写和需要清除特权位的写入持写锁串行执行
+static ssize_t loggerfs_write_iter(struct kiocb *iocb, struct iov_iter *from)
 {
-	struct inode *inode = file_inode(file);
+	struct inode *inode = file_inode(iocb->ki_filp);
 	struct loggerfs_file_info *file_info =
 		container_of(inode, struct loggerfs_file_info, vfs_inode);
-	loff_t pos = *ppos;
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+	struct loggerfs_undo *undo = NULL;
+	u64 start = loggerfs_stat_start();
+	struct loggerfs_range range;
+	loff_t pos = iocb->ki_pos;
+	size_t count;
 	ssize_t ret;
-	size_t copied = 0;
-
-	// 确保文件信息是最新的
-	init_file_info_from_disk(file_info);
+	bool shared;
 
-	pr_debug("Write operation: pos=%lld, count=%zu, data_size=%lld\n", 
-		 pos, count, file_info->data_size);
+	loggerfs_load_layout(file_info);
 
-	// 备份原始数据（用于revert功能）
-	if (pos < file_info->data_size) {
-		size_t backup_len = min_t(size_t, count, file_info->data_size - pos);
-		backup_original_data(file_info, pos, backup_len);
-	}
+	shared = write_can_share(iocb, from, file_info);
+	ret = write_lock(iocb, file_info, shared);
+	if (ret)
+		return ret;
 
-	// 如果写入位置超过当前数据大小，需要先清除日志区域
-	if (pos > file_info->data_size) {
-		// 简化处理：清空日志，扩展数据区域
-		spin_lock(&file_info->log_lock);
-		truncate_inode_pages(inode->i_mapping, file_info->data_size);
-		file_info->log_size = 0;
-		file_info->log_start = file_info->data_size;
-		file_info->total_size = file_info->data_size;
-		spin_unlock(&file_info->log_lock);
+	// 加锁之前数据区可能被截短，这时改用独占锁
+	if (shared && !write_can_share(iocb, from, file_info)) {
+		write_unlock(file_info, true);
+		shared = false;
+		ret = write_lock(iocb, file_info, false);
+		if (ret)
+			return ret;
 	}
 
-	// 逐页写入文件内容
-	while (copied < count) {
-		pgoff_t page_idx = (pos + copied) >> PAGE_SHIFT;
-		size_t page_offset = (pos + copied) & (PAGE_SIZE - 1);
-		size_t copy_size = min_t(size_t, count - copied, PAGE_SIZE - page_offset);
-		struct page *page;
-		void *page_addr;
-
-		// 获取或创建页面
-		page = grab_cache_page(inode->i_mapping, page_idx);
-		if (!page) {
-			ret = copied ? copied : -ENOMEM;
+	// 处理O_APPEND（追加到数据末尾）和文件大小限制
+	ret = generic_write_checks(iocb, from);
+	if (ret <= 0)
+		goto out;
+	pos = iocb->ki_pos;
+	count = ret;
+
+	// 撤销快照按整页处理，并发写入按页对齐锁定
+	if (shared) {
+		ret = loggerfs_range_lock(file_info, &range,
+					  round_down(pos, PAGE_SIZE),
+					  round_up(pos + count, PAGE_SIZE),
+					  !(iocb->ki_flags & IOCB_NOWAIT));
+		if (ret)
 			goto out;
-		}
+	}
 
-		// 如果页面不完整且我们不是写入整页，需要先处理现有内容
-		if (!PageUptodate(page) && (page_offset || copy_size < PAGE_SIZE)) {
-			page_addr = kmap_atomic(page);
-			memset(page_addr, 0, PAGE_SIZE);
-			kunmap_atomic(page_addr);
-		}
+	// 记录被覆盖区域的快照（用于revert功能），追加写只记录原大小
+	mutex_lock(&file_info->undo_lock);
+	loggerfs_undo_push(file_info, pos, pos + count, shared, &undo);
+	mutex_unlock(&file_info->undo_lock);
 
-		// 写入数据
-		page_addr = kmap_atomic(page);
-		if (copy_from_user((char *)page_addr + page_offset, buf + copied, copy_size)) {
-			kunmap_atomic(page_addr);
-			unlock_page(page);
-			put_page(page);
-			ret = copied ? copied : -EFAULT;
-			goto out;
-		}
-		kunmap_atomic(page_addr);
+	// 写入会越过当前数据末尾：先为数据让出日志区域开头的页面，写完后再把日志接到新的数据末尾
+	if (pos + count > file_info->data_size)
+		loggerfs_log_make_room(file_info, pos + count);
 
-		// 标记页面为最新和脏页
-		SetPageUptodate(page);
-		set_page_dirty(page);
-		unlock_page(page);
-		put_page(page);
+	// 通用写路径逐页拷贝并在扩展时更新i_size，部分写入也会反映在i_size上
+	ret = __generic_file_write_iter(iocb, from);
 
-		copied += copy_size;
+	// 没有完整写入时恢复未写到的部分：独占写时被整页覆盖的原页面已移入快照
+	if (undo && ret < (ssize_t)count) {
+		mutex_lock(&file_info->undo_lock);
+		loggerfs_undo_unwind(file_info, undo, pos + max_t(ssize_t, ret, 0));
+		mutex_unlock(&file_info->undo_lock);
 	}
 
-	ret = copied;
-	*ppos = pos + copied;
-
-	// 更新数据大小
-	if (*ppos > file_info->data_size) {
-		spin_lock(&file_info->log_lock);
-		file_info->data_size = *ppos;
-		file_info->log_start = file_info->data_size;
-		// 注意：这里不更新i_size，因为物理文件大小包含日志
-		spin_unlock(&file_info->log_lock);
+	if (shared) {
+		loggerfs_range_unlock(file_info, &range);
+	} else {
+		if (i_size_read(inode) > file_info->data_size)
+			file_info->data_size = i_size_read(inode);
+		loggerfs_attach_log(file_info);
 	}
 
 out:
-	// 记录写操作日志（这会更新物理文件大小）
-	if (ret > 0) {
-		add_log_entry(file_info, "write", pos, ret);
+	write_unlock(file_info, shared);
 
-		// 更新inode的逻辑大小（仅数据部分，供stat使用）
-		i_size_write(inode, file_info->data_size);
-
-		// 更新时间戳
-		inode->i_mtime = inode->i_ctime = current_time(inode);
-		mark_inode_dirty(inode);
+	if (ret > 0) {
+		// 记录写操作日志，撤销层随记录得到序号
+		add_log_entry(file_info, LOGGERFS_OP_WRITE, pos, ret, undo);
+		ret = generic_write_sync(iocb, ret);
 	}
-
-	pr_debug("Write completed: pos=%lld->%lld, written=%zd, data_size=%lld\n", 
-		 pos, *ppos, ret, file_info->data_size);
+	if (undo)
+		loggerfs_undo_put(undo);
+	loggerfs_stat_end(sbi, LOGGERFS_STAT_WRITE, start, max_t(ssize_t, ret, 0));
+	trace_loggerfs_write(file_info, pos, max_t(ssize_t, ret, 0), start);
 	return ret;
 }
 
@@ -239,123 +226,444 @@ static int loggerfs_setattr(struct dentry *dentry, struct iattr *attr)
 	// 处理文件大小变化（truncate操作）
 	if (attr->ia_valid & ATTR_SIZE) {
 		loff_t new_size = attr->ia_size;
+		struct loggerfs_undo *undo = NULL;
 		
-		// 确保文件信息是最新的
-		init_file_info_from_disk(file_info);
+		loggerfs_load_layout(file_info);
 		
 		pr_debug("Truncate operation: %lld->%lld\n", 
 			 file_info->data_size, new_size);
 
-		// 备份即将被截断的数据（用于revert功能）
-		if (new_size < file_info->data_size) {
-			backup_original_data(file_info, new_size, 
-					    file_info->data_size - new_size);
-		}
+		down_write(&file_info->layout_rwsem);
 
-		spin_lock(&file_info->log_lock);
+		// 记录即将被截断的数据或原大小（用于revert功能）
+		if (new_size != file_info->data_size)
+			loggerfs_undo_push(file_info, new_size, file_info->data_size,
+					   false, &undo);
 
-		// 截断页面
-		truncate_inode_pages(inode->i_mapping, new_size);
+		// 保留日志：先清除旧日志区域，截断数据后再接到新的数据末尾
+		loggerfs_resize_data(file_info, new_size);
 
-		// 更新文件布局
-		file_info->data_size = new_size;
-		file_info->log_start = new_size;
-		file_info->log_size = 0; // 截断时清空日志
-		file_info->total_size = new_size;
-
-		// 更新inode逻辑大小
-		i_size_write(inode, new_size);
-
-		spin_unlock(&file_info->log_lock);
+		up_write(&file_info->layout_rwsem);
 
 		// 记录truncate操作日志
-		add_log_entry(file_info, "truncate", new_size, 0);
+		add_log_entry(file_info, LOGGERFS_OP_TRUNCATE, new_size, 0, undo);
+		if (undo)
+			loggerfs_undo_put(undo);
 	}
 
+	// 堆叠模式下权限、属主和时间戳同时修改下层文件
+	ret = loggerfs_lower_setattr(file_info, attr);
+	if (ret)
+		return ret;
+
 	setattr_copy(inode, attr);
 	mark_inode_dirty(inode);
 	return 0;
 }
 
-// ioctl操作 - 支持READLOG和REVERT命令
-static long loggerfs_ioctl(struct file *file, unsigned int cmd,
-			   unsigned long arg)
+// 把数据区[start, end)逐页写零（下层不支持打洞时使用）
+static int zero_pages(struct inode *inode, loff_t start, loff_t end)
+{
+	struct page *page;
+	unsigned int off, len;
+
+	for (; start < end; start += len) {
+		off = offset_in_page(start);
+		len = min_t(loff_t, PAGE_SIZE - off, end - start);
+
+		page = loggerfs_grab_page(inode, start >> PAGE_SHIFT,
+					  len < PAGE_SIZE);
+		if (IS_ERR(page))
+			return PTR_ERR(page);
+
+		zero_user(page, off, len);
+		SetPageUptodate(page);
+		set_page_dirty(page);
+		unlock_page(page);
+		put_page(page);
+	}
+	return 0;
+}
+
+// 清除数据区[start, end)：内存模式下页缓存就是存储，去掉整页即成为空洞（读出零），
+// 边缘页在页缓存中清零。堆叠模式下先清页缓存再对下层打洞（反过来正在进行的回写会把
+// 旧数据写回洞中），下层不支持打洞时经页缓存写零
+static int fallocate_clear(struct loggerfs_file_info *file_info, loff_t start,
+			   loff_t end)
+{
+	struct inode *inode = &file_info->vfs_inode;
+	int ret;
+
+	truncate_pagecache_range(inode, start, end - 1);
+	if (!loggerfs_stacked(inode->i_sb))
+		return 0;
+
+	ret = loggerfs_lower_fallocate(file_info,
+				       FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+				       start, end - start);
+	if (ret == -EOPNOTSUPP)
+		ret = zero_pages(inode, start, end);
+	return ret;
+}
+
+// fallocate：预分配（mode为0或KEEP_SIZE）、打洞（PUNCH_HOLE）和清零（ZERO_RANGE）。
+// 改变数据区内容或大小的操作先压入撤销层，可以REVERT；每次调用记录一条日志。
+// 数据区之外（日志、尾部）永远不会被打洞或清零
+static long loggerfs_fallocate(struct file *file, int mode, loff_t offset,
+			       loff_t len)
 {
 	struct inode *inode = file_inode(file);
 	struct loggerfs_file_info *file_info =
 		container_of(inode, struct loggerfs_file_info, vfs_inode);
+	struct loggerfs_undo *undo = NULL;
+	loff_t end = offset + len;
+	bool extend, logged = false;
+	loff_t clear_end, alloc_end;
+	u16 op;
+	int ret;
 
-	switch (cmd) {
-	case READLOG_CMD: {
-		char *log_buffer;
-		size_t log_len;
+	// 其他组合（COLLAPSE_RANGE、INSERT_RANGE等）会移动日志所在的区域，不支持
+	if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE |
+		     FALLOC_FL_ZERO_RANGE))
+		return -EOPNOTSUPP;
 
-		// 确保文件信息是最新的
-		init_file_info_from_disk(file_info);
+	if (mode & FALLOC_FL_PUNCH_HOLE)
+		op = LOGGERFS_OP_PUNCH;
+	else if (mode & FALLOC_FL_ZERO_RANGE)
+		op = LOGGERFS_OP_ZERO;
+	else
+		op = LOGGERFS_OP_ALLOCATE;
 
-		if (file_info->log_size == 0) {
-			return 0; // 没有日志
-		}
+	loggerfs_load_layout(file_info);
 
-		// 分配缓冲区读取日志内容
-		log_buffer = kmalloc(file_info->log_size + 1, GFP_KERNEL);
-		if (!log_buffer)
-			return -ENOMEM;
+	inode_lock(inode);
+	ret = file_remove_privs(file);
+	if (ret)
+		goto out_inode;
 
-		// 从文件读取日志内容
-		if (read_from_file(inode, file_info->log_start, log_buffer, file_info->log_size) != 0) {
-			kfree(log_buffer);
-			return -EIO;
-		}
+	down_write(&file_info->layout_rwsem);
 
-		log_buffer[file_info->log_size] = '\0';
+	extend = !(mode & FALLOC_FL_KEEP_SIZE) && end > file_info->data_size;
+	if (extend) {
+		ret = inode_newsize_ok(inode, end);
+		if (ret)
+			goto out;
+	}
 
-		// 查找日志内容（跳过开始标记，去除结束标记）
-		char *log_content = strstr(log_buffer, LOG_START_MARKER);
-		if (log_content) {
-			log_content += strlen(LOG_START_MARKER);
-			char *log_end = strstr(log_content, LOG_END_MARKER);
-			if (log_end) {
-				*log_end = '\0';
-			}
-			log_len = strlen(log_content);
-		} else {
-			log_len = 0;
+	pr_debug("Fallocate operation: mode=%#x, %lld+%lld, data_size=%lld\n",
+		 mode, offset, len, file_info->data_size);
+
+	// 先为数据区（扩展时包括新增的部分）预留下层空间（不改变下层文件的大小和内容），
+	// 下层不支持时忽略。失败时数据区和撤销历史都还没有改动，不更新时间也不记录日志
+	if (op == LOGGERFS_OP_ALLOCATE) {
+		alloc_end = extend ? end : min(end, file_info->data_size);
+		if (offset < alloc_end) {
+			ret = loggerfs_lower_fallocate(file_info, FALLOC_FL_KEEP_SIZE,
+						       offset, alloc_end - offset);
+			if (ret == -EOPNOTSUPP)
+				ret = 0;
+			if (ret)
+				goto out;
 		}
+	}
 
-		// 将日志内容复制到用户空间
-		if (log_len > 0) {
-			if (copy_to_user((void __user *)arg, log_content, log_len)) {
-				kfree(log_buffer);
-				return -EFAULT;
+	// 只有清除数据或扩展数据区时需要撤销层；打洞不改变大小，完全在数据区之外时无事可做
+	clear_end = op == LOGGERFS_OP_ALLOCATE ? offset :
+		    min(end, file_info->data_size);
+	if (!extend && offset >= clear_end) {
+		logged = op == LOGGERFS_OP_ALLOCATE;
+	} else {
+		// 预分配不改变内容，只记录原大小
+		loggerfs_undo_push(file_info, op == LOGGERFS_OP_ALLOCATE ?
+				   max(offset, file_info->data_size) : offset,
+				   end, false, &undo);
+
+		if (offset < clear_end) {
+			ret = fallocate_clear(file_info, offset, clear_end);
+			if (ret) {
+				// 恢复已经清掉的部分（整页快照已不在页缓存中）
+				if (undo)
+					loggerfs_undo_unwind(file_info, undo, offset);
+				goto out;
 			}
 		}
 
-		kfree(log_buffer);
-		pr_debug("READLOG: returned %zu bytes of log data\n", log_len);
+		if (extend)
+			loggerfs_resize_data(file_info, end);
+		logged = true;
+	}
+
+	if (logged) {
+		inode->i_mtime = inode->i_ctime = current_time(inode);
+		mark_inode_dirty(inode);
+	}
+
+out:
+	up_write(&file_info->layout_rwsem);
+out_inode:
+	inode_unlock(inode);
+	if (logged)
+		add_log_entry(file_info, op, offset, len, undo);
+	if (undo)
+		loggerfs_undo_put(undo);
+	return ret;
+}
+
+// 内存模式的SEEK_DATA/SEEK_HOLE：页缓存中存在的页面是数据，不存在的页面是空洞
+static loff_t mem_seek_data(struct address_space *mapping, loff_t offset,
+			    loff_t size, int whence)
+{
+	pgoff_t index = offset >> PAGE_SHIFT;
+	pgoff_t last = (size - 1) >> PAGE_SHIFT;
+
+	if (whence == SEEK_DATA) {
+		if (!xa_find(&mapping->i_pages, &index, last, XA_PRESENT))
+			return -ENXIO;
+		return max_t(loff_t, offset, (loff_t)index << PAGE_SHIFT);
+	}
+
+	while (index <= last && xa_load(&mapping->i_pages, index)) {
+		index++;
+		cond_resched();
+	}
+	return max_t(loff_t, offset, (loff_t)index << PAGE_SHIFT);
+}
+
+// llseek：SEEK_DATA/SEEK_HOLE只在数据区内查找，日志区域既不是数据也不是空洞；
+// 数据末尾视为空洞，从数据末尾及之后开始查找返回-ENXIO。其他方式走通用路径（i_size就是data_size）
+static loff_t loggerfs_llseek(struct file *file, loff_t offset, int whence)
+{
+	struct inode *inode = file_inode(file);
+	struct loggerfs_file_info *file_info =
+		container_of(inode, struct loggerfs_file_info, vfs_inode);
+	loff_t size, ret;
+
+	if (whence != SEEK_DATA && whence != SEEK_HOLE)
+		return generic_file_llseek(file, offset, whence);
+
+	loggerfs_load_layout(file_info);
+
+	// 读锁：查找过程中数据末尾不变
+	down_read(&file_info->layout_rwsem);
+	size = file_info->data_size;
+	if (offset < 0 || offset >= size)
+		ret = -ENXIO;
+	else if (loggerfs_stacked(inode->i_sb))
+		ret = loggerfs_lower_seek_data(file_info, offset, whence);
+	else
+		ret = mem_seek_data(inode->i_mapping, offset, size, whence);
+	up_read(&file_info->layout_rwsem);
+
+	// 下层文件中数据末尾之后是日志
+	if (ret >= size)
+		ret = whence == SEEK_DATA ? -ENXIO : size;
+	if (ret < 0)
+		return ret;
+	return vfs_setpos(file, ret, inode->i_sb->s_maxbytes);
+}
+
+// fsync/fdatasync：内存模式下页缓存就是存储，无事可做。堆叠模式下先把排队的记录写入日志，
+// 再经由意图日志成组提交：数据部分写回并刷盘，记录随事务一起落盘，同时到达的fsync合并为一次提交。
+// 撤销历史只在内存中，不需要刷盘；没有意图日志时把整个文件（数据、日志和尾部）写回并刷盘
+static int loggerfs_fsync(struct file *file, loff_t start, loff_t end,
+			  int datasync)
+{
+	struct inode *inode = file_inode(file);
+	struct loggerfs_file_info *file_info =
+		container_of(inode, struct loggerfs_file_info, vfs_inode);
+	int ret, err;
+
+	if (!loggerfs_stacked(inode->i_sb))
+		return 0;
+
+	loggerfs_flush_log(file_info);
+	if (LOGGERFS_SB(inode->i_sb)->journal_file)
+		ret = loggerfs_journal_fsync(file_info);
+	else
+		ret = loggerfs_lower_fsync(file_info, LLONG_MAX, datasync);
+
+	// 回写线程之前遇到的写回错误也要报告给这个文件
+	err = file_check_and_advance_wb_err(file);
+	return ret ? ret : err;
+}
+
+// ioctl操作 - 支持READLOG、流式的LOGGERFS_IOC_READLOG、新记录通知、REVERT、日志配置和读日志策略命令
+static long loggerfs_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct inode *inode = file_inode(file);
+	struct loggerfs_file_info *file_info =
+		container_of(inode, struct loggerfs_file_info, vfs_inode);
+
+	switch (cmd) {
+	case READLOG_CMD: {
+		long log_len;
+
+		loggerfs_load_layout(file_info);
+		// 先把尚在队列中的记录写入日志
+		loggerfs_flush_log(file_info);
+
+		// 日志以二进制记录保存，在这里才格式化为文本，最多LOGGERFS_READLOG_MAX字节
+		down_read(&file_info->layout_rwsem);
+		log_len = loggerfs_log_render_to_user(file_info,
+						      (char __user *)arg,
+						      LOGGERFS_READLOG_MAX);
+		up_read(&file_info->layout_rwsem);
+
+		pr_debug("READLOG: returned %ld bytes of log data\n", log_len);
 		return log_len;
 	}
 
+	case LOGGERFS_IOC_READLOG: {
+		struct loggerfs_readlog rl;
+		long ret;
+
+		if (copy_from_user(&rl, (void __user *)arg, sizeof(rl)))
+			return -EFAULT;
+		if (rl.version != LOGGERFS_READLOG_V1 ||
+		    rl.flags & ~(LOGGERFS_READLOG_BINARY | LOGGERFS_READLOG_ALL))
+			return -EINVAL;
+
+		loggerfs_load_layout(file_info);
+		loggerfs_flush_log(file_info);
+
+		// 只返回缓冲区放得下的记录，调用者用回填的next_seq继续读取
+		down_read(&file_info->layout_rwsem);
+		ret = loggerfs_log_read_user(file_info, &rl);
+		up_read(&file_info->layout_rwsem);
+
+		if (ret >= 0 && copy_to_user((void __user *)arg, &rl, sizeof(rl)))
+			return -EFAULT;
+		return ret;
+	}
+
+	case LOGGERFS_IOC_WATCH:
+		// 返回新的通知fd，之后追加进日志的记录都会送到它的队列中
+		loggerfs_load_layout(file_info);
+		return loggerfs_watch_create(file,
+					     (struct loggerfs_watch_args __user *)arg);
+
 	case REVERT_CMD:
 		// 撤销最后一次写操作
 		pr_debug("REVERT: attempting to revert last write operation\n");
+		loggerfs_load_layout(file_info);
 		return remove_last_write_log(file_info);
 
+	case GETLOGCONF_CMD: {
+		struct loggerfs_log_config conf;
+
+		loggerfs_load_layout(file_info);
+		loggerfs_flush_log(file_info);
+
+		down_read(&file_info->layout_rwsem);
+		conf.log_size = file_info->log_cap;
+		conf.log_entries = file_info->log_max_entries;
+		conf.log_used = file_info->log_used;
+		conf.nr_entries = file_info->log_used / LOGGERFS_REC_SIZE;
+		up_read(&file_info->layout_rwsem);
+
+		if (copy_to_user((void __user *)arg, &conf, sizeof(conf)))
+			return -EFAULT;
+		return 0;
+	}
+
+	case SETLOGCONF_CMD: {
+		struct loggerfs_log_config conf;
+		int ret;
+
+		// 修改日志配置会淘汰记录、重写日志区域，要求以写方式打开
+		if (!(file->f_mode & FMODE_WRITE))
+			return -EBADF;
+		if (copy_from_user(&conf, (void __user *)arg, sizeof(conf)))
+			return -EFAULT;
+		if (conf.log_size < LOGGERFS_MIN_LOG_SIZE ||
+		    conf.log_size > LOGGERFS_MAX_LOG_SIZE)
+			return -EINVAL;
+
+		loggerfs_load_layout(file_info);
+		loggerfs_flush_log(file_info);
+
+		down_write(&file_info->layout_rwsem);
+		ret = loggerfs_log_resize(file_info, conf.log_size,
+					  conf.log_entries);
+		if (ret == 0) {
+			// 日志已线性化到新的缓冲区，重写文件中的日志区域
+			loggerfs_detach_log(file_info);
+			ret = loggerfs_attach_log(file_info);
+		}
+		up_write(&file_info->layout_rwsem);
+
+		pr_debug("SETLOGCONF: log_size=%u log_entries=%u ret=%d\n",
+			 conf.log_size, conf.log_entries, ret);
+		return ret;
+	}
+
+	case GETLOGPOLICY_CMD: {
+		struct loggerfs_log_policy policy;
+
+		policy.read_policy = READ_ONCE(file_info->read_policy);
+		policy.read_sample = READ_ONCE(file_info->read_sample);
+		if (copy_to_user((void __user *)arg, &policy, sizeof(policy)))
+			return -EFAULT;
+		return 0;
+	}
+
+	case SETLOGPOLICY_CMD: {
+		struct loggerfs_log_policy policy;
+
+		// 关闭读日志会隐藏访问记录，与修改日志配置一样要求以写方式打开
+		if (!(file->f_mode & FMODE_WRITE))
+			return -EBADF;
+		if (copy_from_user(&policy, (void __user *)arg, sizeof(policy)))
+			return -EFAULT;
+		if (policy.read_policy > LOGGERFS_READS_COALESCE ||
+		    policy.read_sample < 1)
+			return -EINVAL;
+
+		// 策略只在读写路径上按值读取，不需要持锁；离开合并模式时打开的记录
+		// 由下一条记录或下一次刷新入队
+		WRITE_ONCE(file_info->read_sample, policy.read_sample);
+		WRITE_ONCE(file_info->read_policy, policy.read_policy);
+
+		pr_debug("SETLOGPOLICY: read_policy=%u read_sample=%u\n",
+			 policy.read_policy, policy.read_sample);
+		return 0;
+	}
+
 	default:
 		return -ENOTTY;
 	}
 }
 
-// 不需要自定义address_space_operations，使用默认的页缓存机制
+// 页缓存就是文件的全部存储（与ramfs相同）：缺页填零，写入只标脏不回写
+const struct address_space_operations loggerfs_aops = {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+	.read_folio = simple_read_folio,
+	.dirty_folio = noop_dirty_folio,
+#else
+	.readpage = simple_readpage,
+	.set_page_dirty = __set_page_dirty_no_writeback,
+#endif
+	.write_begin = simple_write_begin,
+	.write_end = simple_write_end,
+};
 
-// 文件操作结构体
+// 文件操作结构体：splice经由read_iter/write_iter，sendfile和copy_file_range同样记录日志
 const struct file_operations loggerfs_file_operations = {
-	.read = loggerfs_read,
-	.write = loggerfs_write,
+	.read_iter = loggerfs_read_iter,
+	.write_iter = loggerfs_write_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	.splice_read = copy_splice_read,
+#else
+	.splice_read = generic_file_splice_read,
+#endif
+	.splice_write = iter_file_splice_write,
 	.unlocked_ioctl = loggerfs_ioctl,
-	.llseek = generic_file_llseek,
-	.mmap = generic_file_mmap,
+	.llseek = loggerfs_llseek,
+	.mmap = loggerfs_file_mmap,
 	.open = generic_file_open,
+	.fsync = loggerfs_fsync,
+	.fallocate = loggerfs_fallocate,
 };
 
 // 文件inode操作结构体
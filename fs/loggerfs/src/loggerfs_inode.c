@@ -6,138 +6,113 @@
 #include <linux/time.h>
 #include "../include/loggerfs.h"
 
-// 外部声明 - 在 loggerfs_super.c 中定义
-extern struct kmem_cache *loggerfs_inode_cachep;
-
-// 创建新的loggerfs文件info结构 - 物理日志方案
-static struct loggerfs_file_info *loggerfs_alloc_inode(struct super_block *sb)
-{
-	struct loggerfs_file_info *file_info;
-
-	file_info = kmem_cache_alloc(loggerfs_inode_cachep, GFP_KERNEL);
-	if (!file_info)
-		return NULL;
-
-	// 初始化文件数据和日志布局信息
-	file_info->data_size = 0;
-	file_info->log_start = 0;
-	file_info->log_size = 0;
-	file_info->total_size = 0;
-
-	// 初始化备份数据结构
-	file_info->backup.is_valid = false;
-	file_info->backup.original_data = NULL;
-	file_info->backup.offset = 0;
-	file_info->backup.length = 0;
-
-	// log_lock已在alloc_inode中初始化，无需重复初始化
-
-	pr_debug("Allocated new loggerfs inode with physical log support\n");
-	return file_info;
-}
-
-// 目录操作 - 创建文件
-static int loggerfs_create(struct inode *dir, struct dentry *dentry,
-			   umode_t mode, bool excl)
+// 普通文件inode的公共初始化：预分配日志缓冲区并取挂载选项中的日志配置
+int loggerfs_init_file_inode(struct inode *inode)
 {
-	struct loggerfs_file_info *file_info;
-	struct inode *inode;
-
-	file_info = loggerfs_alloc_inode(dir->i_sb);
-	if (!file_info) {
-		pr_err("Failed to allocate loggerfs_file_info for file creation\n");
-		return -ENOSPC;
-	}
-
-	inode = &file_info->vfs_inode;
-	inode_init_once(inode);
-	inode->i_sb = dir->i_sb;
-	inode->i_mode = mode | S_IFREG;
-	inode->i_uid = current_fsuid();
-	inode->i_gid = current_fsgid();
-	inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode);
-	inode->i_ino = get_next_ino();
+	struct loggerfs_file_info *file_info =
+		container_of(inode, struct loggerfs_file_info, vfs_inode);
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+	int ret;
+
+	// 日志缓冲区的第一段随inode预分配，容量取挂载选项
+	ret = loggerfs_log_resize(file_info, sbi->log_size, sbi->log_entries);
+	if (ret)
+		return ret;
+	ret = loggerfs_log_slots_init(file_info);
+	if (ret)
+		return ret;
+
+	file_info->read_policy = sbi->read_policy;
+	file_info->read_sample = sbi->read_sample;
 	inode->i_op = &loggerfs_file_inode_operations;
 	inode->i_fop = &loggerfs_file_operations;
-	inode->i_size = 0;
-
-	d_instantiate(dentry, inode);
-	dget(dentry);
-
-	pr_debug("Created new loggerfs file: %s\n", dentry->d_name.name);
 	return 0;
 }
 
-// 目录操作 - 创建目录
-static int loggerfs_mkdir(struct inode *dir, struct dentry *dentry,
-			  umode_t mode)
+// 创建新的loggerfs inode - 物理日志方案
+// 通过new_inode()走s_op->alloc_inode，file_info的初始化只在一处完成
+static struct inode *loggerfs_get_inode(struct super_block *sb,
+					const struct inode *dir, umode_t mode,
+					dev_t dev)
 {
 	struct loggerfs_file_info *file_info;
 	struct inode *inode;
 
-	file_info = loggerfs_alloc_inode(dir->i_sb);
-	if (!file_info) {
-		pr_err("Failed to allocate loggerfs_file_info for directory creation\n");
-		return -ENOSPC;
-	}
+	inode = new_inode(sb);
+	if (!inode)
+		return NULL;
+
+	file_info = container_of(inode, struct loggerfs_file_info, vfs_inode);
 
-	inode = &file_info->vfs_inode;
-	inode_init_once(inode);
-	inode->i_sb = dir->i_sb;
-	inode->i_mode = mode | S_IFDIR;
-	inode->i_uid = current_fsuid();
-	inode->i_gid = current_fsgid();
+	inode->i_ino = get_next_ino();
+	inode_init_owner(inode, dir, mode);
 	inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode);
-	inode->i_op = &simple_dir_inode_operations;
-	inode->i_fop = &simple_dir_operations;
-	inc_nlink(inode);
 
-	d_instantiate(dentry, inode);
-	dget(dentry);
-	inc_nlink(dir);
+	switch (mode & S_IFMT) {
+	case S_IFREG:
+		if (loggerfs_init_file_inode(inode)) {
+			iput(inode);
+			return NULL;
+		}
+		inode->i_mapping->a_ops = &loggerfs_aops;
+		// 页缓存是唯一的存储，页面不能被回收
+		mapping_set_unevictable(inode->i_mapping);
+		inode->i_size = 0;
+		// 新建的空文件布局已知，无需再从磁盘解析
+		file_info->layout_loaded = true;
+		break;
+	case S_IFDIR:
+		inode->i_op = &simple_dir_inode_operations;
+		inode->i_fop = &simple_dir_operations;
+		inc_nlink(inode);
+		break;
+	default:
+		init_special_inode(inode, mode, dev);
+		break;
+	}
 
-	pr_debug("Created new directory: %s\n", dentry->d_name.name);
-	return 0;
+	return inode;
 }
 
-// 特殊文件创建（设备文件、FIFO等）
+// 特殊文件创建（设备文件、FIFO等），普通文件和目录也经由此处
 static int loggerfs_mknod(struct inode *dir, struct dentry *dentry,
 			  umode_t mode, dev_t dev)
 {
-	struct loggerfs_file_info *file_info;
 	struct inode *inode;
 
-	file_info = loggerfs_alloc_inode(dir->i_sb);
-	if (!file_info) {
-		pr_err("Failed to allocate loggerfs_file_info for inode\n");
+	inode = loggerfs_get_inode(dir->i_sb, dir, mode, dev);
+	if (!inode) {
+		pr_err("Failed to allocate loggerfs inode\n");
 		return -ENOSPC;
 	}
 
-	inode = &file_info->vfs_inode;
-	inode_init_once(inode);
-	inode->i_sb = dir->i_sb;
-	inode->i_ino = get_next_ino();
-
-	if (S_ISREG(mode)) {
-		inode->i_op = &loggerfs_file_inode_operations;
-		inode->i_fop = &loggerfs_file_operations;
-		inode->i_size = 0;
-	} else {
-		init_special_inode(inode, mode, dev);
-	}
-
-	inode->i_mode = mode;
-	inode->i_uid = current_fsuid();
-	inode->i_gid = current_fsgid();
-	inode->i_atime = inode->i_mtime = inode->i_ctime = current_time(inode);
-
 	d_instantiate(dentry, inode);
 	dget(dentry);
+	dir->i_mtime = dir->i_ctime = current_time(dir);
 
 	pr_debug("Created inode: %s (mode=0%o)\n", dentry->d_name.name, mode);
 	return 0;
 }
 
+// 目录操作 - 创建文件
+static int loggerfs_create(struct inode *dir, struct dentry *dentry,
+			   umode_t mode, bool excl)
+{
+	return loggerfs_mknod(dir, dentry, mode | S_IFREG, 0);
+}
+
+// 目录操作 - 创建目录
+static int loggerfs_mkdir(struct inode *dir, struct dentry *dentry,
+			  umode_t mode)
+{
+	int ret;
+
+	ret = loggerfs_mknod(dir, dentry, mode | S_IFDIR, 0);
+	if (!ret)
+		inc_nlink(dir);
+	return ret;
+}
+
 // 目录inode操作结构体
 const struct inode_operations loggerfs_dir_inode_operations = {
 	.create = loggerfs_create,
@@ -0,0 +1,728 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/fs.h>
+#include <linux/namei.h>
+#include <linux/mount.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/log2.h>
+#include <linux/string.h>
+#include <linux/crc32.h>
+#include <linux/cred.h>
+#include <linux/dcache.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/errseq.h>
+#include "../include/loggerfs.h"
+
+// 堆叠模式的意图日志（挂载选项journal=，默认打开）：
+// 1. 写入只修改页缓存，数据页、日志区域和尾部各自由回写线程写回，崩溃后数据和日志可能不一致：
+//    尾部指向已被数据覆盖的区域，或者日志中的记录描述的数据没有落盘
+// 2. 日志线程编码一批记录时，同时把记录和写入后的数据大小作为一个块追加到正在积累的事务中
+// 3. 一轮刷新结束后提交事务（有序模式）：先把事务中各文件的数据部分写回并刷盘，再把整个事务
+//    一次写入下层目录中的意图日志文件并刷盘。并发写入者的记录由同一次刷盘提交（成组提交），
+//    日志区域和尾部仍由回写线程异步写回
+// 4. 意图日志超过LOGGERFS_JOURNAL_MAX、sync或卸载时做检查点：把出现过的文件整体写回并刷盘，
+//    然后清空意图日志
+// 5. 挂载时重放完整的事务：文件的数据大小改为最后提交的大小，日志区域无效时丢弃，
+//    再追加尚未写入日志的记录（REVERT记录重新标记被撤销的记录）
+// 撤销历史只在内存中，重新挂载后本来就没有，不需要记录
+// 有序模式只保证已提交的记录描述的数据已落盘，反过来不保证：回写线程随时可能写回脏的数据页，
+// 而记录在写入者放开layout_rwsem之后才发布、下一轮刷新才提交，其间崩溃会留下没有记录的修改
+// （文件在意图日志中时，重放按提交的数据大小截掉扩展的部分）。先写日志要让回写等待layout_rwsem，
+// 而写入者持有它经过脏页限流，脏页超限时两边互相等待。需要修改和记录一起落盘时由fsync提交
+
+#define LOGGERFS_JOURNAL_MAX (1 << 20)  // 意图日志超过该大小时做检查点
+
+static inline struct loggerfs_file_info *LOGGERFS_I(struct inode *inode)
+{
+	return container_of(inode, struct loggerfs_file_info, vfs_inode);
+}
+
+// 确保事务缓冲区还能放下len字节。调用者持有journal_lock
+static bool journal_reserve(struct loggerfs_sb_info *sbi, size_t len)
+{
+	size_t cap;
+	char *buf;
+
+	if (sbi->journal_len + len <= sbi->journal_cap)
+		return true;
+
+	cap = max_t(size_t, PAGE_SIZE, roundup_pow_of_two(sbi->journal_len + len));
+	buf = kvmalloc(cap, GFP_NOFS);
+	if (!buf)
+		return false;
+
+	if (sbi->journal_buf)
+		memcpy(buf, sbi->journal_buf, sbi->journal_len);
+	kvfree(sbi->journal_buf);
+	sbi->journal_buf = buf;
+	sbi->journal_cap = cap;
+	return true;
+}
+
+static void journal_put(struct loggerfs_sb_info *sbi, const void *data,
+			size_t len)
+{
+	memcpy(sbi->journal_buf + sbi->journal_len, data, len);
+	sbi->journal_len += len;
+}
+
+// 开始为file_info写一个块，成功时持有journal_lock直到loggerfs_journal_end。
+// 内存模式或没有打开意图日志时返回false。调用者持有layout_rwsem写锁
+bool loggerfs_journal_begin(struct loggerfs_file_info *file_info,
+			    struct loggerfs_journal_handle *handle)
+{
+	struct inode *inode = &file_info->vfs_inode;
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+	struct loggerfs_journal_block block;
+	struct inode *lower = file_info->lower_inode;
+	char *buf, *path;
+	size_t len;
+
+	if (!sbi->journal_file || !lower)
+		return false;
+
+	handle->file_info = file_info;
+	handle->nr = 0;
+	handle->failed = false;
+
+	// 重放时按路径找回文件，路径相对lowerdir
+	buf = kmalloc(PATH_MAX, GFP_NOFS);
+	path = buf ? dentry_path_raw(file_info->lower_path.dentry, buf, PATH_MAX) :
+		     ERR_PTR(-ENOMEM);
+	if (IS_ERR(path) || strlen(path) <= sbi->journal_root_len) {
+		handle->failed = true;
+		path = "";
+	} else {
+		path += sbi->journal_root_len;
+		while (*path == '/')
+			path++;
+	}
+	len = min_t(size_t, strlen(path), U16_MAX);
+
+	memset(&block, 0, sizeof(block));
+	block.ino = cpu_to_le64(lower->i_ino);
+	block.generation = cpu_to_le32(lower->i_generation);
+	block.path_len = cpu_to_le16(len);
+
+	mutex_lock(&sbi->journal_lock);
+	handle->block = sbi->journal_len;
+	if (!handle->failed && journal_reserve(sbi, sizeof(block) + len)) {
+		journal_put(sbi, &block, sizeof(block));
+		journal_put(sbi, path, len);
+	} else {
+		handle->failed = true;
+	}
+	kfree(buf);
+	return true;
+}
+
+// 把一条已编码的记录和它的命令路径写入当前块
+void loggerfs_journal_record(struct loggerfs_journal_handle *handle,
+			     const struct loggerfs_log_record *rec,
+			     const char *cmd)
+{
+	struct loggerfs_sb_info *sbi =
+		LOGGERFS_SB(handle->file_info->vfs_inode.i_sb);
+	u8 len = cmd ? min_t(size_t, strlen(cmd), LOGGERFS_CMD_SLOT_SIZE - 1) : 0;
+
+	if (handle->failed ||
+	    !journal_reserve(sbi, LOGGERFS_REC_SIZE + 1 + len)) {
+		handle->failed = true;
+		return;
+	}
+
+	journal_put(sbi, rec, LOGGERFS_REC_SIZE);
+	journal_put(sbi, &len, 1);
+	journal_put(sbi, cmd, len);
+	handle->nr++;
+}
+
+// 结束当前块，把inode加入正在积累的事务并安排日志线程提交
+void loggerfs_journal_end(struct loggerfs_journal_handle *handle)
+{
+	struct loggerfs_file_info *file_info = handle->file_info;
+	struct inode *inode = &file_info->vfs_inode;
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+	struct loggerfs_journal_block *block;
+
+	if (handle->failed) {
+		// 这批记录仍然写入日志，只是崩溃后无法保证与数据一致
+		sbi->journal_len = handle->block;
+		mutex_unlock(&sbi->journal_lock);
+		pr_warn_ratelimited("No memory to journal %u log records\n",
+				    handle->nr);
+		return;
+	}
+
+	block = (struct loggerfs_journal_block *)(sbi->journal_buf + handle->block);
+	block->data_size = cpu_to_le64(file_info->data_size);
+	block->nr_records = cpu_to_le32(handle->nr);
+
+	file_info->journal_tid = sbi->journal_tid;
+	file_info->journal_size = file_info->data_size;
+	if (list_empty(&file_info->journal_node)) {
+		ihold(inode);
+		list_add_tail(&file_info->journal_node, &sbi->journal_inodes);
+	}
+	mutex_unlock(&sbi->journal_lock);
+
+	// READLOG、REVERT等在日志线程之外刷新的记录也要有人提交，
+	// 日志线程自己在这一轮结束时提交
+	if (current_work() != &sbi->flush_work.work)
+		queue_delayed_work(loggerfs_log_wq, &sbi->flush_work,
+				   msecs_to_jiffies(sbi->flush_ms));
+}
+
+// 把一段内容追加到意图日志文件
+static int journal_write(struct loggerfs_sb_info *sbi, const void *data,
+			 size_t len)
+{
+	loff_t pos = sbi->journal_size;
+	ssize_t ret;
+
+	ret = kernel_write(sbi->journal_file, data, len, &pos);
+	if (ret < 0)
+		return ret;
+	if (ret != len)
+		return -EIO;
+	sbi->journal_size = pos;
+	return 0;
+}
+
+// 检查点：把上次检查点之后出现过的文件整体写回并刷盘，然后清空意图日志。
+// 正在积累的事务还没有写入意图日志，其中的inode留在列表上。调用者持有提交锁
+static int journal_checkpoint(struct loggerfs_sb_info *sbi)
+{
+	struct loggerfs_file_info *file_info, *tmp;
+	const struct cred *old_cred;
+	LIST_HEAD(inodes);
+	LIST_HEAD(done);
+	int ret = 0, err;
+
+	mutex_lock(&sbi->journal_lock);
+	list_splice_init(&sbi->journal_inodes, &inodes);
+	mutex_unlock(&sbi->journal_lock);
+
+	list_for_each_entry(file_info, &inodes, journal_node) {
+		err = loggerfs_lower_fsync(file_info, LLONG_MAX, 0);
+		if (err && !ret)
+			ret = err;
+	}
+
+	// 刷盘期间又加入正在积累的事务的inode放回列表
+	mutex_lock(&sbi->journal_lock);
+	list_for_each_entry_safe(file_info, tmp, &inodes, journal_node) {
+		if (file_info->journal_tid > sbi->journal_committed)
+			list_move_tail(&file_info->journal_node, &sbi->journal_inodes);
+		else
+			list_move_tail(&file_info->journal_node, &done);
+	}
+	mutex_unlock(&sbi->journal_lock);
+
+	list_for_each_entry_safe(file_info, tmp, &done, journal_node) {
+		list_del_init(&file_info->journal_node);
+		iput(&file_info->vfs_inode);
+	}
+
+	// 有文件没能刷盘时保留意图日志，重新挂载时重放
+	if (ret) {
+		pr_err("Journal checkpoint failed: %d\n", ret);
+		return ret;
+	}
+
+	old_cred = override_creds(sbi->lower_cred);
+	ret = vfs_truncate(&sbi->journal_file->f_path, 0);
+	revert_creds(old_cred);
+	if (ret == 0)
+		ret = vfs_fsync(sbi->journal_file, 1);
+	if (ret == 0) {
+		sbi->journal_size = 0;
+		sbi->journal_checkpoints++;
+	}
+	return ret;
+}
+
+// 提交正在积累的事务：先写回并刷盘各文件的数据部分，再写入事务并刷盘意图日志（有序模式）。
+// 同一轮中所有写入者的记录只需一次意图日志刷盘。失败的事务同样结束，错误记在journal_err上。
+// 调用者持有提交锁
+static int journal_commit_locked(struct loggerfs_sb_info *sbi)
+{
+	struct loggerfs_journal_header header;
+	struct loggerfs_file_info *file_info, *tmp;
+	unsigned long files = 0;
+	LIST_HEAD(inodes);
+	char *buf = NULL;
+	size_t len;
+	u64 tid;
+	u32 crc;
+	int ret = 0, err;
+
+	// 取下正在积累的事务，之后的记录和fsync进入下一个事务
+	mutex_lock(&sbi->journal_lock);
+	len = sbi->journal_len;
+	tid = sbi->journal_tid;
+	list_for_each_entry(file_info, &sbi->journal_inodes, journal_node) {
+		if (file_info->journal_tid == tid) {
+			list_add_tail(&file_info->journal_commit, &inodes);
+			files++;
+		}
+	}
+	if (files) {
+		buf = sbi->journal_buf;
+		sbi->journal_buf = NULL;
+		sbi->journal_len = 0;
+		sbi->journal_cap = 0;
+		sbi->journal_tid++;
+	}
+	mutex_unlock(&sbi->journal_lock);
+
+	if (!files)
+		return 0;
+
+	// 有序模式：记录描述的数据先落盘，日志区域和尾部留给回写线程
+	list_for_each_entry_safe(file_info, tmp, &inodes, journal_commit) {
+		list_del_init(&file_info->journal_commit);
+		if (READ_ONCE(file_info->journal_size) == 0)
+			continue;
+		err = loggerfs_lower_fsync(file_info,
+					   READ_ONCE(file_info->journal_size) - 1, 1);
+		if (err && !ret)
+			ret = err;
+	}
+	if (ret) {
+		pr_err("Failed to write back data for journal transaction %llu: %d\n",
+		       tid, ret);
+		goto out;
+	}
+
+	// 只有fsync加入、没有新记录的事务不需要写意图日志
+	if (len) {
+		header.magic = cpu_to_le32(LOGGERFS_JOURNAL_MAGIC);
+		header.len = cpu_to_le32(len);
+		header.tid = cpu_to_le64(tid);
+		crc = crc32_le(~0, (const u8 *)&header,
+			       offsetof(struct loggerfs_journal_header, crc));
+		header.crc = cpu_to_le32(crc32_le(crc, buf, len));
+
+		ret = journal_write(sbi, &header, sizeof(header));
+		if (ret == 0)
+			ret = journal_write(sbi, buf, len);
+		if (ret == 0)
+			ret = vfs_fsync(sbi->journal_file, 1);
+		if (ret) {
+			pr_err("Failed to commit journal transaction %llu: %d\n",
+			       tid, ret);
+			goto out;
+		}
+	}
+
+	sbi->journal_commits++;
+	sbi->journal_files += files;
+	WRITE_ONCE(sbi->journal_committed, tid);
+
+	if (sbi->journal_size > LOGGERFS_JOURNAL_MAX)
+		journal_checkpoint(sbi);
+	kvfree(buf);
+	return 0;
+
+out:
+	errseq_set(&sbi->journal_err, ret);
+	WRITE_ONCE(sbi->journal_committed, tid);
+	kvfree(buf);
+	return ret;
+}
+
+int loggerfs_journal_commit(struct loggerfs_sb_info *sbi)
+{
+	int ret;
+
+	if (!sbi->journal_file)
+		return 0;
+
+	mutex_lock(&sbi->journal_commit_lock);
+	ret = journal_commit_locked(sbi);
+	mutex_unlock(&sbi->journal_commit_lock);
+	return ret;
+}
+
+// fsync：把inode加入正在积累的事务并等待它提交。同时到达的fsync加入同一个事务，
+// 拿到提交锁的那个替所有人提交，其余的在等锁期间发现自己的事务已经提交就直接返回，
+// 一次提交只刷一次意图日志，每个文件的数据也只写回一次。调用者已把排队的记录写入日志
+int loggerfs_journal_fsync(struct loggerfs_file_info *file_info)
+{
+	struct inode *inode = &file_info->vfs_inode;
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+	errseq_t since;
+	u64 tid;
+
+	since = errseq_sample(&sbi->journal_err);
+
+	// mmap写入没有日志记录，数据部分同样由提交写回
+	mutex_lock(&sbi->journal_lock);
+	tid = sbi->journal_tid;
+	file_info->journal_tid = tid;
+	file_info->journal_size = READ_ONCE(file_info->data_size);
+	if (list_empty(&file_info->journal_node)) {
+		ihold(inode);
+		list_add_tail(&file_info->journal_node, &sbi->journal_inodes);
+	}
+	sbi->journal_fsyncs++;
+	mutex_unlock(&sbi->journal_lock);
+
+	mutex_lock(&sbi->journal_commit_lock);
+	if (sbi->journal_committed < tid)
+		journal_commit_locked(sbi);
+	mutex_unlock(&sbi->journal_commit_lock);
+
+	return errseq_check(&sbi->journal_err, since);
+}
+
+// sync和卸载：提交正在积累的事务并做检查点
+int loggerfs_journal_sync(struct loggerfs_sb_info *sbi)
+{
+	int ret;
+
+	if (!sbi->journal_file)
+		return 0;
+
+	mutex_lock(&sbi->journal_commit_lock);
+	ret = journal_commit_locked(sbi);
+	if (ret == 0)
+		ret = journal_checkpoint(sbi);
+	mutex_unlock(&sbi->journal_commit_lock);
+	return ret;
+}
+
+// 根目录下的意图日志文件对loggerfs不可见
+bool loggerfs_journal_hidden(struct dentry *dentry)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(dentry->d_sb);
+
+	return sbi->journal_file && dentry->d_parent == dentry->d_sb->s_root &&
+	       dentry->d_name.len == sizeof(LOGGERFS_JOURNAL_NAME) - 1 &&
+	       !memcmp(dentry->d_name.name, LOGGERFS_JOURNAL_NAME,
+		       dentry->d_name.len);
+}
+
+/* 重放：每个文件在意图日志中最后的数据大小和记录序号 */
+struct journal_replay {
+	struct list_head list;
+	u64 ino;
+	u32 generation;
+	loff_t data_size;
+	u64 last_seq;
+	char *path;
+};
+
+// 依次访问意图日志中完整事务的每个块，返回有效内容的长度
+typedef void (*journal_block_fn)(const struct loggerfs_journal_block *block,
+				 const char *path, const char *recs,
+				 const char *end, void *data);
+
+static size_t journal_walk(const char *buf, size_t size, journal_block_fn fn,
+			   void *data)
+{
+	const struct loggerfs_journal_header *header;
+	const struct loggerfs_journal_block *block;
+	const char *p, *end, *recs;
+	size_t pos = 0, len;
+	unsigned int i;
+	u32 crc;
+	u8 cmd_len;
+
+	while (size - pos >= sizeof(*header)) {
+		header = (const void *)(buf + pos);
+		len = le32_to_cpu(header->len);
+		if (le32_to_cpu(header->magic) != LOGGERFS_JOURNAL_MAGIC ||
+		    len > size - pos - sizeof(*header))
+			break;
+
+		p = buf + pos + sizeof(*header);
+		crc = crc32_le(~0, (const u8 *)header,
+			       offsetof(struct loggerfs_journal_header, crc));
+		if (crc32_le(crc, p, len) != le32_to_cpu(header->crc))
+			break;
+
+		// 事务完整，块的格式由loggerfs_journal_begin/record/end保证
+		for (end = p + len; p + sizeof(*block) <= end;) {
+			block = (const void *)p;
+			recs = p + sizeof(*block) + le16_to_cpu(block->path_len);
+			for (p = recs, i = 0;
+			     i < le32_to_cpu(block->nr_records) &&
+			     p + LOGGERFS_REC_SIZE + 1 <= end; i++) {
+				cmd_len = p[LOGGERFS_REC_SIZE];
+				p += LOGGERFS_REC_SIZE + 1 + cmd_len;
+			}
+			if (p > end)
+				break;
+			fn(block, (const char *)(block + 1), recs, p, data);
+		}
+		pos += sizeof(*header) + len;
+	}
+	return pos;
+}
+
+// 第一遍：汇总每个文件最后的数据大小和记录序号
+static void journal_collect(const struct loggerfs_journal_block *block,
+			    const char *path, const char *recs,
+			    const char *end, void *data)
+{
+	const struct loggerfs_log_record *rec;
+	struct list_head *replays = data;
+	struct journal_replay *r;
+	u64 ino = le64_to_cpu(block->ino);
+	const char *p;
+	u8 cmd_len;
+
+	list_for_each_entry(r, replays, list)
+		if (r->ino == ino)
+			goto found;
+
+	r = kzalloc(sizeof(*r), GFP_KERNEL);
+	if (!r)
+		return;
+	r->path = kstrndup(path, le16_to_cpu(block->path_len), GFP_KERNEL);
+	if (!r->path) {
+		kfree(r);
+		return;
+	}
+	r->ino = ino;
+	r->generation = le32_to_cpu(block->generation);
+	list_add_tail(&r->list, replays);
+
+found:
+	r->data_size = le64_to_cpu(block->data_size);
+	for (p = recs; p < end; p += LOGGERFS_REC_SIZE + 1 + cmd_len) {
+		rec = (const void *)p;
+		cmd_len = p[LOGGERFS_REC_SIZE];
+		r->last_seq = le64_to_cpu(rec->seq);
+	}
+}
+
+struct journal_apply {
+	struct loggerfs_file_info *file_info;
+	unsigned long dirty_slots;
+	unsigned int nr;
+};
+
+// 第二遍：把一个文件尚未写入日志的记录追加到日志缓冲区
+static void journal_apply_block(const struct loggerfs_journal_block *block,
+				const char *path, const char *recs,
+				const char *end, void *data)
+{
+	struct journal_apply *apply = data;
+	struct loggerfs_file_info *file_info = apply->file_info;
+	struct loggerfs_log_record rec;
+	char cmd[LOGGERFS_CMD_SLOT_SIZE];
+	const char *p;
+	u8 cmd_len;
+	u64 seq;
+
+	if (le64_to_cpu(block->ino) != file_info->lower_inode->i_ino)
+		return;
+
+	for (p = recs; p < end; p += LOGGERFS_REC_SIZE + 1 + cmd_len) {
+		memcpy(&rec, p, LOGGERFS_REC_SIZE);
+		cmd_len = p[LOGGERFS_REC_SIZE];
+		seq = le64_to_cpu(rec.seq);
+		if (seq < file_info->log_next_seq)
+			continue;
+
+		// revert记录不带被撤销记录的序号，恢复时不再给旧记录打标记（按偏移猜测可能标错记录）
+		memcpy(cmd, p + LOGGERFS_REC_SIZE + 1, cmd_len);
+		cmd[cmd_len] = '\0';
+		rec.cmd = cmd_len ?
+			loggerfs_log_cmd_slot(file_info, cmd, &apply->dirty_slots) :
+			LOGGERFS_CMD_NONE;
+		loggerfs_log_append(file_info, &rec);
+		file_info->log_next_seq = seq + 1;
+		apply->nr++;
+	}
+}
+
+// 把一个文件恢复到意图日志中最后提交的状态，写回并刷盘
+static void journal_replay_file(struct super_block *sb, const char *buf,
+				size_t size, struct journal_replay *r)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(sb);
+	struct journal_apply apply = { };
+	struct loggerfs_file_info *file_info;
+	const struct cred *old_cred;
+	struct inode *inode;
+	struct path path;
+	int ret;
+
+	old_cred = override_creds(sbi->lower_cred);
+	ret = vfs_path_lookup(sbi->lower_root.dentry, sbi->lower_root.mnt,
+			      r->path, 0, &path);
+	revert_creds(old_cred);
+	if (ret) {
+		pr_warn("Journaled file %s is gone, skipping it\n", r->path);
+		return;
+	}
+
+	// 文件在提交之后被替换过
+	if (!d_is_reg(path.dentry) || d_inode(path.dentry)->i_ino != r->ino ||
+	    d_inode(path.dentry)->i_generation != r->generation) {
+		pr_warn("Journaled file %s was replaced, skipping it\n", r->path);
+		goto out;
+	}
+
+	inode = loggerfs_lower_iget(sb, path.dentry);
+	if (IS_ERR(inode))
+		goto out;
+	file_info = LOGGERFS_I(inode);
+
+	down_write(&file_info->layout_rwsem);
+	if (file_info->data_size != r->data_size ||
+	    file_info->log_next_seq <= r->last_seq) {
+		loggerfs_replay_layout(file_info, r->data_size);
+		apply.file_info = file_info;
+		journal_walk(buf, size, journal_apply_block, &apply);
+		loggerfs_detach_log(file_info);
+		loggerfs_attach_log(file_info);
+		pr_info("Replayed %u journaled log records into %s, data size %lld\n",
+			apply.nr, r->path, r->data_size);
+	}
+	up_write(&file_info->layout_rwsem);
+
+	ret = loggerfs_lower_fsync(file_info, LLONG_MAX, 0);
+	if (ret)
+		pr_err("Failed to write back replayed file %s: %d\n", r->path, ret);
+	iput(inode);
+out:
+	path_put(&path);
+}
+
+// 重放意图日志中完整的事务，然后清空意图日志
+static int journal_replay(struct super_block *sb, struct file *file)
+{
+	struct journal_replay *r, *tmp;
+	const struct cred *old_cred;
+	LIST_HEAD(replays);
+	loff_t size, pos = 0;
+	size_t valid;
+	ssize_t ret;
+	char *buf;
+
+	size = i_size_read(file_inode(file));
+	if (!size)
+		return 0;
+
+	buf = kvmalloc(size, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	ret = kernel_read(file, buf, size, &pos);
+	if (ret != size) {
+		kvfree(buf);
+		return ret < 0 ? ret : -EIO;
+	}
+
+	valid = journal_walk(buf, size, journal_collect, &replays);
+	list_for_each_entry_safe(r, tmp, &replays, list) {
+		journal_replay_file(sb, buf, valid, r);
+		list_del(&r->list);
+		kfree(r->path);
+		kfree(r);
+	}
+	if (valid < size)
+		pr_warn("Discarded %lld bytes of incomplete journal transactions\n",
+			size - valid);
+	kvfree(buf);
+
+	old_cred = override_creds(LOGGERFS_SB(sb)->lower_cred);
+	ret = vfs_truncate(&file->f_path, 0);
+	revert_creds(old_cred);
+	return ret ? ret : vfs_fsync(file, 1);
+}
+
+static int loggerfs_journal_show(struct seq_file *m, void *v)
+{
+	struct loggerfs_sb_info *sbi = m->private;
+
+	mutex_lock(&sbi->journal_commit_lock);
+	seq_printf(m, "committed_tid: %llu\n", sbi->journal_committed);
+	seq_printf(m, "commits: %lu\n", sbi->journal_commits);
+	seq_printf(m, "files: %lu\n", sbi->journal_files);
+	seq_printf(m, "fsyncs: %lu\n", sbi->journal_fsyncs);
+	seq_printf(m, "checkpoints: %lu\n", sbi->journal_checkpoints);
+	seq_printf(m, "journal_size: %lld\n", sbi->journal_size);
+	mutex_unlock(&sbi->journal_commit_lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(loggerfs_journal);
+
+// 堆叠挂载时打开（或创建）意图日志并重放上次没有完成检查点的事务
+int loggerfs_journal_init(struct super_block *sb)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(sb);
+	const struct cred *old_cred;
+	struct file *file;
+	char *buf, *root;
+	int ret;
+
+	buf = kmalloc(PATH_MAX, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	root = dentry_path_raw(sbi->lower_root.dentry, buf, PATH_MAX);
+	sbi->journal_root_len = IS_ERR(root) ? 0 : strlen(root);
+	kfree(buf);
+	if (IS_ERR(root))
+		return PTR_ERR(root);
+
+	old_cred = override_creds(sbi->lower_cred);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 12, 0)
+	file = file_open_root(&sbi->lower_root, LOGGERFS_JOURNAL_NAME,
+			      O_RDWR | O_CREAT | O_LARGEFILE, 0600);
+#else
+	file = file_open_root(sbi->lower_root.dentry, sbi->lower_root.mnt,
+			      LOGGERFS_JOURNAL_NAME,
+			      O_RDWR | O_CREAT | O_LARGEFILE, 0600);
+#endif
+	revert_creds(old_cred);
+	if (IS_ERR(file)) {
+		pr_err("Failed to open journal in %s: %ld\n", sbi->lowerdir,
+		       PTR_ERR(file));
+		return PTR_ERR(file);
+	}
+
+	// 重放时还没有打开意图日志，恢复写入的记录不会再次进入意图日志
+	ret = journal_replay(sb, file);
+	if (ret) {
+		pr_err("Failed to replay journal: %d\n", ret);
+		fput(file);
+		return ret;
+	}
+
+	sbi->journal_file = file;
+	sbi->journal_tid = 1;
+	debugfs_create_file("journal", 0444, sbi->debugfs_dir, sbi,
+			    &loggerfs_journal_fops);
+	return 0;
+}
+
+// 卸载时在释放inode之前调用：提交并做检查点，正常卸载后意图日志为空
+void loggerfs_journal_exit(struct super_block *sb)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(sb);
+	struct loggerfs_file_info *file_info, *tmp;
+
+	if (!sbi->journal_file)
+		return;
+
+	if (loggerfs_journal_sync(sbi))
+		pr_warn("Journal not empty at unmount, it will be replayed\n");
+
+	// 检查点失败时inode仍在列表上
+	list_for_each_entry_safe(file_info, tmp, &sbi->journal_inodes, journal_node) {
+		list_del_init(&file_info->journal_node);
+		iput(&file_info->vfs_inode);
+	}
+
+	fput(sbi->journal_file);
+	sbi->journal_file = NULL;
+	kvfree(sbi->journal_buf);
+	sbi->journal_buf = NULL;
+}
@@ -0,0 +1,505 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+#include <linux/math64.h>
+#include "../include/loggerfs.h"
+#include "../include/loggerfs_trace.h"
+
+// 分段环形日志：
+// 1. 日志区域的内存副本由若干LOGGERFS_LOG_SEG_SIZE大小的段组成，按区域偏移直接定位段，
+//    容量再大也不需要连续内存
+// 2. 段在日志增长时按需分配，短日志只占一段；按需分配失败时把容量限制在已分配的段上，
+//    日志路径不会因此失败
+// 3. 记录定长，段大小是记录大小的整数倍，记录不会跨段；追加、淘汰都是O(1)
+// 4. 命令路径存放在去重的命令表中，记录只保存槽位；文本只在READLOG时生成
+// 5. 逻辑位置相对最旧的记录（log_head），区域偏移相对记录区域开头
+// 除READLOG只需读锁外，调用者都持有layout_rwsem写锁
+
+static const char * const loggerfs_op_names[] = {
+	[LOGGERFS_OP_READ] = "read",
+	[LOGGERFS_OP_WRITE] = "write",
+	[LOGGERFS_OP_TRUNCATE] = "truncate",
+	[LOGGERFS_OP_REVERT] = "revert",
+	[LOGGERFS_OP_ALLOCATE] = "allocate",
+	[LOGGERFS_OP_PUNCH] = "punch",
+	[LOGGERFS_OP_ZERO] = "zero",
+};
+
+const char *loggerfs_log_op_name(unsigned int op)
+{
+	if (op < ARRAY_SIZE(loggerfs_op_names) && loggerfs_op_names[op])
+		return loggerfs_op_names[op];
+	return "unknown";
+}
+
+int loggerfs_log_op_code(const char *name)
+{
+	unsigned int op;
+
+	for (op = 0; op < ARRAY_SIZE(loggerfs_op_names); op++)
+		if (loggerfs_op_names[op] && !strcmp(loggerfs_op_names[op], name))
+			return op;
+	return -EINVAL;
+}
+
+static inline char *log_seg_ptr(struct loggerfs_file_info *file_info, size_t off)
+{
+	return file_info->log_segs[off / LOGGERFS_LOG_SEG_SIZE] +
+	       off % LOGGERFS_LOG_SEG_SIZE;
+}
+
+// 区域偏移off处的内存，*len为同一段内从off起、不超过max的连续字节数
+char *loggerfs_log_seg(struct loggerfs_file_info *file_info, size_t off,
+		       size_t max, size_t *len)
+{
+	*len = min_t(size_t, max,
+		     LOGGERFS_LOG_SEG_SIZE - off % LOGGERFS_LOG_SEG_SIZE);
+	return log_seg_ptr(file_info, off);
+}
+
+// 从旧到新第idx条记录
+struct loggerfs_log_record *loggerfs_log_rec_at(struct loggerfs_file_info *file_info,
+						unsigned int idx)
+{
+	size_t off = (file_info->log_head + (size_t)idx * LOGGERFS_REC_SIZE) %
+		     file_info->log_cap;
+
+	return (struct loggerfs_log_record *)log_seg_ptr(file_info, off);
+}
+
+// 日志缓冲区（段和命令表）占用的内存计入超级块统计（见loggerfs_mem.c）
+static inline void log_account(struct loggerfs_file_info *file_info, long nr)
+{
+	atomic_long_add(nr * LOGGERFS_LOG_SEG_SIZE,
+			&LOGGERFS_SB(file_info->vfs_inode.i_sb)->log_bytes);
+}
+
+static void log_free_segs(char **segs, unsigned int nr_alloc, char **inline_seg)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_alloc; i++)
+		kmem_cache_free(loggerfs_log_buf_cachep, segs[i]);
+	if (segs != inline_seg)
+		kfree(segs);
+}
+
+// 确保区域[0, len)所在的段都已分配
+int loggerfs_log_reserve(struct loggerfs_file_info *file_info, size_t len,
+			 gfp_t gfp)
+{
+	while ((size_t)file_info->log_nr_alloc * LOGGERFS_LOG_SEG_SIZE < len) {
+		char *seg = kmem_cache_alloc(loggerfs_log_buf_cachep, gfp);
+
+		if (!seg)
+			return -ENOMEM;
+		file_info->log_segs[file_info->log_nr_alloc++] = seg;
+		log_account(file_info, 1);
+	}
+	return 0;
+}
+
+static inline void log_evict_oldest(struct loggerfs_file_info *file_info)
+{
+	// 跟踪点关闭时不定位记录
+	if (trace_loggerfs_log_evict_enabled())
+		trace_loggerfs_log_evict(file_info,
+					 loggerfs_log_rec_at(file_info, 0));
+	file_info->log_head = (file_info->log_head + LOGGERFS_REC_SIZE) %
+			      file_info->log_cap;
+	file_info->log_used -= LOGGERFS_REC_SIZE;
+	if (!file_info->log_used)
+		file_info->log_head = 0;
+}
+
+// 淘汰最旧的记录，直到容量和记录数都在限制内；need为真时再为一条新记录留出位置
+static void log_evict(struct loggerfs_file_info *file_info, size_t cap,
+		      unsigned int max_entries, bool need)
+{
+	size_t room = need ? LOGGERFS_REC_SIZE : 0;
+
+	while (file_info->log_used &&
+	       (file_info->log_used + room > cap ||
+		(max_entries &&
+		 file_info->log_used / LOGGERFS_REC_SIZE + need > max_entries)))
+		log_evict_oldest(file_info);
+}
+
+// 查找或分配命令路径的槽位，新写入的槽位在*dirty_slots中置位。
+// 槽位记录最后一次被引用的记录序号；表满时重用最久未用的槽位，
+// 该槽位仍被日志中的旧记录引用时，把这些记录的命令改为未知（记录本身保留），
+// 并置位LOGGERFS_CMD_DIRTY_RECORDS，由调用者重写整个记录区域
+u8 loggerfs_log_cmd_slot(struct loggerfs_file_info *file_info,
+			 const char *path, unsigned long *dirty_slots)
+{
+	struct loggerfs_log_record *rec;
+	unsigned int nr, idx;
+	char *slot;
+	int i, victim = -1, empty = -1;
+
+	for (i = 0; i < LOGGERFS_CMD_SLOTS; i++) {
+		slot = file_info->log_cmd_table + i * LOGGERFS_CMD_SLOT_SIZE;
+		if (!slot[0]) {
+			if (empty < 0)
+				empty = i;
+		} else if (!strncmp(slot, path, LOGGERFS_CMD_SLOT_SIZE - 1)) {
+			file_info->log_cmd_seq[i] = file_info->log_next_seq;
+			return i;
+		} else if (victim < 0 ||
+			   file_info->log_cmd_seq[i] < file_info->log_cmd_seq[victim]) {
+			victim = i;
+		}
+	}
+
+	if (empty >= 0) {
+		victim = empty;
+		slot = file_info->log_cmd_table + victim * LOGGERFS_CMD_SLOT_SIZE;
+	} else {
+		slot = file_info->log_cmd_table + victim * LOGGERFS_CMD_SLOT_SIZE;
+		nr = file_info->log_used / LOGGERFS_REC_SIZE;
+		for (idx = 0; idx < nr; idx++) {
+			rec = loggerfs_log_rec_at(file_info, idx);
+			if (le64_to_cpu(rec->seq) > file_info->log_cmd_seq[victim])
+				break;
+			if (rec->cmd == victim) {
+				rec->cmd = LOGGERFS_CMD_NONE;
+				__set_bit(LOGGERFS_CMD_DIRTY_RECORDS, dirty_slots);
+			}
+		}
+	}
+
+	strncpy(slot, path, LOGGERFS_CMD_SLOT_SIZE - 1);
+	slot[LOGGERFS_CMD_SLOT_SIZE - 1] = '\0';
+	file_info->log_cmd_seq[victim] = file_info->log_next_seq;
+	__set_bit(victim, dirty_slots);
+	return victim;
+}
+
+// 在环形日志末尾追加一条记录，返回记录写入的区域偏移
+size_t loggerfs_log_append(struct loggerfs_file_info *file_info,
+			   const struct loggerfs_log_record *rec)
+{
+	size_t tail;
+
+	log_evict(file_info, file_info->log_cap, file_info->log_max_entries, true);
+	tail = (file_info->log_head + file_info->log_used) % file_info->log_cap;
+
+	// 日志仍在增长、新记录落到尚未分配的段上时按需分配
+	if (loggerfs_log_reserve(file_info, tail + LOGGERFS_REC_SIZE, GFP_NOFS)) {
+		pr_warn_ratelimited("No memory to grow log, capping it at %u segments\n",
+				    file_info->log_nr_alloc);
+		file_info->log_cap = (size_t)file_info->log_nr_alloc *
+				     LOGGERFS_LOG_SEG_SIZE;
+		log_evict(file_info, file_info->log_cap,
+			  file_info->log_max_entries, true);
+		tail = (file_info->log_head + file_info->log_used) %
+		       file_info->log_cap;
+	}
+
+	memcpy(log_seg_ptr(file_info, tail), rec, LOGGERFS_REC_SIZE);
+	file_info->log_used += LOGGERFS_REC_SIZE;
+
+	// 区域只在回绕前增长，回绕后固定为整个容量
+	if (tail + LOGGERFS_REC_SIZE > file_info->log_size)
+		file_info->log_size = tail + LOGGERFS_REC_SIZE;
+
+	return tail;
+}
+
+// 标记REVERT撤销的那次修改的记录：记录序号seq由撤销层在记录写入日志时得到。
+// 合并的写记录可能还包含之后被撤销的写入，此时只把长度截到offset。
+// 返回记录的区域偏移和被撤销的长度，记录已被淘汰、丢弃或已经撤销时返回-ENOENT
+int loggerfs_log_revert(struct loggerfs_file_info *file_info, u64 seq,
+			loff_t offset, size_t *rec_off, u32 *length)
+{
+	struct loggerfs_log_record *rec;
+	unsigned int i;
+	loff_t start;
+	u64 rec_seq;
+	u32 len;
+
+	if (seq == U64_MAX)
+		return -ENOENT;
+
+	// 序号随追加递增，从最新的记录往回找
+	for (i = file_info->log_used / LOGGERFS_REC_SIZE; i > 0; i--) {
+		rec = loggerfs_log_rec_at(file_info, i - 1);
+		rec_seq = le64_to_cpu(rec->seq);
+		if (rec_seq > seq)
+			continue;
+		if (rec_seq < seq || (rec->flags & LOGGERFS_REC_REVERTED))
+			break;
+
+		start = le64_to_cpu(rec->offset);
+		len = le32_to_cpu(rec->length);
+		if (start < offset) {
+			if (offset >= start + len)
+				break;
+			rec->length = cpu_to_le32(offset - start);
+			*length = len - (offset - start);
+		} else {
+			rec->flags |= LOGGERFS_REC_REVERTED;
+			*length = len;
+		}
+		*rec_off = (file_info->log_head + (size_t)(i - 1) * LOGGERFS_REC_SIZE) %
+			   file_info->log_cap;
+		return 0;
+	}
+	return -ENOENT;
+}
+
+// 把一条记录格式化为文档中的文本格式：时间 命令全路径 访问类型 起始位置 数据长度
+int loggerfs_log_render(struct loggerfs_file_info *file_info,
+			const struct loggerfs_log_record *rec, char *buf,
+			size_t size)
+{
+	const char *path = "[unknown]";
+
+	if (rec->cmd < LOGGERFS_CMD_SLOTS &&
+	    file_info->log_cmd_table[rec->cmd * LOGGERFS_CMD_SLOT_SIZE])
+		path = file_info->log_cmd_table + rec->cmd * LOGGERFS_CMD_SLOT_SIZE;
+
+	return snprintf(buf, size, "%llu %s %s %lld %u\n",
+			div_u64(le64_to_cpu(rec->time), NSEC_PER_SEC), path,
+			loggerfs_log_op_name(le16_to_cpu(rec->op)),
+			(long long)le64_to_cpu(rec->offset),
+			le32_to_cpu(rec->length));
+}
+
+// 以文本格式把日志复制给用户，最多size字节：从最新的记录往前取能放下的记录，
+// 再按从旧到新的顺序输出。返回复制的字节数
+long loggerfs_log_render_to_user(struct loggerfs_file_info *file_info,
+				 char __user *buf, size_t size)
+{
+	unsigned int nr = file_info->log_used / LOGGERFS_REC_SIZE;
+	unsigned int start = nr, i;
+	struct loggerfs_log_record *rec;
+	char line[LOGGERFS_CMD_SLOT_SIZE + 96];
+	size_t total = 0;
+	int len;
+
+	// 被撤销的记录不输出，二进制日志中仍然保留
+	while (start > 0) {
+		rec = loggerfs_log_rec_at(file_info, start - 1);
+		len = rec->flags & LOGGERFS_REC_REVERTED ? 0 :
+		      loggerfs_log_render(file_info, rec, line, sizeof(line));
+		if (total + len > size)
+			break;
+		total += len;
+		start--;
+	}
+
+	total = 0;
+	for (i = start; i < nr; i++) {
+		rec = loggerfs_log_rec_at(file_info, i);
+		if (rec->flags & LOGGERFS_REC_REVERTED)
+			continue;
+		len = loggerfs_log_render(file_info, rec, line, sizeof(line));
+		if (copy_to_user(buf + total, line, len))
+			return -EFAULT;
+		total += len;
+	}
+
+	return total;
+}
+
+// 二分查找序号不小于seq的第一条记录（日志中的记录按序号递增）
+static unsigned int log_find_seq(struct loggerfs_file_info *file_info, u64 seq)
+{
+	unsigned int lo = 0, hi = file_info->log_used / LOGGERFS_REC_SIZE, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (le64_to_cpu(loggerfs_log_rec_at(file_info, mid)->seq) < seq)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// 把一条记录转换为LOGGERFS_IOC_READLOG的二进制格式（含命令路径和对齐填充），返回长度
+static size_t log_fill_entry(struct loggerfs_file_info *file_info,
+			     const struct loggerfs_log_record *rec,
+			     struct loggerfs_readlog_entry *entry)
+{
+	const char *path = NULL;
+	size_t path_len = 0, len;
+
+	if (rec->cmd < LOGGERFS_CMD_SLOTS) {
+		path = file_info->log_cmd_table + rec->cmd * LOGGERFS_CMD_SLOT_SIZE;
+		path_len = strnlen(path, LOGGERFS_CMD_SLOT_SIZE - 1);
+	}
+	len = LOGGERFS_READLOG_ENTRY_SIZE(path_len);
+
+	memset(entry, 0, len);
+	entry->seq = le64_to_cpu(rec->seq);
+	entry->time = le64_to_cpu(rec->time);
+	entry->offset = le64_to_cpu(rec->offset);
+	entry->length = le32_to_cpu(rec->length);
+	entry->op = le16_to_cpu(rec->op);
+	entry->flags = rec->flags;
+	entry->path_len = path_len;
+	memcpy(entry + 1, path, path_len);
+	return len;
+}
+
+// 流式读取日志（LOGGERFS_IOC_READLOG）：从序号不小于arg->start_seq的记录开始按文本或二进制格式
+// 填入用户缓冲区，放不下下一条记录时停止，并回填arg中的返回字段。
+// 返回写入的字节数，一条记录都放不下时返回-EMSGSIZE。调用者持有layout_rwsem读锁
+long loggerfs_log_read_user(struct loggerfs_file_info *file_info,
+			    struct loggerfs_readlog *arg)
+{
+	unsigned int nr = file_info->log_used / LOGGERFS_REC_SIZE;
+	char __user *buf = u64_to_user_ptr(arg->buf);
+	struct loggerfs_log_record *rec;
+	union {
+		struct loggerfs_readlog_entry entry;
+		char text[LOGGERFS_CMD_SLOT_SIZE + 96];
+	} out;
+	size_t total = 0, len;
+	unsigned int i;
+
+	arg->nr_records = 0;
+	arg->first_seq = nr ? le64_to_cpu(loggerfs_log_rec_at(file_info, 0)->seq) :
+			 file_info->log_next_seq;
+
+	for (i = log_find_seq(file_info, arg->start_seq); i < nr; i++) {
+		rec = loggerfs_log_rec_at(file_info, i);
+		if (arg->flags & LOGGERFS_READLOG_BINARY)
+			len = log_fill_entry(file_info, rec, &out.entry);
+		else if ((rec->flags & LOGGERFS_REC_REVERTED) &&
+			 !(arg->flags & LOGGERFS_READLOG_ALL))
+			len = 0;
+		else
+			len = loggerfs_log_render(file_info, rec, out.text,
+						  sizeof(out.text));
+
+		if (total + len > arg->len) {
+			if (!total)
+				return -EMSGSIZE;
+			break;
+		}
+		if (!len)
+			continue;
+		if (copy_to_user(buf + total, &out, len))
+			return -EFAULT;
+		total += len;
+		arg->nr_records++;
+	}
+
+	arg->next_seq = i < nr ? le64_to_cpu(loggerfs_log_rec_at(file_info, i)->seq) :
+			file_info->log_next_seq;
+	return total;
+}
+
+// 加载已有日志后重建下一个记录序号和各槽位最后被引用的序号
+void loggerfs_log_reload(struct loggerfs_file_info *file_info)
+{
+	unsigned int nr = file_info->log_used / LOGGERFS_REC_SIZE;
+	struct loggerfs_log_record *rec;
+	unsigned int i;
+	u64 seq = 0;
+
+	// 文件中的命令表可能损坏，保证每个槽位都以NUL结尾
+	for (i = 0; i < LOGGERFS_CMD_SLOTS; i++)
+		file_info->log_cmd_table[(i + 1) * LOGGERFS_CMD_SLOT_SIZE - 1] = '\0';
+
+	memset(file_info->log_cmd_seq, 0, sizeof(file_info->log_cmd_seq));
+	for (i = 0; i < nr; i++) {
+		rec = loggerfs_log_rec_at(file_info, i);
+		seq = le64_to_cpu(rec->seq);
+		if (rec->cmd < LOGGERFS_CMD_SLOTS)
+			file_info->log_cmd_seq[rec->cmd] = seq;
+	}
+	file_info->log_next_seq = seq + 1;
+}
+
+// 修改日志容量和记录数上限：先按新限制淘汰最旧的记录，剩下的记录线性化到新的段中
+// （头位置归零）。内存不足时返回-ENOMEM且日志保持不变。调用者负责重写文件中的日志区域
+int loggerfs_log_resize(struct loggerfs_file_info *file_info, size_t cap,
+			unsigned int max_entries)
+{
+	unsigned int nr_segs, nr_alloc, i;
+	char *single = NULL;
+	char **segs;
+	size_t done, n;
+
+	// 容量取记录大小的整数倍，记录不会跨过区域末尾
+	cap = rounddown(cap, LOGGERFS_REC_SIZE);
+	nr_segs = DIV_ROUND_UP(cap, LOGGERFS_LOG_SEG_SIZE);
+
+	if (!file_info->log_cmd_table) {
+		file_info->log_cmd_table = kmem_cache_zalloc(loggerfs_log_buf_cachep,
+							     GFP_KERNEL);
+		if (!file_info->log_cmd_table)
+			return -ENOMEM;
+		file_info->log_next_seq = 1;
+		log_account(file_info, 1);
+	}
+
+	nr_alloc = max_t(unsigned int, 1,
+			 DIV_ROUND_UP(min(file_info->log_used, cap),
+				      LOGGERFS_LOG_SEG_SIZE));
+	segs = nr_segs == 1 ? &single : kcalloc(nr_segs, sizeof(*segs), GFP_KERNEL);
+	if (!segs)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_alloc; i++) {
+		segs[i] = kmem_cache_alloc(loggerfs_log_buf_cachep, GFP_KERNEL);
+		if (!segs[i]) {
+			log_free_segs(segs, i, &single);
+			return -ENOMEM;
+		}
+	}
+
+	log_evict(file_info, cap, max_entries, false);
+
+	for (done = 0; done < file_info->log_used; done += n) {
+		n = min_t(size_t, file_info->log_used - done, LOGGERFS_LOG_SEG_SIZE);
+		for (i = 0; i < n / LOGGERFS_REC_SIZE; i++)
+			memcpy(segs[done / LOGGERFS_LOG_SEG_SIZE] +
+			       i * LOGGERFS_REC_SIZE,
+			       loggerfs_log_rec_at(file_info,
+						   done / LOGGERFS_REC_SIZE + i),
+			       LOGGERFS_REC_SIZE);
+	}
+
+	log_free_segs(file_info->log_segs, file_info->log_nr_alloc,
+		      &file_info->log_seg0);
+	log_account(file_info, (long)nr_alloc - file_info->log_nr_alloc);
+
+	// 单段日志的段表直接放在inode里，避免再分配一次
+	if (nr_segs == 1) {
+		file_info->log_seg0 = single;
+		segs = &file_info->log_seg0;
+	}
+
+	file_info->log_segs = segs;
+	file_info->log_nr_alloc = nr_alloc;
+	file_info->log_cap = cap;
+	file_info->log_max_entries = max_entries;
+	file_info->log_head = 0;
+	file_info->log_size = file_info->log_used;
+	file_info->log_base = 0;
+	return 0;
+}
+
+void loggerfs_log_destroy(struct loggerfs_file_info *file_info)
+{
+	if (file_info->log_segs) {
+		log_free_segs(file_info->log_segs, file_info->log_nr_alloc,
+			      &file_info->log_seg0);
+		log_account(file_info, -(long)file_info->log_nr_alloc);
+	}
+	if (file_info->log_cmd_table) {
+		kmem_cache_free(loggerfs_log_buf_cachep, file_info->log_cmd_table);
+		log_account(file_info, -1);
+	}
+
+	file_info->log_segs = NULL;
+	file_info->log_nr_alloc = 0;
+	file_info->log_cmd_table = NULL;
+}
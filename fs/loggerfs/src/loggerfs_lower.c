@@ -0,0 +1,836 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/fs.h>
+#include <linux/namei.h>
+#include <linux/mount.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/writeback.h>
+#include <linux/uio.h>
+#include <linux/bvec.h>
+#include <linux/sched/mm.h>
+#include <linux/cred.h>
+#include "../include/loggerfs.h"
+
+// 堆叠模式（挂载选项lowerdir=）：
+// 1. 每个loggerfs文件对应下层目录中的一个文件，下层文件的内容就是页缓存中的物理布局
+//    （数据+日志），重新挂载后日志仍然存在
+// 2. 页面按需从下层文件读入（readpage/readahead），脏页由内核回写线程经writepages批量写回，
+//    连续的脏页合并为一次下层写
+// 3. 下层文件的大小在回写和write_inode时同步为total_size（i_size只是数据部分）
+// 4. 目录操作直接转发到下层目录，loggerfs dentry的d_fsdata指向对应的下层dentry
+// 5. 访问下层文件系统一律使用挂载者的凭据
+// 内存模式下这里的页面辅助函数退化为原来的行为：缺页填零，不读写任何下层文件
+
+#define LOGGERFS_WB_PAGES 64    // 一次下层写最多合并的页数
+
+static inline struct loggerfs_file_info *LOGGERFS_I(struct inode *inode)
+{
+	return container_of(inode, struct loggerfs_file_info, vfs_inode);
+}
+
+static inline struct dentry *lower_dentry(struct dentry *dentry)
+{
+	return dentry->d_fsdata;
+}
+
+// 打开（或取得已打开的）下层文件；内存模式返回NULL
+static struct file *lower_file(struct loggerfs_file_info *file_info)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_info->vfs_inode.i_sb);
+	const struct cred *old_cred;
+	struct file *file;
+
+	file = READ_ONCE(file_info->lower_file);
+	if (file || !file_info->lower_path.dentry)
+		return file;
+
+	old_cred = override_creds(sbi->lower_cred);
+	file = dentry_open(&file_info->lower_path, O_RDWR | O_LARGEFILE,
+			   current_cred());
+	revert_creds(old_cred);
+	if (IS_ERR(file))
+		return file;
+
+	// 并发首次使用时只保留一个
+	if (cmpxchg(&file_info->lower_file, NULL, file)) {
+		fput(file);
+		file = file_info->lower_file;
+	}
+	return file;
+}
+
+// 用下层文件的内容填充页面（超出下层文件末尾的部分填零），不解锁页面
+static int loggerfs_fill_page(struct inode *inode, struct page *page)
+{
+	struct loggerfs_file_info *file_info = LOGGERFS_I(inode);
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+	const struct cred *old_cred;
+	loff_t pos = page_offset(page);
+	unsigned int nofs;
+	struct file *file;
+	ssize_t ret = 0;
+	void *kaddr;
+
+	file = lower_file(file_info);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+
+	kaddr = kmap(page);
+	if (file) {
+		old_cred = override_creds(sbi->lower_cred);
+		nofs = memalloc_nofs_save();
+		ret = kernel_read(file, kaddr, PAGE_SIZE, &pos);
+		memalloc_nofs_restore(nofs);
+		revert_creds(old_cred);
+	}
+	if (ret >= 0)
+		memset(kaddr + ret, 0, PAGE_SIZE - ret);
+	kunmap(page);
+
+	if (ret < 0)
+		return ret;
+
+	flush_dcache_page(page);
+	SetPageUptodate(page);
+	return 0;
+}
+
+// 取得用于读取的页面：堆叠模式下按需从下层读入；内存模式下不存在的页面返回NULL（空洞）
+struct page *loggerfs_get_page(struct inode *inode, pgoff_t index)
+{
+	if (!loggerfs_stacked(inode->i_sb))
+		return find_get_page(inode->i_mapping, index);
+
+	return read_mapping_page(inode->i_mapping, index, NULL);
+}
+
+// 取得用于写入的已加锁页面；只写页面的一部分（partial）时先读入原有内容
+struct page *loggerfs_grab_page(struct inode *inode, pgoff_t index, bool partial)
+{
+	struct page *page;
+	int ret;
+
+	page = grab_cache_page(inode->i_mapping, index);
+	if (!page)
+		return ERR_PTR(-ENOMEM);
+
+	if (!PageUptodate(page) && partial) {
+		ret = loggerfs_fill_page(inode, page);
+		if (ret) {
+			unlock_page(page);
+			put_page(page);
+			return ERR_PTR(ret);
+		}
+	}
+	return page;
+}
+
+static int loggerfs_lower_readpage(struct file *file, struct page *page)
+{
+	int ret = loggerfs_fill_page(page->mapping->host, page);
+
+	if (ret)
+		SetPageError(page);
+	unlock_page(page);
+	return ret;
+}
+
+static void loggerfs_lower_readahead(struct readahead_control *rac)
+{
+	struct page *page;
+
+	while ((page = readahead_page(rac))) {
+		loggerfs_lower_readpage(NULL, page);
+		put_page(page);
+	}
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+static int loggerfs_lower_read_folio(struct file *file, struct folio *folio)
+{
+	return loggerfs_lower_readpage(file, &folio->page);
+}
+
+static int loggerfs_lower_write_begin(struct file *file,
+				      struct address_space *mapping,
+				      loff_t pos, unsigned int len,
+				      struct page **pagep, void **fsdata)
+#else
+static int loggerfs_lower_write_begin(struct file *file,
+				      struct address_space *mapping,
+				      loff_t pos, unsigned int len,
+				      unsigned int flags, struct page **pagep,
+				      void **fsdata)
+#endif
+{
+	struct page *page;
+	int ret;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+	page = grab_cache_page_write_begin(mapping, pos >> PAGE_SHIFT);
+#else
+	page = grab_cache_page_write_begin(mapping, pos >> PAGE_SHIFT, flags);
+#endif
+	if (!page)
+		return -ENOMEM;
+
+	// 部分写入需要页面中原有的内容
+	if (!PageUptodate(page) && len != PAGE_SIZE) {
+		ret = loggerfs_fill_page(mapping->host, page);
+		if (ret) {
+			unlock_page(page);
+			put_page(page);
+			return ret;
+		}
+	}
+
+	*pagep = page;
+	return 0;
+}
+
+// 整页写入时write_begin没有读入原有内容，拷贝不完整时不能像simple_write_end那样把其余部分填零
+// 并标记为最新，否则回写会用零覆盖下层文件中的数据。返回0让通用写路径重新拷贝
+static int loggerfs_lower_write_end(struct file *file,
+				    struct address_space *mapping,
+				    loff_t pos, unsigned int len,
+				    unsigned int copied, struct page *page,
+				    void *fsdata)
+{
+	if (!PageUptodate(page) && copied < len) {
+		unlock_page(page);
+		put_page(page);
+		return 0;
+	}
+	return simple_write_end(file, mapping, pos, len, copied, page, fsdata);
+}
+
+// 回写上下文：积累连续的脏页，一次写入下层文件
+struct loggerfs_wb {
+	struct loggerfs_file_info *file_info;
+	struct file *file;
+	loff_t end;             // 回写开始时的物理大小，之后的页面不写
+	loff_t pos;             // 积累的第一页在文件中的位置
+	size_t len;
+	unsigned int nr;
+	struct bio_vec bvec[LOGGERFS_WB_PAGES];
+};
+
+static void loggerfs_wb_submit(struct loggerfs_wb *wb)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(wb->file_info->vfs_inode.i_sb);
+	struct address_space *mapping = wb->file_info->vfs_inode.i_mapping;
+	const struct cred *old_cred;
+	struct iov_iter iter;
+	loff_t pos = wb->pos;
+	unsigned int nofs, i;
+	ssize_t ret;
+
+	if (!wb->nr)
+		return;
+
+	iov_iter_bvec(&iter, WRITE, wb->bvec, wb->nr, wb->len);
+	old_cred = override_creds(sbi->lower_cred);
+	nofs = memalloc_nofs_save();
+	ret = vfs_iter_write(wb->file, &iter, &pos, 0);
+	memalloc_nofs_restore(nofs);
+	revert_creds(old_cred);
+
+	if (ret != wb->len)
+		mapping_set_error(mapping, ret < 0 ? ret : -EIO);
+
+	for (i = 0; i < wb->nr; i++) {
+		if (ret != wb->len)
+			SetPageError(wb->bvec[i].bv_page);
+		end_page_writeback(wb->bvec[i].bv_page);
+	}
+	wb->nr = 0;
+	wb->len = 0;
+}
+
+// write_cache_pages的回调：页面已加锁且清除了脏标记
+static int loggerfs_wb_page(struct page *page, struct writeback_control *wbc,
+			    void *data)
+{
+	struct loggerfs_wb *wb = data;
+	loff_t pos = page_offset(page);
+	size_t len;
+
+	// 物理末尾之后的页面已被截断或日志已移走，无需写回
+	if (pos >= wb->end) {
+		unlock_page(page);
+		return 0;
+	}
+
+	if (wb->nr && (wb->nr == LOGGERFS_WB_PAGES || pos != wb->pos + wb->len))
+		loggerfs_wb_submit(wb);
+
+	len = min_t(loff_t, PAGE_SIZE, wb->end - pos);
+	set_page_writeback(page);
+	unlock_page(page);
+
+	if (!wb->nr)
+		wb->pos = pos;
+	wb->bvec[wb->nr].bv_page = page;
+	wb->bvec[wb->nr].bv_offset = 0;
+	wb->bvec[wb->nr].bv_len = len;
+	wb->nr++;
+	wb->len += len;
+	return 0;
+}
+
+static int loggerfs_lower_writepages(struct address_space *mapping,
+				     struct writeback_control *wbc)
+{
+	struct loggerfs_file_info *file_info = LOGGERFS_I(mapping->host);
+	struct loggerfs_wb *wb;
+	struct file *file;
+	int ret;
+
+	file = lower_file(file_info);
+	if (IS_ERR_OR_NULL(file))
+		return file ? PTR_ERR(file) : -EIO;
+
+	wb = kmalloc(sizeof(*wb), GFP_NOFS);
+	if (!wb)
+		return -ENOMEM;
+
+	wb->file_info = file_info;
+	wb->file = file;
+	wb->end = READ_ONCE(file_info->total_size);
+	wb->nr = 0;
+	wb->len = 0;
+
+	ret = write_cache_pages(mapping, wbc, loggerfs_wb_page, wb);
+	loggerfs_wb_submit(wb);
+	kfree(wb);
+
+	loggerfs_lower_sync_size(file_info);
+	return ret;
+}
+
+// 内存回收单独写回一页
+static int loggerfs_lower_writepage(struct page *page,
+				    struct writeback_control *wbc)
+{
+	struct loggerfs_file_info *file_info = LOGGERFS_I(page->mapping->host);
+	struct loggerfs_wb *wb;
+	struct file *file;
+
+	file = lower_file(file_info);
+	wb = IS_ERR_OR_NULL(file) ? NULL : kmalloc(sizeof(*wb), GFP_NOFS);
+	if (!wb) {
+		// 稍后由回写线程重试
+		redirty_page_for_writepage(wbc, page);
+		unlock_page(page);
+		return 0;
+	}
+
+	wb->file_info = file_info;
+	wb->file = file;
+	wb->end = READ_ONCE(file_info->total_size);
+	wb->nr = 0;
+	wb->len = 0;
+	loggerfs_wb_page(page, wbc, wb);
+	loggerfs_wb_submit(wb);
+	kfree(wb);
+	return 0;
+}
+
+const struct address_space_operations loggerfs_lower_aops = {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 19, 0)
+	.read_folio = loggerfs_lower_read_folio,
+	.dirty_folio = filemap_dirty_folio,
+#else
+	.readpage = loggerfs_lower_readpage,
+	.set_page_dirty = __set_page_dirty_nobuffers,
+#endif
+	.readahead = loggerfs_lower_readahead,
+	.writepage = loggerfs_lower_writepage,
+	.writepages = loggerfs_lower_writepages,
+	.write_begin = loggerfs_lower_write_begin,
+	.write_end = loggerfs_lower_write_end,
+};
+
+// 把下层文件的大小同步为物理大小（数据+日志）
+void loggerfs_lower_sync_size(struct loggerfs_file_info *file_info)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_info->vfs_inode.i_sb);
+	struct file *file = READ_ONCE(file_info->lower_file);
+	const struct cred *old_cred;
+	loff_t size;
+	int ret;
+
+	// 从未打开过的下层文件没有被修改过
+	if (!file || !smp_load_acquire(&file_info->layout_loaded))
+		return;
+
+	size = READ_ONCE(file_info->total_size);
+	if (i_size_read(file_inode(file)) == size)
+		return;
+
+	old_cred = override_creds(sbi->lower_cred);
+	ret = vfs_truncate(&file->f_path, size);
+	revert_creds(old_cred);
+	if (ret)
+		pr_warn_ratelimited("Failed to resize lower file to %lld: %d\n",
+				    size, ret);
+}
+
+// 把[0, end]范围的脏页写回下层文件并刷盘（意图日志的提交和检查点使用），内存模式无事可做
+int loggerfs_lower_fsync(struct loggerfs_file_info *file_info, loff_t end,
+			 int datasync)
+{
+	struct file *file = lower_file(file_info);
+	int ret;
+
+	if (IS_ERR_OR_NULL(file))
+		return PTR_ERR_OR_ZERO(file);
+
+	ret = filemap_write_and_wait_range(file_info->vfs_inode.i_mapping, 0, end);
+	if (ret)
+		return ret;
+	loggerfs_lower_sync_size(file_info);
+	return vfs_fsync_range(file, 0, end, datasync);
+}
+
+// 对下层文件的[offset, offset+len)执行fallocate（只用于数据区，调用者已清掉相应的页缓存），
+// 内存模式无事可做。下层文件系统不支持时返回-EOPNOTSUPP
+int loggerfs_lower_fallocate(struct loggerfs_file_info *file_info, int mode,
+			     loff_t offset, loff_t len)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_info->vfs_inode.i_sb);
+	struct file *file = lower_file(file_info);
+	const struct cred *old_cred;
+	int ret;
+
+	if (IS_ERR_OR_NULL(file))
+		return PTR_ERR_OR_ZERO(file);
+
+	old_cred = override_creds(sbi->lower_cred);
+	ret = vfs_fallocate(file, mode, offset, len);
+	revert_creds(old_cred);
+	return ret;
+}
+
+// 在下层文件上查找offset之后的数据或空洞（SEEK_DATA/SEEK_HOLE）。
+// 先写回脏页，下层文件才能反映页缓存中的内容。结果可能落在日志区域中，由调用者按数据大小截断
+loff_t loggerfs_lower_seek_data(struct loggerfs_file_info *file_info,
+				loff_t offset, int whence)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_info->vfs_inode.i_sb);
+	struct file *file = lower_file(file_info);
+	const struct cred *old_cred;
+	loff_t ret;
+
+	if (IS_ERR_OR_NULL(file))
+		return file ? PTR_ERR(file) : -ENXIO;
+
+	ret = filemap_write_and_wait_range(file_info->vfs_inode.i_mapping,
+					   offset, LLONG_MAX);
+	if (ret)
+		return ret;
+
+	old_cred = override_creds(sbi->lower_cred);
+	ret = vfs_llseek(file, offset, whence);
+	revert_creds(old_cred);
+	return ret;
+}
+
+// 把chmod、chown和时间戳的修改转发到下层（大小由回写同步）
+int loggerfs_lower_setattr(struct loggerfs_file_info *file_info,
+			   struct iattr *attr)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_info->vfs_inode.i_sb);
+	struct dentry *lower = file_info->lower_path.dentry;
+	const struct cred *old_cred;
+	struct iattr lower_attr = *attr;
+	int ret;
+
+	if (!lower)
+		return 0;
+
+	lower_attr.ia_valid &= ~(ATTR_SIZE | ATTR_FILE | ATTR_OPEN);
+	if (!lower_attr.ia_valid)
+		return 0;
+
+	old_cred = override_creds(sbi->lower_cred);
+	inode_lock(d_inode(lower));
+	ret = notify_change(lower, &lower_attr, NULL);
+	inode_unlock(d_inode(lower));
+	revert_creds(old_cred);
+	return ret;
+}
+
+// 释放对下层文件的引用（evict_inode时调用）
+void loggerfs_lower_release(struct loggerfs_file_info *file_info)
+{
+	if (file_info->lower_file) {
+		fput(file_info->lower_file);
+		file_info->lower_file = NULL;
+	}
+	if (file_info->lower_path.dentry) {
+		path_put(&file_info->lower_path);
+		file_info->lower_path.dentry = NULL;
+		file_info->lower_path.mnt = NULL;
+	}
+	file_info->lower_inode = NULL;
+}
+
+static int lower_inode_test(struct inode *inode, void *data)
+{
+	return LOGGERFS_I(inode)->lower_inode == d_inode(data);
+}
+
+static int lower_inode_set(struct inode *inode, void *data)
+{
+	struct loggerfs_file_info *file_info = LOGGERFS_I(inode);
+	struct dentry *lower = data;
+
+	file_info->lower_path.mnt = mntget(LOGGERFS_SB(inode->i_sb)->lower_root.mnt);
+	file_info->lower_path.dentry = dget(lower);
+	file_info->lower_inode = d_inode(lower);
+	inode->i_ino = d_inode(lower)->i_ino;
+	return 0;
+}
+
+// 取得下层dentry对应的loggerfs inode，同一个下层inode只对应一个loggerfs inode
+struct inode *loggerfs_lower_iget(struct super_block *sb,
+				  struct dentry *lower_dentry)
+{
+	struct inode *lower = d_inode(lower_dentry);
+	struct inode *inode;
+	int ret;
+
+	inode = iget5_locked(sb, lower->i_ino, lower_inode_test,
+			     lower_inode_set, lower_dentry);
+	if (!inode)
+		return ERR_PTR(-ENOMEM);
+	if (!(inode->i_state & I_NEW))
+		return inode;
+
+	inode->i_mode = lower->i_mode;
+	inode->i_uid = lower->i_uid;
+	inode->i_gid = lower->i_gid;
+	inode->i_atime = lower->i_atime;
+	inode->i_mtime = lower->i_mtime;
+	inode->i_ctime = lower->i_ctime;
+	set_nlink(inode, lower->i_nlink);
+	i_size_write(inode, i_size_read(lower));
+
+	switch (lower->i_mode & S_IFMT) {
+	case S_IFREG:
+		ret = loggerfs_init_file_inode(inode);
+		if (ret) {
+			iget_failed(inode);
+			return ERR_PTR(ret);
+		}
+		inode->i_mapping->a_ops = &loggerfs_lower_aops;
+		break;
+	case S_IFDIR:
+		inode->i_op = &loggerfs_lower_dir_inode_operations;
+		inode->i_fop = &loggerfs_lower_dir_operations;
+		break;
+	default:
+		init_special_inode(inode, lower->i_mode, lower->i_rdev);
+		break;
+	}
+
+	unlock_new_inode(inode);
+
+	// 立即解析布局：i_size变为数据大小，回写也需要知道物理大小
+	if (S_ISREG(inode->i_mode))
+		loggerfs_load_layout(LOGGERFS_I(inode));
+
+	return inode;
+}
+
+static struct dentry *loggerfs_lower_lookup(struct inode *dir,
+					    struct dentry *dentry,
+					    unsigned int flags)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(dir->i_sb);
+	struct dentry *lower_parent = lower_dentry(dentry->d_parent);
+	const struct cred *old_cred;
+	struct inode *inode = NULL;
+	struct dentry *lower;
+
+	// 根目录下的意图日志文件不可见
+	if (loggerfs_journal_hidden(dentry))
+		return ERR_PTR(-ENOENT);
+
+	old_cred = override_creds(sbi->lower_cred);
+	lower = lookup_one_len_unlocked(dentry->d_name.name, lower_parent,
+					dentry->d_name.len);
+	revert_creds(old_cred);
+	if (IS_ERR(lower))
+		return ERR_CAST(lower);
+
+	// 负的下层dentry也保留，创建时直接使用
+	dentry->d_fsdata = lower;
+	if (d_really_is_positive(lower)) {
+		inode = loggerfs_lower_iget(dir->i_sb, lower);
+		if (IS_ERR(inode))
+			return ERR_CAST(inode);
+	}
+
+	return d_splice_alias(inode, dentry);
+}
+
+// 下层创建成功后建立loggerfs inode
+static int lower_instantiate(struct inode *dir, struct dentry *dentry)
+{
+	struct dentry *lower = lower_dentry(dentry);
+	struct inode *inode;
+
+	inode = loggerfs_lower_iget(dir->i_sb, lower);
+	if (IS_ERR(inode))
+		return PTR_ERR(inode);
+
+	d_instantiate(dentry, inode);
+	set_nlink(dir, d_inode(lower_dentry(dentry->d_parent))->i_nlink);
+	dir->i_mtime = dir->i_ctime = current_time(dir);
+	return 0;
+}
+
+static int loggerfs_lower_mknod(struct inode *dir, struct dentry *dentry,
+				umode_t mode, dev_t dev)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(dir->i_sb);
+	struct dentry *lower_parent = lower_dentry(dentry->d_parent);
+	struct inode *lower_dir = d_inode(lower_parent);
+	const struct cred *old_cred;
+	int ret;
+
+	old_cred = override_creds(sbi->lower_cred);
+	inode_lock_nested(lower_dir, I_MUTEX_PARENT);
+	switch (mode & S_IFMT) {
+	case S_IFREG:
+		ret = vfs_create(lower_dir, lower_dentry(dentry), mode, true);
+		break;
+	case S_IFDIR:
+		ret = vfs_mkdir(lower_dir, lower_dentry(dentry), mode);
+		break;
+	default:
+		ret = vfs_mknod(lower_dir, lower_dentry(dentry), mode, dev);
+		break;
+	}
+	inode_unlock(lower_dir);
+	revert_creds(old_cred);
+
+	if (ret == 0)
+		ret = lower_instantiate(dir, dentry);
+
+	pr_debug("Created lower inode: %s (mode=0%o) ret=%d\n",
+		 dentry->d_name.name, mode, ret);
+	return ret;
+}
+
+static int loggerfs_lower_create(struct inode *dir, struct dentry *dentry,
+				 umode_t mode, bool excl)
+{
+	return loggerfs_lower_mknod(dir, dentry, mode | S_IFREG, 0);
+}
+
+static int loggerfs_lower_mkdir(struct inode *dir, struct dentry *dentry,
+				umode_t mode)
+{
+	return loggerfs_lower_mknod(dir, dentry, mode | S_IFDIR, 0);
+}
+
+// 删除文件或目录：转发到下层后同步链接数
+static int lower_remove(struct inode *dir, struct dentry *dentry, bool is_dir)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(dir->i_sb);
+	struct dentry *lower_parent = lower_dentry(dentry->d_parent);
+	struct dentry *lower = dget(lower_dentry(dentry));
+	struct inode *lower_dir = d_inode(lower_parent);
+	struct inode *inode = d_inode(dentry);
+	const struct cred *old_cred;
+	int ret;
+
+	old_cred = override_creds(sbi->lower_cred);
+	inode_lock_nested(lower_dir, I_MUTEX_PARENT);
+	if (is_dir)
+		ret = vfs_rmdir(lower_dir, lower);
+	else
+		ret = vfs_unlink(lower_dir, lower, NULL);
+	inode_unlock(lower_dir);
+	revert_creds(old_cred);
+
+	if (ret == 0) {
+		if (is_dir)
+			clear_nlink(inode);
+		else
+			set_nlink(inode, LOGGERFS_I(inode)->lower_inode->i_nlink);
+		set_nlink(dir, lower_dir->i_nlink);
+		dir->i_mtime = dir->i_ctime = inode->i_ctime = current_time(dir);
+	}
+
+	dput(lower);
+	return ret;
+}
+
+static int loggerfs_lower_unlink(struct inode *dir, struct dentry *dentry)
+{
+	return lower_remove(dir, dentry, false);
+}
+
+static int loggerfs_lower_rmdir(struct inode *dir, struct dentry *dentry)
+{
+	return lower_remove(dir, dentry, true);
+}
+
+static int loggerfs_lower_rename(struct inode *old_dir, struct dentry *old_dentry,
+				 struct inode *new_dir, struct dentry *new_dentry,
+				 unsigned int flags)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(old_dir->i_sb);
+	struct dentry *lower_old_parent = lower_dentry(old_dentry->d_parent);
+	struct dentry *lower_new_parent = lower_dentry(new_dentry->d_parent);
+	struct dentry *lower_old = dget(lower_dentry(old_dentry));
+	struct dentry *lower_new = dget(lower_dentry(new_dentry));
+	const struct cred *old_cred;
+	struct dentry *trap;
+	int ret;
+
+	if (flags & ~RENAME_NOREPLACE)
+		return -EINVAL;
+
+	old_cred = override_creds(sbi->lower_cred);
+	trap = lock_rename(lower_old_parent, lower_new_parent);
+	// 下层目录树在持锁前被改动过
+	if (lower_old->d_parent != lower_old_parent ||
+	    lower_new->d_parent != lower_new_parent ||
+	    trap == lower_old || trap == lower_new) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = vfs_rename(d_inode(lower_old_parent), lower_old,
+			 d_inode(lower_new_parent), lower_new, NULL, flags);
+	if (ret == 0) {
+		set_nlink(old_dir, d_inode(lower_old_parent)->i_nlink);
+		set_nlink(new_dir, d_inode(lower_new_parent)->i_nlink);
+		old_dir->i_mtime = old_dir->i_ctime = current_time(old_dir);
+		new_dir->i_mtime = new_dir->i_ctime = current_time(new_dir);
+		if (d_really_is_positive(new_dentry))
+			set_nlink(d_inode(new_dentry),
+				  LOGGERFS_I(d_inode(new_dentry))->lower_inode->i_nlink);
+	}
+
+out:
+	unlock_rename(lower_old_parent, lower_new_parent);
+	revert_creds(old_cred);
+	dput(lower_new);
+	dput(lower_old);
+	return ret;
+}
+
+const struct inode_operations loggerfs_lower_dir_inode_operations = {
+	.create = loggerfs_lower_create,
+	.lookup = loggerfs_lower_lookup,
+	.unlink = loggerfs_lower_unlink,
+	.mkdir = loggerfs_lower_mkdir,
+	.rmdir = loggerfs_lower_rmdir,
+	.mknod = loggerfs_lower_mknod,
+	.rename = loggerfs_lower_rename,
+	.getattr = simple_getattr,
+};
+
+// 目录读取直接使用打开的下层目录
+static int loggerfs_lower_dir_open(struct inode *inode, struct file *file)
+{
+	struct loggerfs_file_info *file_info = LOGGERFS_I(inode);
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+	const struct cred *old_cred;
+	struct file *lower;
+
+	old_cred = override_creds(sbi->lower_cred);
+	lower = dentry_open(&file_info->lower_path, O_RDONLY | O_DIRECTORY,
+			    current_cred());
+	revert_creds(old_cred);
+	if (IS_ERR(lower))
+		return PTR_ERR(lower);
+
+	file->private_data = lower;
+	return 0;
+}
+
+static int loggerfs_lower_dir_release(struct inode *inode, struct file *file)
+{
+	fput(file->private_data);
+	return 0;
+}
+
+// 列出根目录时跳过意图日志文件
+struct loggerfs_dir_ctx {
+	struct dir_context ctx;
+	struct dir_context *caller;
+};
+
+static int loggerfs_filldir(struct dir_context *ctx, const char *name,
+			    int namelen, loff_t offset, u64 ino,
+			    unsigned int d_type)
+{
+	struct loggerfs_dir_ctx *fctx =
+		container_of(ctx, struct loggerfs_dir_ctx, ctx);
+
+	if (namelen == sizeof(LOGGERFS_JOURNAL_NAME) - 1 &&
+	    !memcmp(name, LOGGERFS_JOURNAL_NAME, namelen))
+		return 0;
+
+	fctx->caller->pos = ctx->pos;
+	return fctx->caller->actor(fctx->caller, name, namelen, offset, ino,
+				   d_type);
+}
+
+static int loggerfs_lower_iterate(struct file *file, struct dir_context *ctx)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_inode(file)->i_sb);
+	struct file *lower = file->private_data;
+	struct loggerfs_dir_ctx fctx = {
+		.ctx.actor = loggerfs_filldir,
+		.ctx.pos = ctx->pos,
+		.caller = ctx,
+	};
+	int ret;
+
+	if (sbi->journal_file && IS_ROOT(file->f_path.dentry)) {
+		ret = iterate_dir(lower, &fctx.ctx);
+		ctx->pos = fctx.ctx.pos;
+	} else {
+		ret = iterate_dir(lower, ctx);
+	}
+	file->f_pos = lower->f_pos;
+	return ret;
+}
+
+static loff_t loggerfs_lower_dir_llseek(struct file *file, loff_t offset,
+					int whence)
+{
+	struct file *lower = file->private_data;
+	loff_t ret;
+
+	ret = vfs_llseek(lower, offset, whence);
+	if (ret >= 0)
+		file->f_pos = lower->f_pos;
+	return ret;
+}
+
+const struct file_operations loggerfs_lower_dir_operations = {
+	.open = loggerfs_lower_dir_open,
+	.release = loggerfs_lower_dir_release,
+	.iterate_shared = loggerfs_lower_iterate,
+	.llseek = loggerfs_lower_dir_llseek,
+	.read = generic_read_dir,
+	.fsync = noop_fsync,
+};
+
+static void loggerfs_lower_d_release(struct dentry *dentry)
+{
+	dput(dentry->d_fsdata);
+}
+
+const struct dentry_operations loggerfs_lower_dentry_operations = {
+	.d_release = loggerfs_lower_d_release,
+};
@@ -0,0 +1,194 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/shrinker.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "../include/loggerfs.h"
+
+// 撤销历史和日志的内存统计与回收：
+// 1. 每个超级块统计撤销快照和日志缓冲区占用的内存，通过debugfs的loggerfs/<设备号>/memory查看
+// 2. 有撤销历史的inode按最近一次修改的先后挂在超级块的LRU上，最冷的历史最先被丢弃
+// 3. 内存紧张时shrinker丢弃冷inode的全部历史；总量超过挂载选项backup_max=时，
+//    新的一层先挤掉其他inode的历史，再挤掉本inode最旧的几层（见loggerfs_undo.c）
+// 4. 丢弃历史只影响REVERT能撤销多少步，日志不受影响
+// LRU和统计由backup_lock保护；丢弃别的inode的历史还需要拿到它的layout_rwsem
+// （trylock），避免与正在进行的写入和REVERT冲突
+
+struct dentry *loggerfs_debugfs_root;
+
+// 摘下inode的全部撤销历史放到dead上。调用者持有backup_lock
+static void undo_detach_all(struct loggerfs_sb_info *sbi,
+			    struct loggerfs_file_info *file_info,
+			    struct list_head *dead)
+{
+	if (list_empty(&file_info->undo_stack))
+		return;
+
+	list_splice_init(&file_info->undo_stack, dead);
+	sbi->backup_bytes -= file_info->undo_bytes;
+	sbi->backup_files--;
+	list_del_init(&file_info->backup_lru);
+	file_info->undo_bytes = 0;
+	file_info->undo_depth = 0;
+}
+
+static void undo_free_list(struct list_head *dead)
+{
+	struct loggerfs_undo *undo, *tmp;
+
+	list_for_each_entry_safe(undo, tmp, dead, list) {
+		list_del_init(&undo->list);
+		loggerfs_undo_put(undo);
+	}
+}
+
+// 清空inode的撤销历史（写锁下或者inode销毁时）
+void loggerfs_undo_clear(struct loggerfs_file_info *file_info)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_info->vfs_inode.i_sb);
+	LIST_HEAD(dead);
+
+	spin_lock(&sbi->backup_lock);
+	undo_detach_all(sbi, file_info, &dead);
+	spin_unlock(&sbi->backup_lock);
+
+	undo_free_list(&dead);
+}
+
+// 撤销历史压入或去掉一层之后更新统计，新修改的inode移到LRU尾部。
+// 调用者持有layout_rwsem写锁
+void loggerfs_undo_account(struct loggerfs_file_info *file_info, long bytes,
+			   int how)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_info->vfs_inode.i_sb);
+
+	spin_lock(&sbi->backup_lock);
+	sbi->backup_bytes += bytes;
+	file_info->undo_bytes += bytes;
+	if (how == LOGGERFS_UNDO_DISCARD)
+		sbi->backup_dropped++;
+
+	if (list_empty(&file_info->undo_stack)) {
+		if (!list_empty(&file_info->backup_lru)) {
+			list_del_init(&file_info->backup_lru);
+			sbi->backup_files--;
+		}
+	} else if (list_empty(&file_info->backup_lru)) {
+		list_add_tail(&file_info->backup_lru, &sbi->backup_lru);
+		sbi->backup_files++;
+	} else if (how == LOGGERFS_UNDO_PUSH) {
+		list_move_tail(&file_info->backup_lru, &sbi->backup_lru);
+	}
+	spin_unlock(&sbi->backup_lock);
+}
+
+// 从LRU头部丢弃其他inode的全部撤销历史，直到释放goal字节或每个inode都试过一次，
+// 返回释放的字节数
+unsigned long loggerfs_undo_shrink(struct loggerfs_sb_info *sbi,
+				   unsigned long goal)
+{
+	struct loggerfs_file_info *file_info;
+	unsigned long freed = 0, bytes;
+	unsigned int scan;
+	LIST_HEAD(dead);
+
+	spin_lock(&sbi->backup_lock);
+	scan = sbi->backup_files;
+	while (freed < goal && scan-- && !list_empty(&sbi->backup_lru)) {
+		file_info = list_first_entry(&sbi->backup_lru,
+					     struct loggerfs_file_info, backup_lru);
+
+		// 正在写入或REVERT的inode跳过，移到尾部
+		if (!down_write_trylock(&file_info->layout_rwsem)) {
+			list_move_tail(&file_info->backup_lru, &sbi->backup_lru);
+			continue;
+		}
+
+		bytes = file_info->undo_bytes;
+		sbi->backup_dropped += file_info->undo_depth;
+		undo_detach_all(sbi, file_info, &dead);
+		up_write(&file_info->layout_rwsem);
+
+		// 释放页面时不持锁
+		spin_unlock(&sbi->backup_lock);
+		undo_free_list(&dead);
+		INIT_LIST_HEAD(&dead);
+		freed += bytes;
+		spin_lock(&sbi->backup_lock);
+	}
+	spin_unlock(&sbi->backup_lock);
+
+	return freed;
+}
+
+static unsigned long loggerfs_backup_count(struct shrinker *shrinker,
+					   struct shrink_control *sc)
+{
+	struct loggerfs_sb_info *sbi =
+		container_of(shrinker, struct loggerfs_sb_info, backup_shrinker);
+
+	return READ_ONCE(sbi->backup_bytes) >> PAGE_SHIFT;
+}
+
+static unsigned long loggerfs_backup_scan(struct shrinker *shrinker,
+					  struct shrink_control *sc)
+{
+	struct loggerfs_sb_info *sbi =
+		container_of(shrinker, struct loggerfs_sb_info, backup_shrinker);
+	unsigned long freed;
+
+	// 以页为单位回收，每个inode最多尝试一次
+	freed = loggerfs_undo_shrink(sbi, sc->nr_to_scan << PAGE_SHIFT);
+	return freed ? freed >> PAGE_SHIFT : SHRINK_STOP;
+}
+
+static int loggerfs_memory_show(struct seq_file *m, void *v)
+{
+	struct loggerfs_sb_info *sbi = m->private;
+
+	spin_lock(&sbi->backup_lock);
+	seq_printf(m, "backup_bytes: %lu\n", sbi->backup_bytes);
+	seq_printf(m, "backup_files: %u\n", sbi->backup_files);
+	seq_printf(m, "backup_dropped: %lu\n", sbi->backup_dropped);
+	spin_unlock(&sbi->backup_lock);
+	seq_printf(m, "backup_max: %lu\n", sbi->backup_max);
+	seq_printf(m, "undo_depth: %u\n", sbi->undo_depth);
+	seq_printf(m, "log_bytes: %ld\n", atomic_long_read(&sbi->log_bytes));
+	seq_printf(m, "log_dropped: %ld\n", atomic_long_read(&sbi->log_dropped));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(loggerfs_memory);
+
+// 挂载时注册shrinker和debugfs统计
+int loggerfs_mem_init(struct super_block *sb)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(sb);
+	char name[32];
+	int ret;
+
+	sbi->backup_shrinker.count_objects = loggerfs_backup_count;
+	sbi->backup_shrinker.scan_objects = loggerfs_backup_scan;
+	sbi->backup_shrinker.seeks = DEFAULT_SEEKS;
+	ret = register_shrinker(&sbi->backup_shrinker);
+	if (ret)
+		return ret;
+
+	// debugfs不可用时只是看不到统计
+	snprintf(name, sizeof(name), "%u:%u", MAJOR(sb->s_dev), MINOR(sb->s_dev));
+	sbi->debugfs_dir = debugfs_create_dir(name, loggerfs_debugfs_root);
+	debugfs_create_file("memory", 0444, sbi->debugfs_dir, sbi,
+			    &loggerfs_memory_fops);
+	return 0;
+}
+
+// 卸载时在释放inode之前注销（未注册时也可以调用）
+void loggerfs_mem_exit(struct super_block *sb)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(sb);
+
+	debugfs_remove_recursive(sbi->debugfs_dir);
+	sbi->debugfs_dir = NULL;
+	unregister_shrinker(&sbi->backup_shrinker);
+}
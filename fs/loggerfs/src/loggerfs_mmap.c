@@ -0,0 +1,155 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/rmap.h>
+#include <linux/xarray.h>
+#include <linux/version.h>
+#include "../include/loggerfs.h"
+
+// 共享可写映射的写入记录：
+// 1. 映射的页面在第一次写入时经过page_mkwrite，这时按页记录一条WRITE日志，
+//    并留下写入前的副本放在file_info->mmap_dirty中。同一页之后的写入不再产生缺页
+// 2. 持有layout_rwsem写锁的路径（日志刷新、写入、截断、REVERT）先调用loggerfs_mmap_collect，
+//    把副本按页压入撤销历史，并用page_mkclean重新写保护页面，下一次写入再次记录
+// 3. i_size只包含数据区，数据末尾之外的缺页返回SIGBUS，映射到不了日志区域；
+//    v5格式把命令表对齐到页边界，数据最后一页的其余部分不会是日志
+// page_mkwrite不拿layout_rwsem：读路径持读锁拷贝到用户缓冲区时可能在同一文件的映射上缺页。
+// 同样的原因，add_log_entry从不等待日志线程（环满时丢弃记录），否则日志线程要拿这个inode的写锁，
+// 而读锁的持有者正停在缺页中。记录日志时也不持页锁：解析命令路径可能睡眠，日志线程收集时要锁页
+
+static inline struct loggerfs_file_info *LOGGERFS_I(struct inode *inode)
+{
+	return container_of(inode, struct loggerfs_file_info, vfs_inode);
+}
+
+static vm_fault_t loggerfs_page_mkwrite(struct vm_fault *vmf)
+{
+	struct page *page = vmf->page;
+	struct inode *inode = file_inode(vmf->vma->vm_file);
+	struct loggerfs_file_info *file_info = LOGGERFS_I(inode);
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+	loff_t pos = page_offset(page);
+	vm_fault_t ret = VM_FAULT_LOCKED;
+	struct page *copy = NULL;
+	bool logged = false;
+	loff_t size;
+	int err;
+
+	sb_start_pagefault(inode->i_sb);
+	file_update_time(vmf->vma->vm_file);
+
+again:
+	lock_page(page);
+	size = i_size_read(inode);
+	if (page->mapping != inode->i_mapping || pos >= size) {
+		// 页面已被截断或移入撤销快照，重新缺页
+		unlock_page(page);
+		ret = VM_FAULT_NOPAGE;
+		goto out;
+	}
+
+	// 收集之后第一次写这一页：先放开页锁记录日志，再留下写入前的内容。
+	// 其间页面可能被其他缺页标记过，这时多出一条重复的记录
+	if (!xa_load(&file_info->mmap_dirty, page->index)) {
+		if (!logged) {
+			unlock_page(page);
+			add_log_entry(file_info, LOGGERFS_OP_WRITE, pos,
+				      min_t(loff_t, PAGE_SIZE, size - pos), NULL);
+			logged = true;
+			goto again;
+		}
+
+		if (READ_ONCE(sbi->undo_depth)) {
+			copy = alloc_page(GFP_KERNEL);
+			if (copy)
+				copy_highpage(copy, page);
+		}
+
+		// 没有副本时存一个标记，收集时作废撤销历史
+		err = xa_err(xa_store(&file_info->mmap_dirty, page->index,
+				      copy ? (void *)copy : xa_mk_value(0),
+				      GFP_KERNEL));
+		if (err) {
+			if (copy)
+				put_page(copy);
+			unlock_page(page);
+			ret = VM_FAULT_OOM;
+			goto out;
+		}
+	}
+
+	set_page_dirty(page);
+	wait_for_stable_page(page);
+out:
+	sb_end_pagefault(inode->i_sb);
+	return ret;
+}
+
+static const struct vm_operations_struct loggerfs_vm_ops = {
+	.fault = filemap_fault,
+	.map_pages = filemap_map_pages,
+	.page_mkwrite = loggerfs_page_mkwrite,
+};
+
+int loggerfs_file_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	file_accessed(file);
+	vma->vm_ops = &loggerfs_vm_ops;
+	return 0;
+}
+
+// 重新写保护页面，返回映射中是否有写入
+static bool mmap_mkclean(struct page *page)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+	return folio_mkclean(page_folio(page));
+#else
+	return page_mkclean(page);
+#endif
+}
+
+// 把mmap写过的页面收进撤销历史并重新写保护。调用者持有layout_rwsem写锁，或读锁加undo_lock
+void loggerfs_mmap_collect(struct loggerfs_file_info *file_info)
+{
+	struct inode *inode = &file_info->vfs_inode;
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+	unsigned long index;
+	struct page *page;
+	void *entry;
+
+	if (xa_empty(&file_info->mmap_dirty))
+		return;
+
+	xa_for_each(&file_info->mmap_dirty, index, entry) {
+		// 页锁与page_mkwrite互斥，之后的写入重新经过page_mkwrite
+		page = find_lock_page(inode->i_mapping, index);
+		xa_erase(&file_info->mmap_dirty, index);
+		if (page) {
+			if (mmap_mkclean(page))
+				set_page_dirty(page);
+			unlock_page(page);
+			put_page(page);
+		}
+
+		if (xa_is_value(entry))
+			entry = NULL;
+		if (sbi->undo_depth)
+			loggerfs_undo_push_page(file_info, index, entry);
+		else if (entry)
+			put_page(entry);
+	}
+}
+
+// inode销毁时释放还没有收集的副本
+void loggerfs_mmap_release(struct loggerfs_file_info *file_info)
+{
+	unsigned long index;
+	void *entry;
+
+	xa_for_each(&file_info->mmap_dirty, index, entry)
+		if (!xa_is_value(entry))
+			put_page(entry);
+	xa_destroy(&file_info->mmap_dirty);
+}
@@ -0,0 +1,57 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/fs.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include "../include/loggerfs.h"
+
+// 字节范围锁：
+// 不改变布局的覆盖写只持layout_rwsem读锁，同一文件上不重叠的写入可以并行，
+// 重叠的写入（按页对齐后）在这里互相等待。改变布局的路径持写锁，不需要范围锁。
+// 同时持有的范围很少（每个并发写入者一个），用链表线性查找即可
+
+static bool range_try_insert(struct loggerfs_file_info *file_info,
+			     struct loggerfs_range *range)
+{
+	struct loggerfs_range *r;
+	bool ok = true;
+
+	spin_lock(&file_info->range_lock);
+	list_for_each_entry(r, &file_info->ranges, list) {
+		if (r->start < range->end && range->start < r->end) {
+			ok = false;
+			break;
+		}
+	}
+	if (ok)
+		list_add(&range->list, &file_info->ranges);
+	spin_unlock(&file_info->range_lock);
+	return ok;
+}
+
+// 锁定[start, end)，wait为false时有重叠立即返回-EAGAIN，被信号打断返回-EINTR
+int loggerfs_range_lock(struct loggerfs_file_info *file_info,
+			struct loggerfs_range *range, loff_t start, loff_t end,
+			bool wait)
+{
+	range->start = start;
+	range->end = end;
+
+	if (range_try_insert(file_info, range))
+		return 0;
+	if (!wait)
+		return -EAGAIN;
+	if (wait_event_killable(file_info->range_wait,
+				range_try_insert(file_info, range)))
+		return -EINTR;
+	return 0;
+}
+
+void loggerfs_range_unlock(struct loggerfs_file_info *file_info,
+			   struct loggerfs_range *range)
+{
+	spin_lock(&file_info->range_lock);
+	list_del(&range->list);
+	spin_unlock(&file_info->range_lock);
+	wake_up_all(&file_info->range_wait);
+}
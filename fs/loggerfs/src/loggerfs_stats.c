@@ -0,0 +1,150 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/log2.h>
+#include "../include/loggerfs.h"
+
+// 跟踪点的定义也放在这里（见loggerfs_trace.h）
+#define CREATE_TRACE_POINTS
+#include "../include/loggerfs_trace.h"
+
+// 每个挂载的操作统计：
+// 1. 每种操作记录次数、字节数、总耗时和以2为底的对数耗时直方图
+// 2. 计数器每CPU一份，I/O路径上只做本CPU的加法，不拿锁也不争用缓存行
+// 3. 读取时把各CPU的值相加，通过debugfs的loggerfs/<设备号>/stats和latency查看，
+//    与memory、journal在同一个目录下。相加时不停止计数，结果是近似的快照
+
+struct loggerfs_stats {
+	u64 count[LOGGERFS_STAT_NR];
+	u64 bytes[LOGGERFS_STAT_NR];
+	u64 ns[LOGGERFS_STAT_NR];
+	u64 hist[LOGGERFS_STAT_NR][LOGGERFS_STAT_BUCKETS];
+};
+
+static const char * const loggerfs_stat_names[LOGGERFS_STAT_NR] = {
+	[LOGGERFS_STAT_READ] = "read",
+	[LOGGERFS_STAT_WRITE] = "write",
+	[LOGGERFS_STAT_LOG_ENTRY] = "log_entry",
+	[LOGGERFS_STAT_BACKUP] = "backup",
+	[LOGGERFS_STAT_FIND_LOG] = "find_log_start",
+	[LOGGERFS_STAT_REVERT] = "revert",
+};
+
+// 记录一次从start（loggerfs_stat_start）开始的操作，可在任意上下文调用
+void loggerfs_stat_end(struct loggerfs_sb_info *sbi, enum loggerfs_stat_op op,
+		       u64 start, u64 bytes)
+{
+	u64 ns = ktime_get_ns() - start;
+	unsigned int bucket = min_t(unsigned int, ilog2(ns | 1),
+				    LOGGERFS_STAT_BUCKETS - 1);
+
+	this_cpu_inc(sbi->stats->count[op]);
+	this_cpu_add(sbi->stats->bytes[op], bytes);
+	this_cpu_add(sbi->stats->ns[op], ns);
+	this_cpu_inc(sbi->stats->hist[op][bucket]);
+}
+
+// 把各CPU的计数加到sum中
+static void stats_sum(struct loggerfs_sb_info *sbi, struct loggerfs_stats *sum)
+{
+	struct loggerfs_stats *s;
+	unsigned int op, i;
+	int cpu;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		s = per_cpu_ptr(sbi->stats, cpu);
+		for (op = 0; op < LOGGERFS_STAT_NR; op++) {
+			sum->count[op] += READ_ONCE(s->count[op]);
+			sum->bytes[op] += READ_ONCE(s->bytes[op]);
+			sum->ns[op] += READ_ONCE(s->ns[op]);
+			for (i = 0; i < LOGGERFS_STAT_BUCKETS; i++)
+				sum->hist[op][i] += READ_ONCE(s->hist[op][i]);
+		}
+	}
+}
+
+static int loggerfs_stats_show(struct seq_file *m, void *v)
+{
+	struct loggerfs_stats *sum;
+	unsigned int op;
+
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+	stats_sum(m->private, sum);
+
+	seq_printf(m, "%-16s %12s %16s %16s %10s\n",
+		   "op", "count", "bytes", "total_ns", "avg_ns");
+	for (op = 0; op < LOGGERFS_STAT_NR; op++)
+		seq_printf(m, "%-16s %12llu %16llu %16llu %10llu\n",
+			   loggerfs_stat_names[op], sum->count[op],
+			   sum->bytes[op], sum->ns[op],
+			   sum->count[op] ? div64_u64(sum->ns[op], sum->count[op]) : 0);
+
+	kfree(sum);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(loggerfs_stats);
+
+// 每种操作一段，只列出非空的桶：[下界, 上界) 纳秒 次数
+static int loggerfs_latency_show(struct seq_file *m, void *v)
+{
+	struct loggerfs_stats *sum;
+	unsigned int op, i;
+
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	if (!sum)
+		return -ENOMEM;
+	stats_sum(m->private, sum);
+
+	for (op = 0; op < LOGGERFS_STAT_NR; op++) {
+		if (!sum->count[op])
+			continue;
+		seq_printf(m, "%s:\n", loggerfs_stat_names[op]);
+		for (i = 0; i < LOGGERFS_STAT_BUCKETS; i++) {
+			if (!sum->hist[op][i])
+				continue;
+			if (i == LOGGERFS_STAT_BUCKETS - 1)
+				seq_printf(m, "  [%12llu, %12s) ns: %llu\n",
+					   1ULL << i, "inf", sum->hist[op][i]);
+			else
+				seq_printf(m, "  [%12llu, %12llu) ns: %llu\n",
+					   i ? 1ULL << i : 0, 1ULL << (i + 1),
+					   sum->hist[op][i]);
+		}
+	}
+
+	kfree(sum);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(loggerfs_latency);
+
+// 挂载时分配计数器，在loggerfs_mem_init创建的debugfs目录下注册统计文件。
+// 目录随loggerfs_mem_exit删除
+int loggerfs_stats_init(struct super_block *sb)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(sb);
+
+	sbi->stats = alloc_percpu(struct loggerfs_stats);
+	if (!sbi->stats)
+		return -ENOMEM;
+
+	debugfs_create_file("stats", 0444, sbi->debugfs_dir, sbi,
+			    &loggerfs_stats_fops);
+	debugfs_create_file("latency", 0444, sbi->debugfs_dir, sbi,
+			    &loggerfs_latency_fops);
+	return 0;
+}
+
+// 卸载时在所有inode释放之后调用（未分配时也可以调用）
+void loggerfs_stats_exit(struct super_block *sb)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(sb);
+
+	free_percpu(sbi->stats);
+	sbi->stats = NULL;
+}
@@ -4,6 +4,12 @@
 #include <linux/statfs.h>
 #include <linux/mount.h>
 #include <linux/module.h>
+#include <linux/parser.h>
+#include <linux/seq_file.h>
+#include <linux/namei.h>
+#include <linux/backing-dev.h>
+#include <linux/cred.h>
+#include <linux/debugfs.h>
 #include "../include/loggerfs.h"
 
 struct kmem_cache *loggerfs_inode_cachep;
@@ -23,16 +29,52 @@ static struct inode *loggerfs_alloc_inode(struct super_block *sb)
 	file_info->data_size = 0;
 	file_info->log_start = 0;
 	file_info->log_size = 0;
+	file_info->log_head = 0;
+	file_info->log_used = 0;
 	file_info->total_size = 0;
+	file_info->log_base = 0;
+	file_info->log_cleared = 0;
+	file_info->layout_loaded = false;
 
-	// 初始化备份数据结构
-	file_info->backup.offset = 0;
-	file_info->backup.length = 0;
-	file_info->backup.original_data = NULL;
-	file_info->backup.is_valid = false;
+	// 初始化撤销历史
+	INIT_LIST_HEAD(&file_info->undo_stack);
+	file_info->undo_depth = 0;
+	file_info->undo_bytes = 0;
+	INIT_LIST_HEAD(&file_info->backup_lru);
+	xa_init(&file_info->mmap_dirty);
+	mutex_init(&file_info->undo_lock);
+	spin_lock_init(&file_info->range_lock);
+	INIT_LIST_HEAD(&file_info->ranges);
+	init_waitqueue_head(&file_info->range_wait);
+	INIT_LIST_HEAD(&file_info->watches);
 
-	// 初始化日志操作锁
-	spin_lock_init(&file_info->log_lock);
+	// 初始化布局锁和待写日志队列（日志缓冲区在loggerfs_get_inode中为普通文件分配）
+	init_rwsem(&file_info->layout_rwsem);
+	file_info->log_segs = NULL;
+	file_info->log_seg0 = NULL;
+	file_info->log_cap = 0;
+	file_info->log_nr_alloc = 0;
+	file_info->log_max_entries = 0;
+	file_info->log_cmd_table = NULL;
+	file_info->log_next_seq = 0;
+	file_info->log_slots = NULL;
+	file_info->log_nr_slots = 0;
+	atomic_long_set(&file_info->log_tail, 0);
+	file_info->log_slot_head = 0;
+	file_info->log_state = 0;
+	file_info->read_policy = LOGGERFS_READS_ON;
+	file_info->read_sample = LOGGERFS_DEFAULT_READ_SAMPLE;
+	atomic_set(&file_info->read_count, 0);
+	spin_lock_init(&file_info->log_open_lock);
+	file_info->log_open_rec = NULL;
+	file_info->lower_path.mnt = NULL;
+	file_info->lower_path.dentry = NULL;
+	file_info->lower_inode = NULL;
+	file_info->lower_file = NULL;
+	INIT_LIST_HEAD(&file_info->journal_node);
+	INIT_LIST_HEAD(&file_info->journal_commit);
+	file_info->journal_tid = 0;
+	file_info->journal_size = 0;
 
 	pr_debug("Allocated inode with physical log support\n");
 	return &file_info->vfs_inode;
@@ -45,13 +87,56 @@ static void loggerfs_destroy_inode(struct inode *inode)
 	struct loggerfs_file_info *file_info =
 		container_of(inode, struct loggerfs_file_info, vfs_inode);
 
-	// 清理备份数据
-	cleanup_backup_data(file_info);
+	// 释放撤销历史
+	loggerfs_undo_clear(file_info);
+	loggerfs_mmap_release(file_info);
+
+	loggerfs_log_slots_destroy(file_info);
+	loggerfs_log_destroy(file_info);
 
 	if (loggerfs_inode_cachep && file_info)
 		kmem_cache_free(loggerfs_inode_cachep, file_info);
 }
 
+// 释放页面和对下层文件的引用
+static void loggerfs_evict_inode(struct inode *inode)
+{
+	truncate_inode_pages_final(&inode->i_data);
+	clear_inode(inode);
+	loggerfs_lower_release(container_of(inode, struct loggerfs_file_info,
+					    vfs_inode));
+}
+
+// 回写线程写完脏页后同步下层文件的大小（内存模式无事可做）
+static int loggerfs_write_inode(struct inode *inode,
+				struct writeback_control *wbc)
+{
+	if (S_ISREG(inode->i_mode) && loggerfs_stacked(inode->i_sb))
+		loggerfs_lower_sync_size(container_of(inode, struct loggerfs_file_info,
+						      vfs_inode));
+	return 0;
+}
+
+// sync时把积压的日志写入并提交意图日志，再做检查点（内存模式无事可做）
+static int loggerfs_sync_fs(struct super_block *sb, int wait)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(sb);
+
+	if (!wait || !sbi->journal_file)
+		return 0;
+
+	loggerfs_flush_all_logs(sbi);
+	return loggerfs_journal_sync(sbi);
+}
+
+// 内存模式下inode就是文件本身，最后一个引用释放即删除；堆叠模式下缓存到内存回收
+static int loggerfs_drop_inode(struct inode *inode)
+{
+	if (loggerfs_stacked(inode->i_sb))
+		return generic_drop_inode(inode);
+	return generic_delete_inode(inode);
+}
+
 static int loggerfs_statfs(struct dentry *dentry, struct kstatfs *buf)
 {
 	buf->f_type = LOGGERFS_MAGIC;
@@ -60,18 +145,296 @@ static int loggerfs_statfs(struct dentry *dentry, struct kstatfs *buf)
 	return 0;
 }
 
+// 与LOGGERFS_READS_*对应，用于显示挂载选项
+static const char * const loggerfs_read_policy_names[] = {
+	[LOGGERFS_READS_OFF] = "off",
+	[LOGGERFS_READS_ON] = "on",
+	[LOGGERFS_READS_SAMPLE] = "sample",
+	[LOGGERFS_READS_COALESCE] = "coalesce",
+};
+
+static int loggerfs_show_options(struct seq_file *m, struct dentry *root)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(root->d_sb);
+
+	if (sbi->flush_ms != LOGGERFS_DEFAULT_FLUSH_MS)
+		seq_printf(m, ",flush_ms=%u", sbi->flush_ms);
+	if (sbi->flush_records != LOGGERFS_DEFAULT_FLUSH_RECORDS)
+		seq_printf(m, ",flush_records=%u", sbi->flush_records);
+	if (sbi->log_size != LOGGERFS_DEFAULT_LOG_SIZE)
+		seq_printf(m, ",logsize=%u", sbi->log_size);
+	if (sbi->log_entries != LOGGERFS_DEFAULT_LOG_ENTRIES)
+		seq_printf(m, ",logentries=%u", sbi->log_entries);
+	if (sbi->read_policy != LOGGERFS_READS_ON)
+		seq_printf(m, ",readlog=%s", loggerfs_read_policy_names[sbi->read_policy]);
+	if (sbi->read_sample != LOGGERFS_DEFAULT_READ_SAMPLE)
+		seq_printf(m, ",readsample=%u", sbi->read_sample);
+	if (sbi->undo_depth != LOGGERFS_DEFAULT_UNDO_DEPTH)
+		seq_printf(m, ",undo_depth=%u", sbi->undo_depth);
+	if (sbi->backup_max != LOGGERFS_DEFAULT_BACKUP_MAX)
+		seq_printf(m, ",backup_max=%lu", sbi->backup_max);
+	if (sbi->lowerdir)
+		seq_show_option(m, "lowerdir", sbi->lowerdir);
+	if (sbi->lowerdir && !sbi->journal)
+		seq_puts(m, ",journal=off");
+	return 0;
+}
+
 // 超级块操作结构体
 const struct super_operations loggerfs_ops = {
 	.alloc_inode = loggerfs_alloc_inode,
 	.destroy_inode = loggerfs_destroy_inode,
 	.statfs = loggerfs_statfs,
-	.drop_inode = generic_delete_inode,
+	.drop_inode = loggerfs_drop_inode,
+	.evict_inode = loggerfs_evict_inode,
+	.write_inode = loggerfs_write_inode,
+	.sync_fs = loggerfs_sync_fs,
+	.show_options = loggerfs_show_options,
+};
+
+// 挂载选项
+enum {
+	Opt_flush_ms,
+	Opt_flush_records,
+	Opt_logsize,
+	Opt_logentries,
+	Opt_readlog_off,
+	Opt_readlog_on,
+	Opt_readlog_sample,
+	Opt_readlog_coalesce,
+	Opt_readsample,
+	Opt_lowerdir,
+	Opt_backup_max,
+	Opt_undo_depth,
+	Opt_journal_off,
+	Opt_journal_on,
+	Opt_err,
 };
 
+static const match_table_t loggerfs_tokens = {
+	{ Opt_flush_ms, "flush_ms=%u" },
+	{ Opt_flush_records, "flush_records=%u" },
+	{ Opt_logsize, "logsize=%u" },
+	{ Opt_logentries, "logentries=%u" },
+	{ Opt_readlog_off, "readlog=off" },
+	{ Opt_readlog_on, "readlog=on" },
+	{ Opt_readlog_sample, "readlog=sample" },
+	{ Opt_readlog_coalesce, "readlog=coalesce" },
+	{ Opt_readsample, "readsample=%u" },
+	{ Opt_lowerdir, "lowerdir=%s" },
+	{ Opt_backup_max, "backup_max=%s" },
+	{ Opt_undo_depth, "undo_depth=%u" },
+	{ Opt_journal_off, "journal=off" },
+	{ Opt_journal_on, "journal=on" },
+	{ Opt_err, NULL },
+};
+
+static int loggerfs_parse_options(char *data, struct loggerfs_sb_info *sbi)
+{
+	substring_t args[MAX_OPT_ARGS];
+	char *p, *str, *end;
+	int option, bad;
+
+	if (!data)
+		return 0;
+
+	while ((p = strsep(&data, ",")) != NULL) {
+		if (!*p)
+			continue;
+
+		switch (match_token(p, loggerfs_tokens, args)) {
+		case Opt_flush_ms:
+			if (match_int(&args[0], &option) || option < 0)
+				return -EINVAL;
+			sbi->flush_ms = option;
+			break;
+		case Opt_flush_records:
+			if (match_int(&args[0], &option) || option < 1 ||
+			    option > LOGGERFS_MAX_FLUSH_RECORDS)
+				return -EINVAL;
+			sbi->flush_records = option;
+			break;
+		case Opt_logsize:
+			if (match_int(&args[0], &option) ||
+			    option < LOGGERFS_MIN_LOG_SIZE ||
+			    option > LOGGERFS_MAX_LOG_SIZE)
+				return -EINVAL;
+			sbi->log_size = option;
+			break;
+		case Opt_logentries:
+			if (match_int(&args[0], &option) || option < 0)
+				return -EINVAL;
+			sbi->log_entries = option;
+			break;
+		case Opt_readlog_off:
+			sbi->read_policy = LOGGERFS_READS_OFF;
+			break;
+		case Opt_readlog_on:
+			sbi->read_policy = LOGGERFS_READS_ON;
+			break;
+		case Opt_readlog_sample:
+			sbi->read_policy = LOGGERFS_READS_SAMPLE;
+			break;
+		case Opt_readlog_coalesce:
+			sbi->read_policy = LOGGERFS_READS_COALESCE;
+			break;
+		case Opt_readsample:
+			if (match_int(&args[0], &option) || option < 1)
+				return -EINVAL;
+			sbi->read_sample = option;
+			break;
+		case Opt_lowerdir:
+			kfree(sbi->lowerdir);
+			sbi->lowerdir = match_strdup(&args[0]);
+			if (!sbi->lowerdir)
+				return -ENOMEM;
+			break;
+		case Opt_backup_max:
+			// 接受K/M/G后缀
+			str = match_strdup(&args[0]);
+			if (!str)
+				return -ENOMEM;
+			sbi->backup_max = memparse(str, &end);
+			bad = *end != '\0';
+			kfree(str);
+			if (bad)
+				return -EINVAL;
+			break;
+		case Opt_undo_depth:
+			if (match_int(&args[0], &option) || option < 0 ||
+			    option > LOGGERFS_MAX_UNDO_DEPTH)
+				return -EINVAL;
+			sbi->undo_depth = option;
+			break;
+		case Opt_journal_off:
+			sbi->journal = false;
+			break;
+		case Opt_journal_on:
+			sbi->journal = true;
+			break;
+		default:
+			pr_err("Unrecognized mount option \"%s\"\n", p);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+// 堆叠模式的挂载：文件和日志保存在下层目录中，由内核回写线程写回
+static int loggerfs_fill_super_lower(struct super_block *sb,
+				     struct loggerfs_sb_info *sbi)
+{
+	struct super_block *lower_sb;
+	struct inode *inode;
+	int ret;
+
+	ret = kern_path(sbi->lowerdir, LOOKUP_FOLLOW | LOOKUP_DIRECTORY,
+			&sbi->lower_root);
+	if (ret) {
+		pr_err("Failed to resolve lowerdir %s: %d\n", sbi->lowerdir, ret);
+		return ret;
+	}
+
+	lower_sb = sbi->lower_root.mnt->mnt_sb;
+	sb->s_stack_depth = lower_sb->s_stack_depth + 1;
+	if (sb->s_stack_depth > FILESYSTEM_MAX_STACK_DEPTH) {
+		pr_err("Maximum filesystem stacking depth exceeded\n");
+		return -EINVAL;
+	}
+
+	// 下层访问使用挂载者的凭据
+	sbi->lower_cred = prepare_creds();
+	if (!sbi->lower_cred)
+		return -ENOMEM;
+
+	// 需要自己的bdi，脏页才会由回写线程写回
+	ret = super_setup_bdi(sb);
+	if (ret)
+		return ret;
+
+	sb->s_maxbytes = lower_sb->s_maxbytes;
+	sb->s_blocksize = PAGE_CACHE_SIZE;
+	sb->s_blocksize_bits = PAGE_CACHE_SHIFT;
+	sb->s_magic = LOGGERFS_MAGIC;
+	sb->s_op = &loggerfs_ops;
+	sb->s_d_op = &loggerfs_lower_dentry_operations;
+	sb->s_time_gran = 1;
+
+	inode = loggerfs_lower_iget(sb, sbi->lower_root.dentry);
+	if (IS_ERR(inode))
+		return PTR_ERR(inode);
+
+	sb->s_root = d_make_root(inode);
+	if (!sb->s_root)
+		return -ENOMEM;
+	sb->s_root->d_fsdata = dget(sbi->lower_root.dentry);
+
+	// 重放上次没有完成检查点的事务（需要根目录和下层凭据）
+	if (sbi->journal) {
+		ret = loggerfs_journal_init(sb);
+		if (ret)
+			return ret;
+	}
+
+	ret = loggerfs_audit_init(sb);
+	if (ret)
+		return ret;
+
+	pr_info("Mounted over lower directory %s\n", sbi->lowerdir);
+	return 0;
+}
+
 // 挂载操作
 static int loggerfs_fill_super(struct super_block *sb, void *data, int silent)
 {
+	struct loggerfs_sb_info *sbi;
 	struct inode *inode;
+	int ret;
+
+	sbi = kzalloc(sizeof(*sbi), GFP_KERNEL);
+	if (!sbi)
+		return -ENOMEM;
+
+	sbi->flush_ms = LOGGERFS_DEFAULT_FLUSH_MS;
+	sbi->flush_records = LOGGERFS_DEFAULT_FLUSH_RECORDS;
+	sbi->log_size = LOGGERFS_DEFAULT_LOG_SIZE;
+	sbi->log_entries = LOGGERFS_DEFAULT_LOG_ENTRIES;
+	sbi->read_policy = LOGGERFS_READS_ON;
+	sbi->read_sample = LOGGERFS_DEFAULT_READ_SAMPLE;
+	init_llist_head(&sbi->flush_list);
+	atomic_set(&sbi->pending_records, 0);
+	atomic_long_set(&sbi->log_dropped, 0);
+	INIT_DELAYED_WORK(&sbi->flush_work, loggerfs_log_flush_work);
+	sbi->undo_depth = LOGGERFS_DEFAULT_UNDO_DEPTH;
+	sbi->backup_max = LOGGERFS_DEFAULT_BACKUP_MAX;
+	spin_lock_init(&sbi->backup_lock);
+	INIT_LIST_HEAD(&sbi->backup_lru);
+	atomic_long_set(&sbi->log_bytes, 0);
+	sbi->journal = true;
+	mutex_init(&sbi->journal_lock);
+	mutex_init(&sbi->journal_commit_lock);
+	INIT_LIST_HEAD(&sbi->journal_inodes);
+	spin_lock_init(&sbi->watch_lock);
+	INIT_LIST_HEAD(&sbi->watches);
+	mutex_init(&sbi->audit_lock);
+	init_waitqueue_head(&sbi->audit_wait);
+	sb->s_fs_info = sbi;
+
+	ret = loggerfs_parse_options(data, sbi);
+	if (ret)
+		return ret;
+
+	ret = loggerfs_mem_init(sb);
+	if (ret)
+		return ret;
+
+	ret = loggerfs_stats_init(sb);
+	if (ret)
+		return ret;
+
+	if (sbi->lowerdir)
+		return loggerfs_fill_super_lower(sb, sbi);
 
 	sb->s_maxbytes = MAX_LFS_FILESIZE;
 	sb->s_blocksize = PAGE_CACHE_SIZE;
@@ -80,7 +443,7 @@ static int loggerfs_fill_super(struct super_block *sb, void *data, int silent)
 	sb->s_op = &loggerfs_ops;
 	sb->s_time_gran = 1;
 
-	inode = loggerfs_alloc_inode(sb); // 统一用loggerfs_alloc_inode
+	inode = new_inode(sb); // 经由s_op->alloc_inode分配并完成VFS初始化
 	if (!inode) {
 		pr_err("Failed to allocate root inode\n");
 		return -ENOMEM;
@@ -101,7 +464,7 @@ static int loggerfs_fill_super(struct super_block *sb, void *data, int silent)
 		return -ENOMEM;
 	}
 
-	return 0;
+	return loggerfs_audit_init(sb);
 }
 
 static struct dentry *loggerfs_mount(struct file_system_type *fs_type,
@@ -113,7 +476,35 @@ static struct dentry *loggerfs_mount(struct file_system_type *fs_type,
 
 static void loggerfs_kill_sb(struct super_block *sb)
 {
-	kill_litter_super(sb);
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(sb);
+
+	// 先把积压的日志写完，日志线程持有的inode引用也在此释放
+	if (sbi) {
+		cancel_delayed_work_sync(&sbi->flush_work);
+		loggerfs_flush_all_logs(sbi);
+		// 意图日志持有inode引用，要在释放inode之前做完检查点；
+		// 检查点中刷新的记录可能又安排了日志线程
+		loggerfs_journal_exit(sb);
+		cancel_delayed_work_sync(&sbi->flush_work);
+		loggerfs_mem_exit(sb);
+		loggerfs_audit_exit(sb);
+	}
+
+	if (sbi && sbi->lower_root.dentry) {
+		// 堆叠模式的dentry没有被钉住，卸载时同步写回所有脏页
+		kill_anon_super(sb);
+		path_put(&sbi->lower_root);
+	} else {
+		kill_litter_super(sb);
+	}
+
+	if (sbi) {
+		loggerfs_stats_exit(sb);
+		if (sbi->lower_cred)
+			put_cred(sbi->lower_cred);
+		kfree(sbi->lowerdir);
+	}
+	kfree(sbi);
 }
 
 static struct file_system_type loggerfs_fs_type = {
@@ -144,13 +535,41 @@ static int __init loggerfs_init(void)
 		return -ENOMEM;
 	}
 
+	loggerfs_log_buf_cachep = kmem_cache_create("loggerfs_log_buf",
+						    LOGGERFS_LOG_SEG_SIZE, 0,
+						    SLAB_RECLAIM_ACCOUNT, NULL);
+	if (!loggerfs_log_buf_cachep) {
+		pr_err("Failed to create log buffer cache\n");
+		ret = -ENOMEM;
+		goto out_inode_cache;
+	}
+
+	loggerfs_log_wq = alloc_workqueue("loggerfs_log", WQ_UNBOUND, 0);
+	if (!loggerfs_log_wq) {
+		pr_err("Failed to create log workqueue\n");
+		ret = -ENOMEM;
+		goto out_buf_cache;
+	}
+
+	// 各挂载的内存统计放在debugfs的loggerfs目录下
+	loggerfs_debugfs_root = debugfs_create_dir("loggerfs", NULL);
+
 	ret = register_filesystem(&loggerfs_fs_type);
 	if (ret) {
-		kmem_cache_destroy(loggerfs_inode_cachep);
 		pr_err("Failed to register loggerfs filesystem\n");
+		goto out_debugfs;
 	}
 
 	pr_info("Filesystem registered successfully\n");
+	return 0;
+
+out_debugfs:
+	debugfs_remove_recursive(loggerfs_debugfs_root);
+	destroy_workqueue(loggerfs_log_wq);
+out_buf_cache:
+	kmem_cache_destroy(loggerfs_log_buf_cachep);
+out_inode_cache:
+	kmem_cache_destroy(loggerfs_inode_cachep);
 	return ret;
 }
 
@@ -158,6 +577,10 @@ static int __init loggerfs_init(void)
 static void __exit loggerfs_exit(void)
 {
 	unregister_filesystem(&loggerfs_fs_type);
+	debugfs_remove_recursive(loggerfs_debugfs_root);
+	destroy_workqueue(loggerfs_log_wq);
+	loggerfs_cmd_cache_destroy();
+	kmem_cache_destroy(loggerfs_log_buf_cachep);
 	kmem_cache_destroy(loggerfs_inode_cachep);
 	pr_info("Filesystem unregistered\n");
 }
@@ -0,0 +1,341 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include "../include/loggerfs.h"
+#include "../include/loggerfs_trace.h"
+
+// 多层撤销历史：
+// 1. 每次写入或改变大小之前压入一层，记录被覆盖区域的页面快照和修改前的数据大小，
+//    REVERT从栈顶逐层恢复，最多保留挂载选项undo_depth=层
+// 2. 持写锁时被完整覆盖的页面不复制：快照直接持有原页面的引用并把它移出页缓存，写入时另分配新页。
+//    只有区域两端部分覆盖的页面（最多两页）需要复制。持读锁的并发覆盖写不能移走页面：
+//    读者不拿范围锁，移走的页面在写完之前会读成空洞，所以这时整页也复制
+// 3. 没有被覆盖的页面仍在页缓存中，由各层共享，不占用额外内存
+// 4. 某一层无法记录（内存不足、超过backup_max）时整个历史作废，
+//    否则更早的层恢复出来的内容会缺少这次修改之外的部分
+// 5. 通过mmap写入的页面每页一层，写入前的副本在page_mkwrite时留下（见loggerfs_mmap.c）
+// 栈的修改在layout_rwsem写锁下进行，或者在读锁加undo_lock下进行（不改变布局的并发覆盖写，
+// 见loggerfs_write_iter）。并发写入者各自持有自己那一层的引用，这一层被其他写入者挤出栈后
+// 仍然可以用来恢复没写到的部分。统计和LRU见loggerfs_mem.c
+
+static unsigned long undo_excess(struct loggerfs_sb_info *sbi,
+				 unsigned long bytes)
+{
+	unsigned long total = READ_ONCE(sbi->backup_bytes) + bytes;
+
+	return total > sbi->backup_max ? total - sbi->backup_max : 0;
+}
+
+// 放弃一层的引用，最后一个引用释放页面快照（不处理统计）
+void loggerfs_undo_put(struct loggerfs_undo *undo)
+{
+	unsigned int i;
+
+	if (!refcount_dec_and_test(&undo->ref))
+		return;
+
+	for (i = 0; i < undo->nr_pages; i++)
+		if (undo->pages[i])
+			put_page(undo->pages[i]);
+	kvfree(undo);
+}
+
+// 从栈中去掉一层并释放
+static void undo_drop(struct loggerfs_file_info *file_info,
+		      struct loggerfs_undo *undo, int how)
+{
+	list_del_init(&undo->list);
+	file_info->undo_depth--;
+	loggerfs_undo_account(file_info, -(long)undo->bytes, how);
+	loggerfs_undo_put(undo);
+}
+
+// 为新的一层腾出bytes字节：超过backup_max时先丢弃其他inode的冷历史，
+// 仍然不够时丢弃本inode最旧的几层
+static int undo_reserve(struct loggerfs_file_info *file_info,
+			unsigned long bytes)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_info->vfs_inode.i_sb);
+	unsigned long over;
+
+	if (!sbi->backup_max)
+		return 0;
+	if (bytes > sbi->backup_max)
+		return -E2BIG;
+
+	over = undo_excess(sbi, bytes);
+	if (over)
+		loggerfs_undo_shrink(sbi, over);
+
+	while (undo_excess(sbi, bytes) && !list_empty(&file_info->undo_stack))
+		undo_drop(file_info, list_last_entry(&file_info->undo_stack,
+						     struct loggerfs_undo, list),
+			  LOGGERFS_UNDO_DISCARD);
+
+	return undo_excess(sbi, bytes) ? -ENOMEM : 0;
+}
+
+// 取得一页的快照：整页被覆盖且steal为true时持有原页面，否则复制一份，空洞为NULL
+static int undo_snapshot_page(struct loggerfs_file_info *file_info,
+			      struct loggerfs_undo *undo, pgoff_t index,
+			      bool steal, struct page **snap)
+{
+	loff_t pos = (loff_t)index << PAGE_SHIFT;
+	struct page *page, *copy;
+
+	*snap = NULL;
+	page = loggerfs_get_page(&file_info->vfs_inode, index);
+	if (IS_ERR(page))
+		return PTR_ERR(page);
+	if (!page)
+		return 0;
+
+	if (steal && pos >= undo->offset &&
+	    pos + PAGE_SIZE <= undo->offset + undo->length) {
+		*snap = page;
+		return 0;
+	}
+
+	// 边缘页还要留在页缓存中接受写入
+	copy = alloc_page(GFP_KERNEL);
+	if (!copy) {
+		put_page(page);
+		return -ENOMEM;
+	}
+	copy_highpage(copy, page);
+	put_page(page);
+	*snap = copy;
+	return 0;
+}
+
+// 把新的一层放到栈顶，超过undo_depth层时丢弃最旧的
+static void undo_link(struct loggerfs_file_info *file_info,
+		      struct loggerfs_undo *undo)
+{
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_info->vfs_inode.i_sb);
+
+	list_add(&undo->list, &file_info->undo_stack);
+	file_info->undo_depth++;
+	loggerfs_undo_account(file_info, undo->bytes, LOGGERFS_UNDO_PUSH);
+
+	while (file_info->undo_depth > sbi->undo_depth)
+		undo_drop(file_info, list_last_entry(&file_info->undo_stack,
+						     struct loggerfs_undo, list),
+			  LOGGERFS_UNDO_DISCARD);
+}
+
+// 在修改数据区[start, end)之前压入一层（end超过数据末尾的部分只需记录原大小），
+// held不为NULL时返回这一层并持有一个引用，由loggerfs_undo_unwind使用、loggerfs_undo_put释放。
+// 失败时清空整个历史。调用者持有layout_rwsem写锁，或读锁加undo_lock（这时shared为true，
+// 快照一律复制，原页面留在页缓存中供并发的读者读取）
+int loggerfs_undo_push(struct loggerfs_file_info *file_info, loff_t start,
+		       loff_t end, bool shared, struct loggerfs_undo **held)
+{
+	struct inode *inode = &file_info->vfs_inode;
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+	struct loggerfs_undo *undo;
+	loff_t length, steal_start, steal_end;
+	unsigned int nr, i;
+	pgoff_t first;
+	u64 t0;
+	int ret;
+
+	// 先收进之前的mmap写入，保持各层的先后顺序
+	loggerfs_mmap_collect(file_info);
+
+	if (!sbi->undo_depth)
+		return -EOPNOTSUPP;
+	t0 = loggerfs_stat_start();
+
+	length = max_t(loff_t, min(end, file_info->data_size) - start, 0);
+	first = start >> PAGE_SHIFT;
+	nr = length ? ((start + length - 1) >> PAGE_SHIFT) - first + 1 : 0;
+
+	ret = undo_reserve(file_info, (unsigned long)nr << PAGE_SHIFT);
+	if (ret)
+		goto fail;
+
+	undo = kvmalloc(struct_size(undo, pages, nr), GFP_KERNEL);
+	if (!undo) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	refcount_set(&undo->ref, 1);
+	undo->offset = start;
+	undo->length = length;
+	undo->old_size = file_info->data_size;
+	undo->bytes = 0;
+	undo->seq = U64_MAX;
+	undo->rec_next = NULL;
+	undo->nr_pages = nr;
+
+	for (i = 0; i < nr; i++) {
+		ret = undo_snapshot_page(file_info, undo, first + i, !shared,
+					 &undo->pages[i]);
+		if (ret) {
+			undo->nr_pages = i;
+			loggerfs_undo_put(undo);
+			goto fail;
+		}
+		if (undo->pages[i])
+			undo->bytes += PAGE_SIZE;
+	}
+
+	// 整页快照移出页缓存（同时解除用户映射），写入时分配新页而不是覆盖原页面
+	steal_start = round_up(start, PAGE_SIZE);
+	steal_end = round_down(start + length, PAGE_SIZE);
+	if (!shared && steal_start < steal_end)
+		truncate_inode_pages_range(inode->i_mapping, steal_start,
+					   steal_end - 1);
+
+	if (held) {
+		refcount_inc(&undo->ref);
+		*held = undo;
+	}
+	undo_link(file_info, undo);
+	loggerfs_stat_end(sbi, LOGGERFS_STAT_BACKUP, t0, length);
+	trace_loggerfs_backup(file_info, start, length, t0);
+	return 0;
+
+fail:
+	pr_warn_ratelimited("Cannot record undo for %lld+%lld (%d), dropping undo history\n",
+			    start, length, ret);
+	loggerfs_undo_clear(file_info);
+	loggerfs_stat_end(sbi, LOGGERFS_STAT_BACKUP, t0, 0);
+	return ret;
+}
+
+// 为mmap写过的一页压入一层，copy是写入前的内容（取得其引用），
+// 为NULL表示没能留下副本，此时整个历史作废。调用者持有layout_rwsem写锁
+void loggerfs_undo_push_page(struct loggerfs_file_info *file_info,
+			     pgoff_t index, struct page *copy)
+{
+	loff_t pos = (loff_t)index << PAGE_SHIFT;
+	struct loggerfs_undo *undo;
+	int ret = -ENOMEM;
+
+	// 这一页已被截掉，之后的截断那一层会恢复它
+	if (pos >= file_info->data_size) {
+		if (copy)
+			put_page(copy);
+		return;
+	}
+
+	if (copy)
+		ret = undo_reserve(file_info, PAGE_SIZE);
+	undo = ret ? NULL : kvmalloc(struct_size(undo, pages, 1), GFP_KERNEL);
+	if (!undo) {
+		if (copy)
+			put_page(copy);
+		pr_warn_ratelimited("Cannot record undo for mmap write at %lld, dropping undo history\n",
+				    pos);
+		loggerfs_undo_clear(file_info);
+		return;
+	}
+
+	refcount_set(&undo->ref, 1);
+	undo->offset = pos;
+	undo->length = min_t(loff_t, PAGE_SIZE, file_info->data_size - pos);
+	undo->old_size = file_info->data_size;
+	undo->bytes = PAGE_SIZE;
+	undo->seq = U64_MAX;
+	undo->rec_next = NULL;
+	undo->nr_pages = 1;
+	undo->pages[0] = copy;
+	undo_link(file_info, undo);
+}
+
+// 把快照中[from, offset+length)的内容写回页缓存
+static int undo_restore(struct loggerfs_file_info *file_info,
+			struct loggerfs_undo *undo, loff_t from)
+{
+	struct inode *inode = &file_info->vfs_inode;
+	loff_t end = undo->offset + undo->length;
+	pgoff_t first = undo->offset >> PAGE_SHIFT;
+	struct page *page, *snap;
+	unsigned int start, len;
+	void *dst, *src;
+
+	for (from = max(from, undo->offset); from < end; from += len) {
+		start = offset_in_page(from);
+		len = min_t(loff_t, PAGE_SIZE - start, end - from);
+		snap = undo->pages[(from >> PAGE_SHIFT) - first];
+
+		page = loggerfs_grab_page(inode, from >> PAGE_SHIFT,
+					  len < PAGE_SIZE);
+		if (IS_ERR(page))
+			return PTR_ERR(page);
+
+		if (snap) {
+			dst = kmap_atomic(page);
+			src = kmap_atomic(snap);
+			memcpy(dst + start, src + start, len);
+			kunmap_atomic(src);
+			kunmap_atomic(dst);
+			flush_dcache_page(page);
+		} else {
+			zero_user(page, start, len);
+		}
+
+		SetPageUptodate(page);
+		set_page_dirty(page);
+		unlock_page(page);
+		put_page(page);
+	}
+	return 0;
+}
+
+// 恢复栈顶一层：先恢复被截掉的大小，写回原内容，再去掉扩展出来的部分。
+// 返回这一层的起始位置和记录这次修改的日志记录序号，没有历史时返回-ENODATA。
+// 调用者持有layout_rwsem写锁
+int loggerfs_undo_pop(struct loggerfs_file_info *file_info, loff_t *offset,
+		      u64 *seq)
+{
+	struct inode *inode = &file_info->vfs_inode;
+	u64 start = loggerfs_stat_start();
+	struct loggerfs_undo *undo;
+	int ret;
+
+	loggerfs_mmap_collect(file_info);
+
+	undo = list_first_entry_or_null(&file_info->undo_stack,
+					struct loggerfs_undo, list);
+	if (!undo)
+		return -ENODATA;
+
+	if (undo->old_size > file_info->data_size)
+		loggerfs_resize_data(file_info, undo->old_size);
+
+	ret = undo_restore(file_info, undo, undo->offset);
+	if (ret)
+		return ret;
+
+	if (undo->old_size < file_info->data_size)
+		loggerfs_resize_data(file_info, undo->old_size);
+
+	trace_loggerfs_restore(file_info, undo->offset, undo->length, start);
+
+	inode->i_mtime = inode->i_ctime = current_time(inode);
+	mark_inode_dirty(inode);
+	*offset = undo->offset;
+	*seq = undo->seq;
+	undo_drop(file_info, undo, LOGGERFS_UNDO_POP);
+	return 0;
+}
+
+// 写入没有完成时把这次写入压入的一层中from之后未写到的部分恢复原样（整页快照已不在页缓存中），
+// 什么都没写入且这一层还在栈中时去掉它。调用者持有写锁或读锁加undo_lock，以及写入的范围
+void loggerfs_undo_unwind(struct loggerfs_file_info *file_info,
+			  struct loggerfs_undo *undo, loff_t from)
+{
+	if (undo_restore(file_info, undo, from)) {
+		loggerfs_undo_clear(file_info);
+		return;
+	}
+	if (from <= undo->offset && !list_empty(&undo->list))
+		undo_drop(file_info, undo, LOGGERFS_UNDO_POP);
+}
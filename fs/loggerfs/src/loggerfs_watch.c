@@ -0,0 +1,242 @@
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/slab.h>
+#include <linux/anon_inodes.h>
+#include <linux/capability.h>
+#include <linux/poll.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+#include "../include/loggerfs.h"
+
+// 新记录通知（LOGGERFS_IOC_WATCH）：
+// 1. 每个通知fd有一个定长的事件队列，挂在inode（只看一个文件）或超级块（整个挂载）的列表上
+// 2. 日志刷新把记录追加进日志时调用loggerfs_watch_notify，按记录放入事件并唤醒读者，
+//    读者看到的记录与READLOG一致（都在日志刷新之后）
+// 3. 队列满时丢弃新记录而不是阻塞日志线程，丢弃的条数记在下一个事件上
+// 列表由sbi->watch_lock保护，队列由各自的lock保护。没有通知fd时刷新路径只检查两个空链表
+// 读者由read_mutex串行，事件拷贝成功后才移出队列，拷贝失败的事件留给下一次read
+
+struct loggerfs_watch {
+	struct list_head node;          // 挂在file_info->watches或sbi->watches上
+	struct file *file;              // 创建时的loggerfs文件，持有引用，保证inode和挂载存在
+	struct mutex read_mutex;        // 串行化读者，队头事件在拷贝期间不会被取走
+	spinlock_t lock;                // 保护以下队列字段
+	wait_queue_head_t wait;
+	unsigned int size;              // 队列容量
+	unsigned int head;              // 最旧事件的位置
+	unsigned int count;             // 队列中的事件数
+	u32 pending_dropped;            // 尚未报告的丢弃数，记到下一个事件上
+	u64 dropped;                    // 累计丢弃数（fdinfo中显示）
+	struct loggerfs_watch_event events[];
+};
+
+static inline struct loggerfs_file_info *LOGGERFS_I(struct inode *inode)
+{
+	return container_of(inode, struct loggerfs_file_info, vfs_inode);
+}
+
+static void watch_queue(struct loggerfs_watch *watch, struct inode *inode,
+			const struct loggerfs_log_record *rec)
+{
+	struct loggerfs_watch_event *ev;
+
+	spin_lock(&watch->lock);
+	if (watch->count == watch->size) {
+		if (watch->pending_dropped < U32_MAX)
+			watch->pending_dropped++;
+		watch->dropped++;
+		spin_unlock(&watch->lock);
+		return;
+	}
+
+	ev = &watch->events[(watch->head + watch->count) % watch->size];
+	ev->ino = inode->i_ino;
+	ev->seq = le64_to_cpu(rec->seq);
+	ev->time = le64_to_cpu(rec->time);
+	ev->offset = le64_to_cpu(rec->offset);
+	ev->length = le32_to_cpu(rec->length);
+	ev->op = le16_to_cpu(rec->op);
+	ev->flags = rec->flags;
+	ev->dropped = watch->pending_dropped;
+	ev->reserved = 0;
+	watch->pending_dropped = 0;
+	watch->count++;
+	spin_unlock(&watch->lock);
+
+	wake_up_interruptible_poll(&watch->wait, EPOLLIN | EPOLLRDNORM);
+}
+
+// 一条记录已追加进日志。调用者持有layout_rwsem写锁，不能睡眠的锁都在这里面
+void loggerfs_watch_notify(struct loggerfs_file_info *file_info,
+			   const struct loggerfs_log_record *rec)
+{
+	struct inode *inode = &file_info->vfs_inode;
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+	struct loggerfs_watch *watch;
+
+	// 刚创建的通知可能错过这一条，与创建之前追加的记录没有区别
+	if (list_empty_careful(&file_info->watches) &&
+	    list_empty_careful(&sbi->watches))
+		return;
+
+	spin_lock(&sbi->watch_lock);
+	list_for_each_entry(watch, &file_info->watches, node)
+		watch_queue(watch, inode, rec);
+	list_for_each_entry(watch, &sbi->watches, node)
+		watch_queue(watch, inode, rec);
+	spin_unlock(&sbi->watch_lock);
+}
+
+// 读取尽可能多的整条事件，缓冲区放不下一个事件时返回-EINVAL
+static ssize_t loggerfs_watch_read(struct file *file, char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	struct loggerfs_watch *watch = file->private_data;
+	struct loggerfs_watch_event ev;
+	size_t done = 0;
+	ssize_t ret;
+
+	if (count < sizeof(ev))
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&watch->read_mutex))
+		return -ERESTARTSYS;
+
+	for (;;) {
+		spin_lock(&watch->lock);
+		if (watch->count)
+			break;
+		spin_unlock(&watch->lock);
+
+		ret = -EAGAIN;
+		if (file->f_flags & O_NONBLOCK)
+			goto out;
+		ret = wait_event_interruptible(watch->wait, READ_ONCE(watch->count));
+		if (ret)
+			goto out;
+	}
+
+	// 持自旋锁时不能拷贝到用户空间：先复制队头，拷贝成功后再移出。
+	// 通知路径只在队尾追加，持有read_mutex时队头不会变
+	while (watch->count && done + sizeof(ev) <= count) {
+		ev = watch->events[watch->head];
+		spin_unlock(&watch->lock);
+
+		if (copy_to_user(buf + done, &ev, sizeof(ev))) {
+			ret = done ? done : -EFAULT;
+			goto out;
+		}
+		done += sizeof(ev);
+
+		spin_lock(&watch->lock);
+		watch->head = (watch->head + 1) % watch->size;
+		watch->count--;
+	}
+	spin_unlock(&watch->lock);
+	ret = done;
+out:
+	mutex_unlock(&watch->read_mutex);
+	return ret;
+}
+
+static __poll_t loggerfs_watch_poll(struct file *file, poll_table *wait)
+{
+	struct loggerfs_watch *watch = file->private_data;
+
+	poll_wait(file, &watch->wait, wait);
+	return READ_ONCE(watch->count) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+static int loggerfs_watch_release(struct inode *anon, struct file *file)
+{
+	struct loggerfs_watch *watch = file->private_data;
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(file_inode(watch->file)->i_sb);
+
+	spin_lock(&sbi->watch_lock);
+	list_del(&watch->node);
+	spin_unlock(&sbi->watch_lock);
+
+	fput(watch->file);
+	kvfree(watch);
+	return 0;
+}
+
+static void loggerfs_watch_show_fdinfo(struct seq_file *m, struct file *file)
+{
+	struct loggerfs_watch *watch = file->private_data;
+
+	spin_lock(&watch->lock);
+	seq_printf(m, "queued:\t%u\nqueue_len:\t%u\ndropped:\t%llu\n",
+		   watch->count, watch->size, watch->dropped);
+	spin_unlock(&watch->lock);
+}
+
+static const struct file_operations loggerfs_watch_fops = {
+	.read = loggerfs_watch_read,
+	.poll = loggerfs_watch_poll,
+	.release = loggerfs_watch_release,
+	.show_fdinfo = loggerfs_watch_show_fdinfo,
+	.llseek = noop_llseek,
+};
+
+// LOGGERFS_IOC_WATCH：创建通知fd并返回
+int loggerfs_watch_create(struct file *file,
+			  struct loggerfs_watch_args __user *uargs)
+{
+	struct inode *inode = file_inode(file);
+	struct loggerfs_sb_info *sbi = LOGGERFS_SB(inode->i_sb);
+	struct loggerfs_watch_args args;
+	struct loggerfs_watch *watch;
+	struct file *anon;
+	int fd;
+
+	if (copy_from_user(&args, uargs, sizeof(args)))
+		return -EFAULT;
+	if (args.flags & ~(LOGGERFS_WATCH_MOUNT | LOGGERFS_WATCH_NONBLOCK))
+		return -EINVAL;
+	// 整个挂载的记录与汇总日志（只有root可读）看到的相同，同样只对管理员开放
+	if ((args.flags & LOGGERFS_WATCH_MOUNT) && !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if (!args.queue_len)
+		args.queue_len = LOGGERFS_WATCH_QUEUE_DEFAULT;
+	if (args.queue_len > LOGGERFS_WATCH_QUEUE_MAX)
+		return -EINVAL;
+
+	watch = kvzalloc(struct_size(watch, events, args.queue_len), GFP_KERNEL);
+	if (!watch)
+		return -ENOMEM;
+	mutex_init(&watch->read_mutex);
+	spin_lock_init(&watch->lock);
+	init_waitqueue_head(&watch->wait);
+	watch->size = args.queue_len;
+	watch->file = get_file(file);
+
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0)
+		goto err;
+	anon = anon_inode_getfile("[loggerfs-watch]", &loggerfs_watch_fops, watch,
+				  O_RDONLY |
+				  (args.flags & LOGGERFS_WATCH_NONBLOCK ? O_NONBLOCK : 0));
+	if (IS_ERR(anon)) {
+		put_unused_fd(fd);
+		fd = PTR_ERR(anon);
+		goto err;
+	}
+
+	// 先挂上再安装fd：安装之后其他线程可以立即关闭它，release要摘下这个节点
+	spin_lock(&sbi->watch_lock);
+	if (args.flags & LOGGERFS_WATCH_MOUNT)
+		list_add_tail(&watch->node, &sbi->watches);
+	else
+		list_add_tail(&watch->node, &LOGGERFS_I(inode)->watches);
+	spin_unlock(&sbi->watch_lock);
+
+	fd_install(fd, anon);
+	return fd;
+
+err:
+	fput(watch->file);
+	kvfree(watch);
+	return fd;
+}
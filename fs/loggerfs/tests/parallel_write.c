@@ -0,0 +1,150 @@
+/*
+ * 并发覆盖写基准：多个线程对同一个文件中互不重叠的区域做pwrite，
+ * 线程数从1翻倍到CPU数，输出每种线程数下的总吞吐量
+ *
+ * 用法：parallel_write <文件> [每个线程的区域大小，默认1M] [块大小，默认4K] [秒数，默认3]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+struct worker {
+	pthread_t thread;
+	int fd;
+	off_t base;             // 本线程区域的起始位置
+	size_t region;
+	size_t block;
+	unsigned long long bytes;
+	int error;
+};
+
+static volatile int stop;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = arg;
+	char *buf = malloc(w->block);
+	size_t off = 0;
+	ssize_t n;
+
+	if (!buf) {
+		w->error = ENOMEM;
+		return NULL;
+	}
+	memset(buf, 'a' + (int)(w->base / w->region) % 26, w->block);
+
+	while (!stop) {
+		n = pwrite(w->fd, buf, w->block, w->base + off);
+		if (n != (ssize_t)w->block) {
+			w->error = n < 0 ? errno : EIO;
+			break;
+		}
+		w->bytes += n;
+		off += w->block;
+		if (off + w->block > w->region)
+			off = 0;
+	}
+	free(buf);
+	return NULL;
+}
+
+// 运行nr个线程seconds秒，返回MB/s，失败返回-1
+static double run(int fd, int nr, size_t region, size_t block, int seconds)
+{
+	struct worker *w = calloc(nr, sizeof(*w));
+	unsigned long long total = 0;
+	double start, elapsed;
+	int i, error = 0;
+
+	if (!w)
+		return -1;
+
+	stop = 0;
+	start = now();
+	for (i = 0; i < nr; i++) {
+		w[i].fd = fd;
+		w[i].base = (off_t)i * region;
+		w[i].region = region;
+		w[i].block = block;
+		pthread_create(&w[i].thread, NULL, worker_main, &w[i]);
+	}
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nr; i++) {
+		pthread_join(w[i].thread, NULL);
+		total += w[i].bytes;
+		if (w[i].error)
+			error = w[i].error;
+	}
+	elapsed = now() - start;
+	free(w);
+
+	if (error) {
+		fprintf(stderr, "写入失败: %s\n", strerror(error));
+		return -1;
+	}
+	return total / elapsed / (1024 * 1024);
+}
+
+int main(int argc, char **argv)
+{
+	size_t region = argc > 2 ? strtoul(argv[2], NULL, 0) : 1 << 20;
+	size_t block = argc > 3 ? strtoul(argv[3], NULL, 0) : 4096;
+	int seconds = argc > 4 ? atoi(argv[4]) : 3;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	double base = 0, mbps;
+	char *zero;
+	int fd, nr;
+
+	if (argc < 2 || !region || !block || block > region || seconds <= 0) {
+		fprintf(stderr, "用法: %s <文件> [区域大小] [块大小] [秒数]\n", argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	// 先写满所有区域，测试中的写入都是数据区内的覆盖写
+	zero = calloc(1, region);
+	if (!zero)
+		return 1;
+	for (nr = 0; nr < cpus; nr++) {
+		if (pwrite(fd, zero, region, (off_t)nr * region) != (ssize_t)region) {
+			perror("pwrite");
+			return 1;
+		}
+	}
+	free(zero);
+
+	printf("%-8s %12s %8s\n", "线程数", "吞吐量(MB/s)", "加速比");
+	for (nr = 1;; nr = nr * 2 < cpus ? nr * 2 : cpus) {
+		mbps = run(fd, nr, region, block, seconds);
+		if (mbps < 0)
+			return 1;
+		if (nr == 1)
+			base = mbps;
+		printf("%-8d %12.1f %8.2f\n", nr, mbps, base > 0 ? mbps / base : 0);
+		if (nr == cpus)
+			break;
+	}
+
+	close(fd);
+	return 0;
+}
@@ -161,6 +161,21 @@ benchmark_log_operations() {
     echo
 }
 
+benchmark_parallel_write() {
+    local test_file="$1"
+
+    echo -e "${BLUE}并发覆盖写测试: 每个线程写同一文件中不重叠的1MB区域${NC}"
+
+    if [ ! -x "$PROJECT_DIR/parallel_write" ]; then
+        echo "  跳过：未编译parallel_write（make bench）"
+        echo
+        return
+    fi
+
+    "$PROJECT_DIR/parallel_write" "$test_file" $((1024 * 1024)) 4096 3 | sed 's/^/  /'
+    echo
+}
+
 # 主测试流程
 main() {
     setup
@@ -189,6 +204,10 @@ main() {
     echo -e "${GREEN}=== 随机访问性能测试 ===${NC}"
     benchmark_random_access "${TEST_FILE}_random"
     
+    # 同一文件上的并发写入
+    echo -e "${GREEN}=== 并发写入性能测试 ===${NC}"
+    benchmark_parallel_write "${TEST_FILE}_parallel"
+    
     # 日志操作性能测试
     echo -e "${GREEN}=== 日志操作性能测试 ===${NC}"
     benchmark_log_operations "${TEST_FILE}_log"
@@ -145,6 +145,242 @@ test_revert_functionality() {
     [ $? -eq 0 ]
 }
 
+test_log_ring_eviction() {
+    # 写入足够多的记录使日志超过一个块，只应淘汰最旧的记录
+    local ring_file="$MOUNT_POINT/ring_file"
+    local i
+    for i in $(seq 0 199); do
+        dd if=/dev/zero of="$ring_file" bs=1 count=1 seek=$i conv=notrunc 2>/dev/null
+    done
+    cd "$PROJECT_DIR"
+    local log=$(./logctl "$ring_file" readlog | sed '1,/^----/d')
+    # 每一行都是完整的记录，最新的写入仍在，最早的写入已被淘汰
+    ! echo "$log" | grep -qvE '^[0-9]+ [^ ]+ [a-z]+ [0-9]+ [0-9]+$' && \
+    echo "$log" | tail -n 1 | grep -qE ' write 199 1$' && \
+    ! echo "$log" | grep -qE ' write 0 1$'
+}
+
+test_log_config() {
+    # 单独放大一个文件的日志容量，写满后应保留超过一个块的日志
+    local conf_file="$MOUNT_POINT/conf_file"
+    local i
+    touch "$conf_file"
+    cd "$PROJECT_DIR"
+    ./logctl "$conf_file" setlog 16384 >/dev/null || return 1
+    for i in $(seq 0 299); do
+        dd if=/dev/zero of="$conf_file" bs=1 count=1 seek=$i conv=notrunc 2>/dev/null
+    done
+    local used=$(./logctl "$conf_file" logconf | sed -n 's/^当前日志: \([0-9]*\) 字节.*/\1/p')
+    [ -n "$used" ] && [ "$used" -gt 4096 ] && [ "$used" -le 16384 ]
+}
+
+test_log_cmd_table() {
+    # 不同程序的记录各自引用命令表中的路径，READLOG渲染出的路径应与程序一致
+    local cmd_file="$MOUNT_POINT/cmd_file"
+    echo "cmd table" > "$cmd_file"
+    cat "$cmd_file" >/dev/null
+    cd "$PROJECT_DIR"
+    local log=$(./logctl "$cmd_file" readlog | sed '1,/^----/d')
+    echo "$log" | grep -qE '^[0-9]+ [^ ]+/cat read 0 [0-9]+$' && \
+    echo "$log" | grep -qE '^[0-9]+ [^ ]+ write 0 10$'
+}
+
+test_readlog_incremental() {
+    # 从上次返回的序号续读，只得到之后的新记录
+    local inc_file="$MOUNT_POINT/inc_file"
+    echo "first" > "$inc_file"
+    cd "$PROJECT_DIR"
+    local next=$(./logctl "$inc_file" readlog 2>&1 >/dev/null | sed -n 's/^下一个序号: //p')
+    [ -n "$next" ] || return 1
+    dd if=/dev/zero of="$inc_file" bs=1 count=3 seek=100 conv=notrunc 2>/dev/null
+    local log=$(./logctl "$inc_file" readlog "$next" 2>/dev/null | sed '1,/^----/d')
+    [ "$(echo "$log" | wc -l)" = "1" ] && echo "$log" | grep -qE ' write 100 3$'
+}
+
+test_read_policy() {
+    # 关闭读日志后读操作不再记录；合并模式下顺序读合并为一条记录
+    local policy_file="$MOUNT_POINT/policy_file"
+    echo "0123456789" > "$policy_file"
+    cd "$PROJECT_DIR"
+    ./logctl "$policy_file" setread off >/dev/null || return 1
+    cat "$policy_file" >/dev/null
+    ./logctl "$policy_file" readlog | grep -q ' read ' && return 1
+    ./logctl "$policy_file" setread coalesce >/dev/null || return 1
+    dd if="$policy_file" of=/dev/null bs=1 count=10 2>/dev/null
+    local log=$(./logctl "$policy_file" readlog | sed '1,/^----/d')
+    [ "$(echo "$log" | grep -c ' read ')" = "1" ] && \
+    echo "$log" | grep -qE ' read 0 10$'
+}
+
+test_copy_and_append() {
+    # cp在同一文件系统内走copy_file_range/splice，目标文件只应包含数据；O_APPEND追加到数据末尾
+    local src_file="$MOUNT_POINT/copy_src"
+    local dst_file="$MOUNT_POINT/copy_dst"
+    dd if=/dev/urandom of="$src_file" bs=4096 count=64 2>/dev/null
+    cp "$src_file" "$dst_file" || return 1
+    cmp -s "$src_file" "$dst_file" || return 1
+    echo "tail" >> "$dst_file"
+    [ "$(stat -c%s "$dst_file")" = "$((4096 * 64 + 5))" ] && \
+    [ "$(tail -c 5 "$dst_file")" = "tail" ]
+}
+
+test_lower_persistence() {
+    # 堆叠在下层目录上：卸载并重新挂载后数据和日志都应保留
+    local lower_dir=$(mktemp -d)
+    local lower_mnt=$(mktemp -d)
+    local ok=1
+    mount -t loggerfs -o lowerdir="$lower_dir" none "$lower_mnt" || return 1
+    echo "persistent" > "$lower_mnt/persist_file"
+    umount "$lower_mnt"
+    mount -t loggerfs -o lowerdir="$lower_dir" none "$lower_mnt" || return 1
+    cd "$PROJECT_DIR"
+    [ "$(cat "$lower_mnt/persist_file")" = "persistent" ] && \
+    [ "$(stat -c%s "$lower_mnt/persist_file")" = "11" ] && \
+    ./logctl "$lower_mnt/persist_file" readlog | grep -qE ' write 0 11$' && ok=0
+    umount "$lower_mnt"
+    rm -rf "$lower_dir" "$lower_mnt"
+    return $ok
+}
+
+test_lower_journal() {
+    # 意图日志：提交后非空，sync做检查点后清空；loggerfs中看不到意图日志文件
+    local lower_dir=$(mktemp -d)
+    local lower_mnt=$(mktemp -d)
+    local journal="$lower_dir/.loggerfs_journal"
+    local ok=1
+    mount -t loggerfs -o lowerdir="$lower_dir",flush_ms=20 none "$lower_mnt" || return 1
+    echo "journaled" > "$lower_mnt/journal_file"
+    sleep 0.5
+    [ -s "$journal" ] && \
+    ! ls -a "$lower_mnt" | grep -q loggerfs_journal && \
+    sync && [ ! -s "$journal" ] && ok=0
+    umount "$lower_mnt"
+    [ -e "$journal" ] && [ ! -s "$journal" ] || ok=1
+    rm -rf "$lower_dir" "$lower_mnt"
+    return $ok
+}
+
+test_lower_fsync() {
+    # fsync之后下层文件中已经是写入的数据；并发的fsync都应成功
+    local lower_dir=$(mktemp -d)
+    local lower_mnt=$(mktemp -d)
+    local ok=1 i
+    mount -t loggerfs -o lowerdir="$lower_dir" none "$lower_mnt" || return 1
+    for i in 1 2 3 4; do
+        printf 'fsync%d' $i | dd of="$lower_mnt/fsync_$i" conv=fsync 2>/dev/null &
+    done
+    wait
+    ok=0
+    for i in 1 2 3 4; do
+        [ "$(head -c 6 "$lower_dir/fsync_$i")" = "fsync$i" ] || ok=1
+    done
+    umount "$lower_mnt"
+    rm -rf "$lower_dir" "$lower_mnt"
+    return $ok
+}
+
+test_multi_level_revert() {
+    # 连续撤销两次覆盖写，回到第一次写入的内容
+    local undo_file="$MOUNT_POINT/undo_file"
+    printf 'one' > "$undo_file"
+    printf 'two' | dd of="$undo_file" conv=notrunc 2>/dev/null
+    printf 'three' | dd of="$undo_file" conv=notrunc 2>/dev/null
+    cd "$PROJECT_DIR"
+    ./logctl "$undo_file" revert >/dev/null && \
+    [ "$(cat "$undo_file")" = "two" ] && \
+    ./logctl "$undo_file" revert >/dev/null && \
+    [ "$(cat "$undo_file")" = "one" ] || return 1
+    # 日志保留第一次写入，被撤销的两次写入换成了revert记录
+    local log=$(./logctl "$undo_file" readlog | sed '1,/^----/d')
+    echo "$log" | grep -qE ' write 0 3$' && \
+    [ "$(echo "$log" | grep -c ' revert ')" = "2" ] && \
+    ! echo "$log" | grep -qE ' write 0 5$'
+}
+
+test_mmap_write() {
+    # 共享映射的写入记录一条write日志，REVERT恢复写入前的内容
+    local mmap_file="$MOUNT_POINT/mmap_file"
+    printf 'aaaaaaaaaa' > "$mmap_file"
+    python3 -c '
+import mmap, sys
+with open(sys.argv[1], "r+b") as f:
+    m = mmap.mmap(f.fileno(), 0)
+    m[0:3] = b"bbb"
+    m.close()
+' "$mmap_file" || return 1
+    [ "$(cat "$mmap_file")" = "bbbaaaaaaa" ] || return 1
+    cd "$PROJECT_DIR"
+    [ "$(./logctl "$mmap_file" readlog | grep -c ' write 0 10$')" = "2" ] && \
+    ./logctl "$mmap_file" revert >/dev/null && \
+    [ "$(cat "$mmap_file")" = "aaaaaaaaaa" ]
+}
+
+test_punch_hole() {
+    # 打洞记录一条punch日志、大小不变、内容读出零，REVERT恢复原内容
+    local hole_file="$MOUNT_POINT/hole_file"
+    yes a | head -c 16384 > "$hole_file"
+    fallocate -p -o 4096 -l 4096 "$hole_file" || return 1
+    [ "$(stat -c%s "$hole_file")" = "16384" ] && \
+    [ "$(dd if="$hole_file" bs=4096 skip=1 count=1 2>/dev/null | tr -d '\0' | wc -c)" = "0" ] || return 1
+    cd "$PROJECT_DIR"
+    ./logctl "$hole_file" readlog | grep -q ' punch 4096 4096$' && \
+    ./logctl "$hole_file" revert >/dev/null && \
+    [ "$(tr -d '\0' < "$hole_file" | wc -c)" = "16384" ]
+}
+
+test_watch() {
+    # 通知fd：写入之后watch输出对应的write记录
+    local watch_file="$MOUNT_POINT/watch_file"
+    local out=$(mktemp)
+    echo "x" > "$watch_file"
+    cd "$PROJECT_DIR"
+    ./logctl "$watch_file" watch > "$out" &
+    local pid=$!
+    sleep 0.5
+    echo "watched" | dd of="$watch_file" bs=8 seek=1 conv=notrunc 2>/dev/null
+    sleep 0.5
+    kill $pid 2>/dev/null
+    wait $pid 2>/dev/null
+    grep -qE ' write +8 +8 *$' "$out"
+    local ok=$?
+    rm -f "$out"
+    return $ok
+}
+
+test_audit_journal() {
+    # 汇总日志：打开之后写入的记录带着inode号和路径出现在/.loggerfs/journal中
+    local audit_file="$MOUNT_POINT/audit_file"
+    local out=$(mktemp)
+    echo "x" > "$audit_file"
+    timeout 2 cat "$MOUNT_POINT/.loggerfs/journal" > "$out" &
+    local pid=$!
+    sleep 0.5
+    echo "audited" | dd of="$audit_file" bs=8 seek=1 conv=notrunc 2>/dev/null
+    wait $pid
+    grep -qE "^[0-9]+\.[0-9]{9} $(stat -c%i "$audit_file") [0-9]+ .* write 8 8 /audit_file$" "$out"
+    local ok=$?
+    rm -f "$out"
+    return $ok
+}
+
+test_backup_limit() {
+    # backup_max=8K时第二个文件的备份挤掉第一个文件的备份，最新的写仍然可以撤销
+    local mem_mnt=$(mktemp -d)
+    local ok=1
+    mount -t loggerfs -o backup_max=8K none "$mem_mnt" || return 1
+    grep " $mem_mnt " /proc/mounts | grep -q "backup_max=8192" || ok=2
+    for f in a b; do
+        yes "$f" | head -c 8192 > "$mem_mnt/backup_$f"
+        yes "x" | dd of="$mem_mnt/backup_$f" bs=8192 count=1 conv=notrunc iflag=fullblock 2>/dev/null
+    done
+    cd "$PROJECT_DIR"
+    [ $ok = 1 ] && ./logctl "$mem_mnt/backup_b" revert >/dev/null && \
+    [ "$(head -c 1 "$mem_mnt/backup_b")" = "b" ] && ok=0
+    umount "$mem_mnt"
+    rm -rf "$mem_mnt"
+    return $ok
+}
+
 test_large_file_operations() {
     # 测试大文件操作（1MB）
     dd if=/dev/zero of="$TEST_FILE" bs=1024 count=1024 2>/dev/null
@@ -179,6 +415,21 @@ main() {
     run_test "dd偏移读取" "test_dd_read_from_offset"
     run_test "日志功能" "test_log_functionality"
     run_test "撤销功能" "test_revert_functionality"
+    run_test "环形日志淘汰" "test_log_ring_eviction"
+    run_test "日志容量配置" "test_log_config"
+    run_test "命令表" "test_log_cmd_table"
+    run_test "增量读日志" "test_readlog_incremental"
+    run_test "读日志策略" "test_read_policy"
+    run_test "复制和追加" "test_copy_and_append"
+    run_test "堆叠模式持久化" "test_lower_persistence"
+    run_test "意图日志" "test_lower_journal"
+    run_test "fsync" "test_lower_fsync"
+    run_test "多级撤销" "test_multi_level_revert"
+    run_test "mmap写入" "test_mmap_write"
+    run_test "fallocate打洞" "test_punch_hole"
+    run_test "新记录通知" "test_watch"
+    run_test "汇总日志" "test_audit_journal"
+    run_test "备份内存上限" "test_backup_limit"
     run_test "大文件操作" "test_large_file_operations"
     run_test "多文件操作" "test_multiple_files"
     